@@ -0,0 +1,893 @@
+// e2e_bench.c
+// 端到端压测：在本机起一个假的 RTSP 头端和按码率发包的 RTP 发送端，启动真实的 rtspunch，
+// 再用多个 HTTP 观看端拉流，统计起播时间、吞吐、逐包延迟以及 rtspunch 每路流的 CPU 和内存开销。
+//
+// 合成的 TS 流在每个 RTP 包的第一个 TS 包里写入发送时间，观看端据此计算包经过 rtspunch 的延迟；
+// 使用 -f 指定 TS 文件时不统计延迟。
+//
+// 用法: e2e_bench [选项] <rtspunch 路径> [-- rtspunch 的其他参数]
+//   -v 观看端数（默认 8）         -c 频道数，观看端轮流分到各频道（默认 2）
+//   -d 持续秒数（默认 5）          -b 每个频道的码率 kbps（默认 8000）
+//   -k 每个 RTP 包的 TS 包数（默认 7） -r 乱序率 %（默认 0）  -l 丢包率 %（默认 0）
+//   -f 循环发送的 TS 文件          -t 使用 /tcp/，上游走交错 TCP
+//   -a 头端在收到请求后多少毫秒才应答，模拟到头端的往返时间（默认 0）
+//   -s 观看端逐个连接同一频道，收到第一个字节就断开，下一个等上游会话关闭后再连，
+//      用来比较首次握手和缓存握手（-C、-P）的起播时间
+//   -V 显示 rtspunch 的日志
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "histogram.h"
+
+#define TS_PACKET_SIZE 188
+#define BENCH_PID 0x100
+#define BENCH_MAGIC "RSPB"
+#define MAX_RTP_PACKET 2048
+#define SEQUENTIAL_GAP_US 200000
+
+struct bench_opts
+{
+    int viewers;
+    int channels;
+    int seconds;
+    int bitrate_kbps;
+    int ts_per_packet;
+    double reorder_pct;
+    double loss_pct;
+    const char *ts_file;
+    int tcp;
+    int rtt_ms;
+    int sequential;
+    int verbose;
+    const char *rtspunch;
+    char **extra_args;
+    int extra_count;
+};
+
+static struct bench_opts g_opts = {8, 2, 5, 8000, 7, 0, 0, NULL, 0, 0, 0, 0, NULL, NULL, 0};
+static atomic_int g_stop = 0;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int write_full(int fd, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+    while (len > 0)
+    {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// RTP 发送端
+
+struct sender
+{
+    int conn;                 // 交错模式下写入 RTSP 连接
+    pthread_mutex_t *conn_lock;
+    int udp;                  // UDP 模式下的发送 socket
+    struct sockaddr_in dest;
+    int interleaved;
+    int channel;
+    atomic_int stop;
+    pthread_t tid;
+    int running;
+};
+
+static FILE *open_ts_file(void)
+{
+    if (!g_opts.ts_file)
+        return NULL;
+    FILE *f = fopen(g_opts.ts_file, "rb");
+    if (!f)
+        fprintf(stderr, "Failed to open %s: %s\n", g_opts.ts_file, strerror(errno));
+    return f;
+}
+
+// 填充一个 RTP 包的 TS 负载；合成流的第一个 TS 包带发送时间
+static void fill_payload(FILE *file, uint8_t *payload, int count, uint8_t *cc)
+{
+    if (file)
+    {
+        size_t need = (size_t)count * TS_PACKET_SIZE;
+        size_t got = fread(payload, 1, need, file);
+        if (got < need)
+        {
+            rewind(file);
+            got += fread(payload + got, 1, need - got, file);
+        }
+        if (got < need)
+            memset(payload + got, 0xff, need - got);
+        return;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        uint8_t *ts = payload + i * TS_PACKET_SIZE;
+        ts[0] = 0x47;
+        ts[1] = (BENCH_PID >> 8) & 0x1f;
+        ts[2] = BENCH_PID & 0xff;
+        ts[3] = 0x10 | (*cc & 0x0f);
+        (*cc)++;
+        memset(ts + 4, 0xff, TS_PACKET_SIZE - 4);
+        if (i == 0)
+        {
+            uint64_t sent = now_ns();
+            memcpy(ts + 4, BENCH_MAGIC, 4);
+            memcpy(ts + 8, &sent, sizeof(sent));
+        }
+    }
+}
+
+static int sender_emit(struct sender *s, const uint8_t *pkt, size_t len)
+{
+    if (!s->interleaved)
+    {
+        sendto(s->udp, pkt, len, 0, (struct sockaddr *)&s->dest, sizeof(s->dest));
+        return 0;
+    }
+
+    uint8_t hdr[4] = {'$', 0, (uint8_t)(len >> 8), (uint8_t)len};
+    pthread_mutex_lock(s->conn_lock);
+    int ret = write_full(s->conn, hdr, sizeof(hdr));
+    if (ret == 0)
+        ret = write_full(s->conn, pkt, len);
+    pthread_mutex_unlock(s->conn_lock);
+    return ret;
+}
+
+static void *sender_thread(void *arg)
+{
+    struct sender *s = (struct sender *)arg;
+    int count = g_opts.ts_per_packet;
+    size_t len = 12 + (size_t)count * TS_PACKET_SIZE;
+    double pps = (double)g_opts.bitrate_kbps * 1000.0 / 8.0 / (count * TS_PACKET_SIZE);
+    uint8_t pkt[MAX_RTP_PACKET], held[MAX_RTP_PACKET];
+    int holding = 0;
+    uint16_t seq = 0;
+    uint8_t cc = 0;
+    uint64_t sent = 0;
+    uint64_t start = now_ns();
+    unsigned int seed = (unsigned int)start ^ (unsigned int)s->channel;
+    FILE *file = open_ts_file();
+
+    while (!atomic_load(&s->stop) && !atomic_load(&g_stop))
+    {
+        // 按码率计算到现在应发出的包数，每毫秒补发一次
+        uint64_t due = (uint64_t)((now_ns() - start) / 1e9 * pps);
+        for (; sent < due; sent++)
+        {
+            uint32_t rtp_ts = (uint32_t)((now_ns() - start) / 1000 * 9 / 100);
+            pkt[0] = 0x80;
+            pkt[1] = 33;
+            pkt[2] = seq >> 8;
+            pkt[3] = seq & 0xff;
+            pkt[4] = rtp_ts >> 24;
+            pkt[5] = rtp_ts >> 16;
+            pkt[6] = rtp_ts >> 8;
+            pkt[7] = rtp_ts;
+            memcpy(pkt + 8, "\x11\x22\x33\x44", 4);
+            seq++;
+            fill_payload(file, pkt + 12, count, &cc);
+
+            if (rand_r(&seed) % 10000 < g_opts.loss_pct * 100)
+                continue;
+            if (!holding && rand_r(&seed) % 10000 < g_opts.reorder_pct * 100)
+            {
+                memcpy(held, pkt, len);
+                holding = 1;
+                continue;
+            }
+            if (sender_emit(s, pkt, len) < 0)
+                goto out;
+            if (holding)
+            {
+                holding = 0;
+                if (sender_emit(s, held, len) < 0)
+                    goto out;
+            }
+        }
+
+        struct timespec ts = {0, 1000000};
+        nanosleep(&ts, NULL);
+    }
+
+out:
+    if (file)
+        fclose(file);
+    return NULL;
+}
+
+// ---------------------------------------------------------------------------
+// 假 RTSP 头端
+
+struct headend_conn
+{
+    int fd;
+    pthread_mutex_t lock;
+    struct sender sender;
+    char buf[8192];
+    size_t len;
+    uint64_t arrived_ns; // 最近一次收到请求数据的时间
+};
+
+static int headend_port = 0;
+
+static const char *find_header(const char *req, const char *name, char *out, size_t size)
+{
+    size_t nlen = strlen(name);
+    for (const char *line = strstr(req, "\r\n"); line; line = strstr(line, "\r\n"))
+    {
+        line += 2;
+        if (strncasecmp(line, name, nlen) == 0 && line[nlen] == ':')
+        {
+            const char *v = line + nlen + 1;
+            while (*v == ' ')
+                v++;
+            size_t n = strcspn(v, "\r\n");
+            if (n >= size)
+                n = size - 1;
+            memcpy(out, v, n);
+            out[n] = '\0';
+            return out;
+        }
+    }
+    return NULL;
+}
+
+static void headend_reply(struct headend_conn *c, const char *cseq, const char *headers, const char *body)
+{
+    char resp[4096];
+    int n = snprintf(resp, sizeof(resp), "RTSP/1.0 200 OK\r\nCSeq: %s\r\n%sContent-Length: %zu\r\n\r\n%s",
+                     cseq, headers, strlen(body), body);
+
+    // 按请求到达时间计算，同一次收到的流水线请求在同一时刻应答
+    if (g_opts.rtt_ms > 0)
+    {
+        uint64_t due = c->arrived_ns + (uint64_t)g_opts.rtt_ms * 1000000;
+        uint64_t now = now_ns();
+        if (due > now)
+        {
+            struct timespec ts = {(time_t)((due - now) / 1000000000), (long)((due - now) % 1000000000)};
+            nanosleep(&ts, NULL);
+        }
+    }
+
+    pthread_mutex_lock(&c->lock);
+    write_full(c->fd, resp, n);
+    pthread_mutex_unlock(&c->lock);
+}
+
+static void headend_stop_sender(struct headend_conn *c)
+{
+    if (!c->sender.running)
+        return;
+    atomic_store(&c->sender.stop, 1);
+    pthread_join(c->sender.tid, NULL);
+    c->sender.running = 0;
+}
+
+// 处理一个完整的请求，返回 -1 表示关闭连接
+static int headend_request(struct headend_conn *c, char *req)
+{
+    char method[32], url[512], cseq[32], transport[256];
+    char headers[1024] = "";
+    const char *body = "";
+    char sdp[512];
+
+    if (sscanf(req, "%31s %511s", method, url) != 2)
+        return -1;
+    if (!find_header(req, "CSeq", cseq, sizeof(cseq)))
+        strcpy(cseq, "0");
+
+    if (strcmp(method, "OPTIONS") == 0)
+    {
+        snprintf(headers, sizeof(headers), "Public: OPTIONS, DESCRIBE, SETUP, PLAY, GET_PARAMETER, TEARDOWN\r\n");
+    }
+    else if (strcmp(method, "DESCRIBE") == 0)
+    {
+        snprintf(sdp, sizeof(sdp),
+                 "v=0\r\no=- 0 0 IN IP4 127.0.0.1\r\ns=bench\r\nc=IN IP4 0.0.0.0\r\nt=0 0\r\n"
+                 "m=video 0 RTP/AVP 33\r\na=rtpmap:33 MP2T/90000\r\n");
+        snprintf(headers, sizeof(headers), "Content-Base: %s/\r\nContent-Type: application/sdp\r\n", url);
+        body = sdp;
+    }
+    else if (strcmp(method, "SETUP") == 0)
+    {
+        if (!find_header(req, "Transport", transport, sizeof(transport)))
+            return -1;
+
+        char *cp = strstr(transport, "client_port=");
+        if (strstr(transport, "interleaved") || cp == NULL)
+        {
+            c->sender.interleaved = 1;
+            snprintf(headers, sizeof(headers), "Session: 1;timeout=60\r\nTransport: RTP/AVP/TCP;unicast;interleaved=0-1\r\n");
+        }
+        else
+        {
+            int port = atoi(cp + strlen("client_port="));
+            struct sockaddr_in local = {0};
+            socklen_t alen = sizeof(local);
+
+            c->sender.udp = socket(AF_INET, SOCK_DGRAM, 0);
+            local.sin_family = AF_INET;
+            local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            bind(c->sender.udp, (struct sockaddr *)&local, sizeof(local));
+            getsockname(c->sender.udp, (struct sockaddr *)&local, &alen);
+
+            c->sender.dest.sin_family = AF_INET;
+            c->sender.dest.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            c->sender.dest.sin_port = htons(port);
+            snprintf(headers, sizeof(headers), "Session: 1;timeout=60\r\nTransport: RTP/AVP;unicast;client_port=%d-%d;server_port=%d-%d\r\n",
+                     port, port + 1, ntohs(local.sin_port), ntohs(local.sin_port) + 1);
+        }
+    }
+    else if (strcmp(method, "PLAY") == 0)
+    {
+        snprintf(headers, sizeof(headers), "Session: 1\r\nRange: npt=0.000-\r\n");
+        headend_reply(c, cseq, headers, body);
+        if (!c->sender.running)
+        {
+            const char *ch = strstr(url, "/ch");
+            c->sender.channel = ch ? atoi(ch + 3) : 0;
+            c->sender.conn = c->fd;
+            c->sender.conn_lock = &c->lock;
+            atomic_init(&c->sender.stop, 0);
+            c->sender.running = pthread_create(&c->sender.tid, NULL, sender_thread, &c->sender) == 0;
+        }
+        return 0;
+    }
+    else if (strcmp(method, "TEARDOWN") == 0)
+    {
+        headend_stop_sender(c);
+        headend_reply(c, cseq, "Session: 1\r\n", "");
+        return -1;
+    }
+    else if (strcmp(method, "GET_PARAMETER") != 0 && strcmp(method, "SET_PARAMETER") != 0)
+    {
+        return -1;
+    }
+
+    headend_reply(c, cseq, headers, body);
+    return 0;
+}
+
+static void *headend_conn_thread(void *arg)
+{
+    struct headend_conn *c = (struct headend_conn *)arg;
+    c->sender.udp = -1;
+
+    while (!atomic_load(&g_stop))
+    {
+        ssize_t n = recv(c->fd, c->buf + c->len, sizeof(c->buf) - 1 - c->len, 0);
+        if (n < 0 && (errno == EINTR || errno == EAGAIN))
+            continue;
+        if (n <= 0)
+            break;
+        c->len += n;
+        c->buf[c->len] = '\0';
+        c->arrived_ns = now_ns();
+
+        int closing = 0;
+        while (c->len > 0 && !closing)
+        {
+            // rtspunch 在交错模式下可能发来 RTCP 帧
+            if (c->buf[0] == '$')
+            {
+                if (c->len < 4)
+                    break;
+                size_t flen = 4 + (((uint8_t)c->buf[2] << 8) | (uint8_t)c->buf[3]);
+                if (c->len < flen)
+                    break;
+                memmove(c->buf, c->buf + flen, c->len - flen);
+                c->len -= flen;
+                continue;
+            }
+
+            char *end = strstr(c->buf, "\r\n\r\n");
+            if (end == NULL)
+                break;
+            size_t rlen = end + 4 - c->buf;
+            char clen[32];
+            *end = '\0';
+            if (find_header(c->buf, "Content-Length", clen, sizeof(clen)))
+                rlen += atoi(clen);
+            if (rlen > c->len)
+            {
+                *end = '\r';
+                break;
+            }
+
+            closing = headend_request(c, c->buf) < 0;
+            memmove(c->buf, c->buf + rlen, c->len - rlen);
+            c->len -= rlen;
+            c->buf[c->len] = '\0';
+        }
+        if (closing || c->len == sizeof(c->buf) - 1)
+            break;
+    }
+
+    headend_stop_sender(c);
+    if (c->sender.udp >= 0)
+        close(c->sender.udp);
+    close(c->fd);
+    pthread_mutex_destroy(&c->lock);
+    free(c);
+    return NULL;
+}
+
+static void *headend_accept_thread(void *arg)
+{
+    int lfd = (int)(intptr_t)arg;
+
+    while (!atomic_load(&g_stop))
+    {
+        int fd = accept(lfd, NULL, NULL);
+        if (fd < 0)
+            continue;
+
+        struct headend_conn *c = calloc(1, sizeof(*c));
+        pthread_t tid;
+        c->fd = fd;
+        pthread_mutex_init(&c->lock, NULL);
+        if (pthread_create(&tid, NULL, headend_conn_thread, c) != 0)
+        {
+            close(fd);
+            free(c);
+            continue;
+        }
+        pthread_detach(tid);
+    }
+    return NULL;
+}
+
+static int listen_loopback(int *port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    struct sockaddr_in addr = {0};
+    socklen_t alen = sizeof(addr);
+
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 64) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    getsockname(fd, (struct sockaddr *)&addr, &alen);
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+// ---------------------------------------------------------------------------
+// HTTP 观看端
+
+struct viewer
+{
+    int index;
+    int port;                 // rtspunch 的 HTTP 端口
+    pthread_t tid;
+    uint64_t start_ns;
+    uint64_t first_byte_ns;   // 0 表示没有收到数据
+    uint64_t last_byte_ns;
+    uint64_t bytes;
+    uint64_t ts_packets;
+    uint64_t cc_errors;
+    struct histogram latency; // 微秒
+};
+
+static void viewer_consume(struct viewer *v, const uint8_t *ts, uint8_t *last_cc, int *have_cc)
+{
+    int pid = ((ts[1] & 0x1f) << 8) | ts[2];
+    v->ts_packets++;
+    if (pid != BENCH_PID)
+        return;
+
+    uint8_t cc = ts[3] & 0x0f;
+    if (*have_cc && cc != ((*last_cc + 1) & 0x0f))
+        v->cc_errors++;
+    *last_cc = cc;
+    *have_cc = 1;
+
+    if (memcmp(ts + 4, BENCH_MAGIC, 4) == 0)
+    {
+        uint64_t sent;
+        memcpy(&sent, ts + 8, sizeof(sent));
+        uint64_t now = now_ns();
+        if (now > sent)
+            hist_record(&v->latency, (now - sent) / 1000);
+    }
+}
+
+static void *viewer_thread(void *arg)
+{
+    struct viewer *v = (struct viewer *)arg;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {0};
+    struct timeval tv = {0, 200000};
+    char req[512];
+    uint8_t buf[65536];
+    size_t len = 0;
+    int header_done = 0;
+    uint8_t last_cc = 0;
+    int have_cc = 0;
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(v->port);
+
+    v->start_ns = now_ns();
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    int n = snprintf(req, sizeof(req), "GET /%s/127.0.0.1:%d/ch%d HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n",
+                     g_opts.tcp ? "tcp" : "rtp", headend_port, v->index % g_opts.channels);
+    write_full(fd, req, n);
+
+    while (!atomic_load(&g_stop))
+    {
+        ssize_t r = recv(fd, buf + len, sizeof(buf) - len, 0);
+        if (r < 0 && (errno == EAGAIN || errno == EINTR))
+            continue;
+        if (r <= 0)
+            break;
+        len += r;
+
+        if (!header_done)
+        {
+            uint8_t *end = memmem(buf, len, "\r\n\r\n", 4);
+            if (end == NULL)
+                continue;
+            size_t hlen = end + 4 - buf;
+            memmove(buf, buf + hlen, len - hlen);
+            len -= hlen;
+            header_done = 1;
+        }
+        if (len == 0)
+            continue;
+
+        uint64_t now = now_ns();
+        if (v->first_byte_ns == 0)
+            v->first_byte_ns = now;
+        v->last_byte_ns = now;
+        if (g_opts.sequential)
+            break;
+
+        // rtspunch 按槽位写出完整的 TS 包，失步时向后找同步字节
+        size_t off = 0;
+        while (len - off >= TS_PACKET_SIZE)
+        {
+            if (buf[off] != 0x47)
+            {
+                off++;
+                continue;
+            }
+            viewer_consume(v, buf + off, &last_cc, &have_cc);
+            off += TS_PACKET_SIZE;
+        }
+        v->bytes += off;
+        memmove(buf, buf + off, len - off);
+        len -= off;
+    }
+
+    close(fd);
+    return NULL;
+}
+
+// ---------------------------------------------------------------------------
+// rtspunch 进程
+
+static int pick_free_port(void)
+{
+    int port = 0;
+    int fd = listen_loopback(&port);
+    if (fd >= 0)
+        close(fd);
+    return port;
+}
+
+static pid_t start_rtspunch(int port)
+{
+    char port_arg[16];
+    snprintf(port_arg, sizeof(port_arg), "%d", port);
+
+    char **argv = calloc(4 + g_opts.extra_count, sizeof(char *));
+    int argc = 0;
+    argv[argc++] = (char *)g_opts.rtspunch;
+    argv[argc++] = "-p";
+    argv[argc++] = port_arg;
+    for (int i = 0; i < g_opts.extra_count; i++)
+        argv[argc++] = g_opts.extra_args[i];
+    argv[argc] = NULL;
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        if (!g_opts.verbose)
+        {
+            int devnull = open("/dev/null", O_WRONLY);
+            dup2(devnull, STDOUT_FILENO);
+            dup2(devnull, STDERR_FILENO);
+        }
+        execv(g_opts.rtspunch, argv);
+        _exit(127);
+    }
+    free(argv);
+    if (pid < 0)
+        return -1;
+
+    // 等它开始监听
+    for (int i = 0; i < 300; i++)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr = {0};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(port);
+        int ok = connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+        close(fd);
+        if (ok)
+            return pid;
+        if (waitpid(pid, NULL, WNOHANG) == pid)
+            return -1;
+        usleep(10000);
+    }
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    return -1;
+}
+
+// utime + stime，单位毫秒
+static double proc_cpu_ms(pid_t pid)
+{
+    char path[64], buf[1024];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return 0;
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+
+    // 进程名可能含空格，从最后一个 ')' 之后开始数字段
+    char *p = strrchr(buf, ')');
+    unsigned long utime = 0, stime = 0;
+    if (!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2)
+        return 0;
+    return (utime + stime) * 1000.0 / sysconf(_SC_CLK_TCK);
+}
+
+static double proc_rss_mb(pid_t pid)
+{
+    char path[64], line[256];
+    double kb = 0;
+    snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return 0;
+    while (fgets(line, sizeof(line), f))
+    {
+        if (sscanf(line, "VmRSS: %lf kB", &kb) == 1)
+            break;
+    }
+    fclose(f);
+    return kb / 1024.0;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-v viewers] [-c channels] [-d seconds] [-b kbps] [-k ts per rtp] [-r reorder %%] [-l loss %%] [-f ts file] [-t] [-a rtt ms] [-s] [-V] <rtspunch> [-- rtspunch args]\n", prog);
+    exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "v:c:d:b:k:r:l:f:ta:sV")) != -1)
+    {
+        switch (opt)
+        {
+        case 'v':
+            g_opts.viewers = atoi(optarg);
+            break;
+        case 'c':
+            g_opts.channels = atoi(optarg);
+            break;
+        case 'd':
+            g_opts.seconds = atoi(optarg);
+            break;
+        case 'b':
+            g_opts.bitrate_kbps = atoi(optarg);
+            break;
+        case 'k':
+            g_opts.ts_per_packet = atoi(optarg);
+            break;
+        case 'r':
+            g_opts.reorder_pct = atof(optarg);
+            break;
+        case 'l':
+            g_opts.loss_pct = atof(optarg);
+            break;
+        case 'f':
+            g_opts.ts_file = optarg;
+            break;
+        case 't':
+            g_opts.tcp = 1;
+            break;
+        case 'a':
+            g_opts.rtt_ms = atoi(optarg);
+            break;
+        case 's':
+            g_opts.sequential = 1;
+            break;
+        case 'V':
+            g_opts.verbose = 1;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind >= argc)
+        usage(argv[0]);
+    g_opts.rtspunch = argv[optind++];
+    if (optind < argc && strcmp(argv[optind], "--") == 0)
+        optind++;
+    g_opts.extra_args = argv + optind;
+    g_opts.extra_count = argc - optind;
+
+    if (g_opts.viewers < 1 || g_opts.channels < 1 || g_opts.seconds < 1 || g_opts.bitrate_kbps < 1 ||
+        g_opts.ts_per_packet < 1 || 12 + g_opts.ts_per_packet * TS_PACKET_SIZE > MAX_RTP_PACKET)
+        usage(argv[0]);
+    if (g_opts.sequential)
+        g_opts.channels = 1;
+    if (g_opts.channels > g_opts.viewers)
+        g_opts.channels = g_opts.viewers;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    int lfd = listen_loopback(&headend_port);
+    if (lfd < 0)
+    {
+        perror("headend listen");
+        return 1;
+    }
+    pthread_t accept_tid;
+    pthread_create(&accept_tid, NULL, headend_accept_thread, (void *)(intptr_t)lfd);
+    pthread_detach(accept_tid);
+
+    int http_port = pick_free_port();
+    pid_t pid = start_rtspunch(http_port);
+    if (pid < 0)
+    {
+        fprintf(stderr, "Failed to start %s\n", g_opts.rtspunch);
+        return 1;
+    }
+
+    double rss_base = proc_rss_mb(pid);
+    double cpu_start = proc_cpu_ms(pid);
+    uint64_t run_start = now_ns();
+
+    struct viewer *viewers = calloc(g_opts.viewers, sizeof(struct viewer));
+    double rss_peak = rss_base;
+    for (int i = 0; i < g_opts.viewers; i++)
+    {
+        viewers[i].index = i;
+        viewers[i].port = http_port;
+        pthread_create(&viewers[i].tid, NULL, viewer_thread, &viewers[i]);
+        // 逐个模式下等上游会话关闭，下一个观看端重新握手
+        if (g_opts.sequential)
+        {
+            pthread_join(viewers[i].tid, NULL);
+            usleep(SEQUENTIAL_GAP_US);
+        }
+    }
+
+    while (!g_opts.sequential && now_ns() - run_start < (uint64_t)g_opts.seconds * 1000000000ull)
+    {
+        usleep(100000);
+        double rss = proc_rss_mb(pid);
+        if (rss > rss_peak)
+            rss_peak = rss;
+    }
+
+    double cpu_ms = proc_cpu_ms(pid) - cpu_start;
+    double elapsed = (now_ns() - run_start) / 1e9;
+
+    atomic_store(&g_stop, 1);
+    for (int i = 0; i < g_opts.viewers && !g_opts.sequential; i++)
+        pthread_join(viewers[i].tid, NULL);
+
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+
+    // 汇总
+    uint64_t *ttfb = calloc(g_opts.viewers, sizeof(uint64_t));
+    struct hist_snapshot *latency = calloc(1, sizeof(*latency));
+    int started = 0;
+    double mbps_sum = 0;
+    uint64_t cc_errors = 0;
+
+    for (int i = 0; i < g_opts.viewers; i++)
+    {
+        struct viewer *v = &viewers[i];
+        hist_snapshot_add(latency, &v->latency);
+        cc_errors += v->cc_errors;
+        if (v->first_byte_ns == 0)
+            continue;
+        ttfb[started++] = v->first_byte_ns - v->start_ns;
+        if (v->last_byte_ns > v->first_byte_ns)
+            mbps_sum += v->bytes * 8.0 / ((v->last_byte_ns - v->first_byte_ns) / 1e9) / 1e6;
+    }
+    qsort(ttfb, started, sizeof(uint64_t), cmp_u64);
+
+    printf("e2e: %d viewers on %d channels, %d kbps/channel, %d TS/RTP, reorder %.1f%%, loss %.1f%%, %s, %.1f s\n",
+           g_opts.viewers, g_opts.channels, g_opts.bitrate_kbps, g_opts.ts_per_packet,
+           g_opts.reorder_pct, g_opts.loss_pct, g_opts.tcp ? "interleaved tcp" : "udp", elapsed);
+    printf("  viewers receiving data  %d/%d\n", started, g_opts.viewers);
+    if (started > 0)
+    {
+        printf("  time to first byte ms  min %.1f  p50 %.1f  max %.1f\n",
+               ttfb[0] / 1e6, ttfb[started / 2] / 1e6, ttfb[started - 1] / 1e6);
+        if (g_opts.sequential && viewers[0].first_byte_ns)
+            printf("  first session ms       %.1f\n",
+                   (viewers[0].first_byte_ns - viewers[0].start_ns) / 1e6);
+        else
+            printf("  throughput Mbit/s      %.2f per viewer (source %.2f), %.2f total\n",
+                   mbps_sum / started, g_opts.bitrate_kbps / 1000.0, mbps_sum);
+    }
+    if (latency->count > 0)
+        printf("  latency us             p50 %llu  p99 %llu  p999 %llu  max %llu  (%llu samples)\n",
+               (unsigned long long)hist_percentile(latency, 0.5), (unsigned long long)hist_percentile(latency, 0.99),
+               (unsigned long long)hist_percentile(latency, 0.999), (unsigned long long)latency->max,
+               (unsigned long long)latency->count);
+    if (!g_opts.ts_file)
+        printf("  continuity errors      %llu\n", (unsigned long long)cc_errors);
+    printf("  rtspunch cpu           %.1f ms/s per channel, %.2f ms/s per viewer\n",
+           cpu_ms / elapsed / g_opts.channels, cpu_ms / elapsed / g_opts.viewers);
+    printf("  rtspunch rss MB        base %.1f  peak %.1f  %.2f per channel\n",
+           rss_base, rss_peak, (rss_peak - rss_base) / g_opts.channels);
+
+    int failed = started < g_opts.viewers;
+    free(ttfb);
+    free(latency);
+    free(viewers);
+    return failed;
+}
@@ -0,0 +1,245 @@
+// parse_bench.c
+// 解析热路径的微基准：对真实形态的输入反复调用 get_rtp_payload、parse_http_url、
+// parse_rtsp_uri、parse_status_code、get_header_value、stun_parse_response 和 ts_check，输出每次调用的纳秒数。
+// 每项跑若干轮取最快的一轮，减少调度和频率变化的干扰。
+//
+// 用法: parse_bench [iterations]
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "parse.h"
+#include "rtp.h"
+#include "stun.h"
+#include "ts.h"
+
+#define BENCH_ROUNDS 5
+#define TS_PACKETS 7
+#define TS_SLOTS 16 // 16 个槽位正好让连续计数转完整数圈，循环检查时不会报错
+
+static volatile uint64_t g_sink; // 防止编译器把调用优化掉
+
+static uint8_t rtp_plain[12 + TS_PACKETS * 188];
+static uint8_t rtp_ext[12 + 2 * 4 + 4 + 3 * 4 + TS_PACKETS * 188 + 4]; // CSRC + 扩展头 + 填充
+static uint8_t stun_rsp[20 + 4 + 20 + 4 + 8];
+static uint8_t stun_tid[12];
+static uint8_t ts_slots[TS_SLOTS][TS_PACKETS * TS_PACKET_SIZE];
+static uint8_t ts_cc[TS_PID_COUNT];
+static struct ts_check_result ts_result;
+static char rtsp_resp[] =
+    "RTSP/1.0 200 OK\r\n"
+    "CSeq: 4\r\n"
+    "Server: ZXUS USP V100R001\r\n"
+    "Session: 1523648712;timeout=60\r\n"
+    "Transport: MP2T/RTP/UDP;unicast;destination=100.64.12.34;source=183.59.160.61;client_port=40000-40001;server_port=6970-6971;ssrc=5F3A1B2C\r\n"
+    "Cache-Control: no-cache\r\n"
+    "\r\n";
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void fill_rtp(uint8_t *pkt, uint8_t flags, uint16_t seq)
+{
+    pkt[0] = flags;
+    pkt[1] = 33; // MP2T
+    store_be16(pkt + 2, seq);
+    store_be32(pkt + 4, 90000);
+    store_be32(pkt + 8, 0x5F3A1B2C);
+}
+
+static void build_inputs(void)
+{
+    fill_rtp(rtp_plain, 0x80, 1000);
+    for (int i = 0; i < TS_PACKETS; i++)
+        rtp_plain[12 + i * 188] = 0x47;
+
+    // 两个 CSRC、一个 3 字扩展头、4 字节填充
+    fill_rtp(rtp_ext, 0x80 | 0x20 | 0x10 | 2, 1001);
+    uint8_t *ext = rtp_ext + 12 + 2 * 4;
+    store_be16(ext, 0xBEDE);
+    store_be16(ext + 2, 3);
+    uint8_t *ts = ext + 4 + 3 * 4;
+    for (int i = 0; i < TS_PACKETS; i++)
+        ts[i * 188] = 0x47;
+    rtp_ext[sizeof(rtp_ext) - 1] = 4;
+
+    // SOFTWARE 在前，XOR-MAPPED-ADDRESS 在后，需要走一遍属性链
+    memset(stun_tid, 0xA5, sizeof(stun_tid));
+    store_be16(stun_rsp, 0x0101);
+    store_be16(stun_rsp + 2, sizeof(stun_rsp) - 20);
+    store_be32(stun_rsp + 4, 0x2112A442);
+    memcpy(stun_rsp + 8, stun_tid, 12);
+    uint8_t *a = stun_rsp + 20;
+    store_be16(a, 0x8022);
+    store_be16(a + 2, 18); // 填充到 20
+    memcpy(a + 4, "Coturn-4.6.2 'Gorst", 18);
+    a += 4 + 20;
+    store_be16(a, 0x0020);
+    store_be16(a + 2, 8);
+    a[5] = 0x01;
+    store_be16(a + 6, 40000 ^ 0x2112);
+    store_be32(a + 8, 0xB73BA03D ^ 0x2112A442);
+
+    for (int k = 0; k < TS_SLOTS; k++)
+    {
+        for (int j = 0; j < TS_PACKETS; j++)
+        {
+            uint8_t *pkt = ts_slots[k] + j * TS_PACKET_SIZE;
+            pkt[0] = TS_SYNC_BYTE;
+            store_be16(pkt + 1, 0x0100);
+            pkt[3] = 0x10 | ((k * TS_PACKETS + j) & 0x0F);
+        }
+    }
+}
+
+static uint64_t case_rtp_plain(void)
+{
+    uint8_t *payload;
+    int size;
+    uint16_t seq;
+    get_rtp_payload(rtp_plain, sizeof(rtp_plain), &payload, &size, &seq);
+    return size + seq;
+}
+
+static uint64_t case_rtp_ext(void)
+{
+    uint8_t *payload;
+    int size;
+    uint16_t seq;
+    get_rtp_payload(rtp_ext, sizeof(rtp_ext), &payload, &size, &seq);
+    return size + seq;
+}
+
+static uint64_t case_http_url(void)
+{
+    char host[PARSE_HOST_MAX], path[PARSE_PATH_MAX];
+    int port;
+    parse_http_url("/rtp/183.59.160.61:554/PLTV/88888888/224/3221225618/10000100000000060000000000105389_0.smil", host, &port, path);
+    return port + path[0];
+}
+
+static uint64_t case_rtsp_uri(void)
+{
+    struct rtsp_uri uri;
+    parse_rtsp_uri("rtsp://183.59.160.61:554/PLTV/88888888/224/3221225618/10000100000000060000000000105389_0.smil?icpid=SSPID&RTS=1", &uri);
+    return uri.port + uri.path[0];
+}
+
+static uint64_t case_status_code(void)
+{
+    return parse_status_code(rtsp_resp);
+}
+
+// 第一次调用后 Transport 行尾已是 '\0'，之后每次的查找路径相同
+static uint64_t case_header_value(void)
+{
+    char *v = get_header_value(rtsp_resp, "Transport");
+    return v ? (uint64_t)v[0] : 0;
+}
+
+static uint64_t case_stun(void)
+{
+    char ip[64];
+    int port = 0;
+    stun_parse_response(stun_rsp, sizeof(stun_rsp), stun_tid, ip, sizeof(ip), &port);
+    return port;
+}
+
+static uint64_t case_ts_check(void)
+{
+    static int k;
+    ts_check(ts_cc, ts_slots[k], sizeof(ts_slots[k]), &ts_result);
+    k = (k + 1) % TS_SLOTS;
+    return ts_result.packets;
+}
+
+// 确认输入走的是成功路径，而不是在测错误分支
+static int verify_inputs(void)
+{
+    uint8_t *payload;
+    int size;
+    char host[PARSE_HOST_MAX], path[PARSE_PATH_MAX], ip[64];
+    int port = 0;
+    struct rtsp_uri uri;
+
+    if (get_rtp_payload(rtp_plain, sizeof(rtp_plain), &payload, &size, NULL) != 1 || size != TS_PACKETS * 188)
+        return -1;
+    if (get_rtp_payload(rtp_ext, sizeof(rtp_ext), &payload, &size, NULL) != 1 || size != TS_PACKETS * 188 || payload[0] != 0x47)
+        return -1;
+    if (parse_http_url("/rtp/183.59.160.61:554/PLTV/1.smil", host, &port, path) != 0 || port != 554)
+        return -1;
+    if (parse_rtsp_uri("rtsp://183.59.160.61/PLTV/1.smil", &uri) != 0 || uri.port != 554)
+        return -1;
+    if (parse_status_code(rtsp_resp) != 200 || get_header_value(rtsp_resp, "Transport") == NULL)
+        return -1;
+    if (stun_parse_response(stun_rsp, sizeof(stun_rsp), stun_tid, ip, sizeof(ip), &port) != 0 ||
+        port != 40000 || strcmp(ip, "183.59.160.61") != 0)
+        return -1;
+
+    struct ts_check_result r = {0};
+    uint8_t cc[TS_PID_COUNT] = {0};
+    for (int k = 0; k < 2 * TS_SLOTS; k++)
+        ts_check(cc, ts_slots[k % TS_SLOTS], sizeof(ts_slots[0]), &r);
+    if (r.packets != 2 * TS_SLOTS * TS_PACKETS || r.cc_errors || r.sync_errors || r.tei)
+        return -1;
+    return 0;
+}
+
+struct bench_case
+{
+    const char *name;
+    uint64_t (*fn)(void);
+};
+
+static const struct bench_case cases[] = {
+    {"get_rtp_payload", case_rtp_plain},
+    {"get_rtp_payload/csrc+ext+pad", case_rtp_ext},
+    {"parse_http_url", case_http_url},
+    {"parse_rtsp_uri", case_rtsp_uri},
+    {"parse_status_code", case_status_code},
+    {"get_header_value", case_header_value},
+    {"stun_parse_response", case_stun},
+    {"ts_check", case_ts_check},
+};
+
+int main(int argc, char *argv[])
+{
+    long iterations = argc > 1 ? atol(argv[1]) : 1000000;
+    if (iterations <= 0)
+    {
+        fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    build_inputs();
+    if (verify_inputs() != 0)
+    {
+        fprintf(stderr, "benchmark inputs did not parse as expected\n");
+        return 1;
+    }
+
+    printf("%-32s %12s %12s\n", "case", "ns/op", "Mops/s");
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++)
+    {
+        double best = 0;
+        for (int r = 0; r < BENCH_ROUNDS; r++)
+        {
+            uint64_t sum = 0;
+            uint64_t start = now_ns();
+            for (long i = 0; i < iterations; i++)
+                sum += cases[c].fn();
+            double ns = (double)(now_ns() - start) / iterations;
+            g_sink += sum;
+            if (r == 0 || ns < best)
+                best = ns;
+        }
+        printf("%-32s %12.1f %12.2f\n", cases[c].name, best, 1e3 / best);
+    }
+    return 0;
+}
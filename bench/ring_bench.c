@@ -0,0 +1,275 @@
+// ring_bench.c
+// 对比旧的 usleep(1000) 轮询环形缓冲区与 acquire/release + eventfd 唤醒的实现：
+// 生产者按固定速率发布带时间戳的包，消费者统计每个包的排队延迟和两端的 CPU 开销。
+//
+// 用法: ring_bench [poll|event|both] [pps] [seconds]
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+
+#define CACHE_LINE_SIZE 64
+#define RING_SIZE 8192
+#define SLOT_SIZE 1536
+
+struct bench_result
+{
+    uint64_t *latency_ns;
+    double producer_cpu_ms;
+    double consumer_cpu_ms;
+    long consumer_wakeups;
+};
+
+struct bench_ring
+{
+    uint8_t *slots;
+    uint64_t *stamps;
+
+    // 旧实现：普通 int，没有内存序保证
+    volatile int poll_head;
+    volatile int poll_tail;
+
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint64_t head;
+    _Atomic int stalled;
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint64_t tail;
+    _Atomic int waiting;
+
+    int consumer_fd;
+    int producer_fd;
+
+    int event_mode;
+    int pps;
+    uint64_t total;
+    struct bench_result *result;
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static double thread_cpu_ms(long *nvcsw)
+{
+    struct rusage ru;
+    getrusage(RUSAGE_THREAD, &ru);
+    if (nvcsw)
+        *nvcsw = ru.ru_nvcsw;
+    return ru.ru_utime.tv_sec * 1e3 + ru.ru_utime.tv_usec / 1e3 +
+           ru.ru_stime.tv_sec * 1e3 + ru.ru_stime.tv_usec / 1e3;
+}
+
+static void wait_fd(int fd)
+{
+    uint64_t v;
+    while (read(fd, &v, sizeof(v)) < 0 && errno == EINTR)
+        ;
+}
+
+static void signal_fd(int fd)
+{
+    uint64_t one = 1;
+    write(fd, &one, sizeof(one));
+}
+
+static void pace(uint64_t start, uint64_t i, int pps)
+{
+    uint64_t deadline = start + i * 1000000000ull / pps;
+    struct timespec ts = {deadline / 1000000000ull, deadline % 1000000000ull};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+static void *poll_producer(void *arg)
+{
+    struct bench_ring *r = arg;
+    uint64_t start = now_ns();
+
+    for (uint64_t i = 0; i < r->total; i++)
+    {
+        pace(start, i, r->pps);
+        while ((r->poll_head + 1) % RING_SIZE == r->poll_tail)
+            usleep(1000);
+        r->stamps[r->poll_head] = now_ns();
+        memset(r->slots + (size_t)r->poll_head * SLOT_SIZE, (int)i, 188);
+        r->poll_head = (r->poll_head + 1) % RING_SIZE;
+    }
+
+    r->result->producer_cpu_ms = thread_cpu_ms(NULL);
+    return NULL;
+}
+
+static void *poll_consumer(void *arg)
+{
+    struct bench_ring *r = arg;
+
+    for (uint64_t n = 0; n < r->total; n++)
+    {
+        while (r->poll_head == r->poll_tail)
+            usleep(1000);
+        r->result->latency_ns[n] = now_ns() - r->stamps[r->poll_tail];
+        r->poll_tail = (r->poll_tail + 1) % RING_SIZE;
+    }
+
+    r->result->consumer_cpu_ms = thread_cpu_ms(&r->result->consumer_wakeups);
+    return NULL;
+}
+
+static void *event_producer(void *arg)
+{
+    struct bench_ring *r = arg;
+    uint64_t start = now_ns();
+    uint64_t head = 0;
+    uint64_t min_tail = 0;
+
+    for (uint64_t i = 0; i < r->total; i++)
+    {
+        pace(start, i, r->pps);
+
+        while (head - min_tail >= RING_SIZE)
+        {
+            min_tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+            if (head - min_tail < RING_SIZE)
+                break;
+            atomic_store(&r->stalled, 1);
+            min_tail = atomic_load(&r->tail);
+            if (head - min_tail < RING_SIZE)
+            {
+                atomic_store(&r->stalled, 0);
+                break;
+            }
+            wait_fd(r->producer_fd);
+        }
+
+        size_t slot = head % RING_SIZE;
+        r->stamps[slot] = now_ns();
+        memset(r->slots + slot * SLOT_SIZE, (int)i, 188);
+        atomic_store_explicit(&r->head, ++head, memory_order_release);
+
+        atomic_thread_fence(memory_order_seq_cst);
+        if (atomic_load_explicit(&r->waiting, memory_order_relaxed) && atomic_exchange(&r->waiting, 0))
+            signal_fd(r->consumer_fd);
+    }
+
+    r->result->producer_cpu_ms = thread_cpu_ms(NULL);
+    return NULL;
+}
+
+static void *event_consumer(void *arg)
+{
+    struct bench_ring *r = arg;
+    uint64_t tail = 0;
+
+    for (uint64_t n = 0; n < r->total;)
+    {
+        uint64_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+        if (head == tail)
+        {
+            atomic_store(&r->waiting, 1);
+            if (atomic_load(&r->head) == tail)
+                wait_fd(r->consumer_fd);
+            else
+                atomic_store(&r->waiting, 0);
+            continue;
+        }
+
+        while (tail != head)
+        {
+            r->result->latency_ns[n++] = now_ns() - r->stamps[tail % RING_SIZE];
+            atomic_store_explicit(&r->tail, ++tail, memory_order_release);
+        }
+
+        atomic_thread_fence(memory_order_seq_cst);
+        if (atomic_load_explicit(&r->stalled, memory_order_relaxed) && atomic_exchange(&r->stalled, 0))
+            signal_fd(r->producer_fd);
+    }
+
+    r->result->consumer_cpu_ms = thread_cpu_ms(&r->result->consumer_wakeups);
+    return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static int run(int event_mode, int pps, int seconds)
+{
+    struct bench_result result;
+    memset(&result, 0, sizeof(result));
+
+    struct bench_ring *r = NULL;
+    if (posix_memalign((void **)&r, CACHE_LINE_SIZE, sizeof(*r)) != 0)
+        return -1;
+    memset(r, 0, sizeof(*r));
+
+    r->event_mode = event_mode;
+    r->pps = pps;
+    r->total = (uint64_t)pps * seconds;
+    r->result = &result;
+    r->slots = malloc((size_t)RING_SIZE * SLOT_SIZE);
+    r->stamps = calloc(RING_SIZE, sizeof(uint64_t));
+    result.latency_ns = calloc(r->total, sizeof(uint64_t));
+    r->consumer_fd = eventfd(0, EFD_CLOEXEC);
+    r->producer_fd = eventfd(0, EFD_CLOEXEC);
+    if (!r->slots || !r->stamps || !result.latency_ns || r->consumer_fd < 0 || r->producer_fd < 0)
+    {
+        fprintf(stderr, "ring_bench: setup failed\n");
+        return -1;
+    }
+
+    pthread_t prod, cons;
+    pthread_create(&cons, NULL, event_mode ? event_consumer : poll_consumer, r);
+    pthread_create(&prod, NULL, event_mode ? event_producer : poll_producer, r);
+    pthread_join(prod, NULL);
+    pthread_join(cons, NULL);
+
+    qsort(result.latency_ns, r->total, sizeof(uint64_t), cmp_u64);
+    uint64_t p50 = result.latency_ns[r->total / 2];
+    uint64_t p99 = result.latency_ns[r->total * 99 / 100];
+    uint64_t max = result.latency_ns[r->total - 1];
+
+    printf("%-6s pps=%d packets=%llu  latency p50=%.1fus p99=%.1fus max=%.1fus  "
+           "cpu producer=%.1fms consumer=%.1fms  consumer wakeups=%ld\n",
+           event_mode ? "event" : "poll", pps, (unsigned long long)r->total,
+           p50 / 1e3, p99 / 1e3, max / 1e3,
+           result.producer_cpu_ms, result.consumer_cpu_ms, result.consumer_wakeups);
+
+    close(r->consumer_fd);
+    close(r->producer_fd);
+    free(result.latency_ns);
+    free(r->stamps);
+    free(r->slots);
+    free(r);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *mode = argc > 1 ? argv[1] : "both";
+    int pps = argc > 2 ? atoi(argv[2]) : 2000;
+    int seconds = argc > 3 ? atoi(argv[3]) : 3;
+
+    if (pps <= 0 || seconds <= 0)
+    {
+        fprintf(stderr, "Usage: %s [poll|event|both] [pps] [seconds]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (strcmp(mode, "poll") == 0 || strcmp(mode, "both") == 0)
+        run(0, pps, seconds);
+    if (strcmp(mode, "event") == 0 || strcmp(mode, "both") == 0)
+        run(1, pps, seconds);
+
+    return 0;
+}
@@ -0,0 +1,53 @@
+// parse_http_url、parse_mcast_addr、parse_ts_options 和 parse_query_take：HTTP 请求行里的 URL，长度与 handle_http_request 中的 %511s 一致
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "parse.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    if (size > 511)
+        return 0;
+
+    char *url = malloc(size + 1);
+    memcpy(url, data, size);
+    url[size] = '\0';
+
+    char *host = malloc(PARSE_HOST_MAX);
+    char *path = malloc(PARSE_PATH_MAX);
+    int port;
+    if (parse_http_url(url, host, &port, path) == 0)
+    {
+        if (strlen(host) >= PARSE_HOST_MAX || strlen(path) >= PARSE_PATH_MAX)
+            abort();
+
+        size_t path_len = strlen(path);
+        int program;
+        char drop[128];
+        if (parse_ts_options(path, &program, drop, sizeof(drop)) >= 0 && strlen(path) > path_len)
+            abort();
+
+        char lag[16];
+        path_len = strlen(path);
+        if (parse_query_take(path, "lag", lag, sizeof(lag)) == 1 && strlen(path) >= path_len)
+            abort();
+    }
+
+    // 规范化后的组播地址必须能原样解析回来
+    struct mcast_group g, again;
+    const char *rest;
+    if (parse_mcast_addr(url, &g, &rest) == 0)
+    {
+        char key[128];
+        if (*rest != '\0' && *rest != '?')
+            abort();
+        if (format_mcast_addr(&g, key, sizeof(key)) != 0 || parse_mcast_addr(key, &again, &rest) != 0 ||
+            *rest != '\0' || memcmp(&g, &again, sizeof(g)) != 0)
+            abort();
+    }
+
+    free(path);
+    free(host);
+    free(url);
+    return 0;
+}
@@ -0,0 +1,27 @@
+// get_rtp_payload：输入即一个 UDP 报文
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rtp.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    if (size > 65535)
+        return 0;
+
+    // 复制到恰好 size 字节的堆内存，越界读能被 ASan 发现
+    uint8_t *buf = malloc(size ? size : 1);
+    memcpy(buf, data, size);
+
+    uint8_t *payload;
+    int len;
+    uint16_t seqn;
+    if (get_rtp_payload(buf, (int)size, &payload, &len, &seqn) >= 0)
+    {
+        if (payload < buf || len < 0 || payload + len > buf + size)
+            abort();
+    }
+
+    free(buf);
+    return 0;
+}
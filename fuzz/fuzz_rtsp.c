@@ -0,0 +1,75 @@
+// RTSP 侧的文本解析：第一个字节选择入口，其余为输入
+// 0: parse_rtsp_uri  1: parse_status_code + get_header_value  2: parse_response_length
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "parse.h"
+
+static const char *headers[] = {"Public", "Content-Base", "Content-Location", "Session", "Transport"};
+
+// 头部里的 NUL 不能让按行查找越过头部结尾
+static void check_nul_in_header(void)
+{
+    static const char resp[] = "RTSP/1.0 200 OK\r\nCSeq: 1\0x\r\nContent-Length: 2\r\n\r\nokRTSP";
+    if (parse_response_length(resp, sizeof(resp) - 1) != sizeof(resp) - 1 - 4)
+        abort();
+    static const char cut[] = "RTSP/1.0 200 OK\r\nX: \0\r\n\r\n";
+    if (parse_response_length(cut, sizeof(cut) - 1) != sizeof(cut) - 1)
+        abort();
+}
+
+int LLVMFuzzerInitialize(int *argc, char ***argv)
+{
+    check_nul_in_header();
+    return 0;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    if (size < 1 || size > 65536)
+        return 0;
+
+    int mode = data[0] % 3;
+    data++;
+    size--;
+
+    // 与接收缓冲区一样，后面可能紧跟二进制数据，不以 NUL 结尾
+    if (mode == 2)
+    {
+        char *raw = malloc(size ? size : 1);
+        memcpy(raw, data, size);
+        size_t len = parse_response_length(raw, size);
+        if (len > size)
+            abort();
+        free(raw);
+        return 0;
+    }
+
+    char *str = malloc(size + 1);
+    memcpy(str, data, size);
+    str[size] = '\0';
+
+    if (mode == 0)
+    {
+        struct rtsp_uri uri;
+        if (parse_rtsp_uri(str, &uri) == 0)
+        {
+            if (strlen(uri.host) >= sizeof(uri.host) || strlen(uri.path) >= sizeof(uri.path) || uri.port <= 0)
+                abort();
+        }
+    }
+    else if (mode == 1)
+    {
+        parse_status_code(str);
+        // 与 on_setup 等回调一样，在同一个缓冲区上依次取多个头部
+        for (size_t i = 0; i < sizeof(headers) / sizeof(headers[0]); i++)
+        {
+            char *v = get_header_value(str, headers[i]);
+            if (v && (v < str || v > str + size))
+                abort();
+        }
+    }
+
+    free(str);
+    return 0;
+}
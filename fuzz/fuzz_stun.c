@@ -0,0 +1,30 @@
+// stun_parse_response：事务 ID 取自输入本身，让模糊器能走到属性解析
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "stun.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    if (size > 2048)
+        return 0;
+
+    unsigned char *rsp = malloc(size ? size : 1);
+    memcpy(rsp, data, size);
+
+    unsigned char tid[12] = {0};
+    if (size >= 20)
+        memcpy(tid, rsp + 8, 12);
+
+    char ip[INET_ADDRSTRLEN];
+    int port = -1;
+    if (stun_parse_response(rsp, size, tid, ip, sizeof(ip), &port) == 0)
+    {
+        if (port < 0 || port > 65535 || memchr(ip, '\0', sizeof(ip)) == NULL)
+            abort();
+    }
+
+    free(rsp);
+    return 0;
+}
@@ -0,0 +1,129 @@
+// ts_scan 与 ts_filter_apply：输入为一个槽位的 TS 负载，第一个字节选择节目号。
+// 启动时先检查一个跨两个 TS 包的 PMT
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ts.h"
+
+#define CHECK_PROGRAM 1
+#define CHECK_PMT_PID 0x100
+#define CHECK_VIDEO_PID 0x101
+#define CHECK_AUDIO_PID 0x110
+#define CHECK_AUDIO_TRACKS 20 // 每条带语言描述符，PMT 约 250 字节，要分两个 TS 包
+
+static uint32_t crc32_mpeg(const uint8_t *p, size_t len)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    while (len--)
+    {
+        crc ^= (uint32_t)*p++ << 24;
+        for (int i = 0; i < 8; i++)
+            crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7 : crc << 1;
+    }
+    return crc;
+}
+
+static size_t put_crc(uint8_t *sec, size_t len)
+{
+    uint32_t crc = crc32_mpeg(sec, len);
+    sec[len] = crc >> 24;
+    sec[len + 1] = crc >> 16;
+    sec[len + 2] = crc >> 8;
+    sec[len + 3] = crc;
+    return len + 4;
+}
+
+static uint8_t *put_header(uint8_t *pkt, int pid, int pusi, int cc)
+{
+    memset(pkt, 0xFF, TS_PACKET_SIZE);
+    pkt[0] = TS_SYNC_BYTE;
+    pkt[1] = (pusi ? 0x40 : 0) | pid >> 8;
+    pkt[2] = pid;
+    pkt[3] = 0x10 | cc;
+    return pkt + 4;
+}
+
+// 跨两个 TS 包的 PMT 也要学到全部 ES，选中节目的音视频都要放行
+static void check_two_packet_pmt(void)
+{
+    uint8_t in[6 * TS_PACKET_SIZE], out[sizeof(in)];
+    uint8_t sec[TS_PSI_SECTION_MAX];
+    size_t len;
+
+    uint8_t *p = put_header(in, TS_PID_PAT, 1, 0);
+    p[0] = 0;
+    uint8_t pat[] = {0x00, 0xB0, 13, 0, 1, 0xC1, 0, 0, 0, CHECK_PROGRAM, 0xE0 | CHECK_PMT_PID >> 8, CHECK_PMT_PID & 0xFF};
+    memcpy(sec, pat, sizeof(pat));
+    memcpy(p + 1, sec, put_crc(sec, sizeof(pat)));
+
+    uint8_t head[] = {0x02, 0xB0, 0, 0, CHECK_PROGRAM, 0xC1, 0, 0, 0xE0 | CHECK_VIDEO_PID >> 8, CHECK_VIDEO_PID & 0xFF, 0xF0, 0};
+    memcpy(sec, head, sizeof(head));
+    len = sizeof(head);
+    uint8_t video[] = {0x1B, 0xE0 | CHECK_VIDEO_PID >> 8, CHECK_VIDEO_PID & 0xFF, 0xF0, 0};
+    memcpy(sec + len, video, sizeof(video));
+    len += sizeof(video);
+    for (int i = 0; i < CHECK_AUDIO_TRACKS; i++)
+    {
+        int pid = CHECK_AUDIO_PID + i;
+        uint8_t audio[] = {0x0F, 0xE0 | pid >> 8, pid & 0xFF, 0xF0, 6, 0x0A, 4, 'c', 'h', 'i', 0};
+        memcpy(sec + len, audio, sizeof(audio));
+        len += sizeof(audio);
+    }
+    sec[1] = 0xB0 | (len + 4 - 3) >> 8;
+    sec[2] = (len + 4 - 3) & 0xFF;
+    len = put_crc(sec, len);
+
+    size_t first = TS_PACKET_SIZE - 5;
+    if (len <= first)
+        abort();
+    p = put_header(in + TS_PACKET_SIZE, CHECK_PMT_PID, 1, 0);
+    p[0] = 0;
+    memcpy(p + 1, sec, first);
+    p = put_header(in + 2 * TS_PACKET_SIZE, CHECK_PMT_PID, 0, 1);
+    memcpy(p, sec + first, len - first);
+
+    put_header(in + 3 * TS_PACKET_SIZE, CHECK_VIDEO_PID, 1, 0);
+    put_header(in + 4 * TS_PACKET_SIZE, CHECK_AUDIO_PID + CHECK_AUDIO_TRACKS - 1, 1, 0);
+    put_header(in + 5 * TS_PACKET_SIZE, 0x200, 1, 0); // 不在 PMT 里
+
+    static struct ts_filter filter;
+    if (ts_filter_init(&filter, CHECK_PROGRAM, NULL) != 0)
+        abort();
+    // PAT、两个 PMT 包、视频和最后一条音轨
+    if (ts_filter_apply(&filter, in, sizeof(in), out) != 5 * TS_PACKET_SIZE)
+        abort();
+}
+
+int LLVMFuzzerInitialize(int *argc, char ***argv)
+{
+    check_two_packet_pmt();
+    return 0;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    if (size < 1 || size > 64 * TS_PACKET_SIZE)
+        return 0;
+
+    int program = data[0] & 0x7;
+    data++;
+    size--;
+
+    uint8_t *buf = malloc(size ? size : 1);
+    uint8_t *out = malloc(size ? size : 1);
+    memcpy(buf, data, size);
+
+    struct ts_psi psi;
+    ts_psi_init(&psi);
+    ts_scan(&psi, buf, size);
+
+    static struct ts_filter filter;
+    if (ts_filter_init(&filter, program ? program : -1, "eit,0x1000") != 0)
+        abort();
+    if (ts_filter_apply(&filter, buf, size, out) > size)
+        abort();
+
+    free(out);
+    free(buf);
+    return 0;
+}
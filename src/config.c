@@ -1,11 +1,19 @@
 // config.c
 #include "config.h"
 #include <stdio.h>
+#include <unistd.h>
+
+static struct server_config g_config = {0, 0, MAX_RTP_BUFFER_SIZE, MAX_UDP_PACKET_SIZE, 0, 0, RECV_BATCH_SIZE, 0, SEND_BATCH_SIZE, SEND_FLUSH_MS, 0, REORDER_HOLD_MS, 0,
+                                         0, LINGER_MAX_SESSIONS, LINGER_MAX_MB, 0, 0, DNS_CACHE_TTL_MS, STUN_SERVERS,
+                                         RTP_PORT_MIN, RTP_PORT_MAX, RTP_PORT_POOL, RTP_SOCKET_RCVBUF, 0, NULL, 0, LAG_LIMIT_PERCENT};
 
 void init_server_config(void)
 {
     g_config.port = 3250;
     g_config.enable_nat = 0;
+
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    g_config.workers = ncpu > 0 ? (int)ncpu : 1;
 }
 
 const struct server_config *get_server_config(void)
@@ -31,4 +39,124 @@ void set_max_rtp_buffer_size(int size)
 void set_max_udp_packet_size(int size)
 {
     g_config.max_udp_packet_size = size;
-}
\ No newline at end of file
+}
+
+void set_workers(int workers)
+{
+    g_config.workers = workers;
+}
+
+void set_hugepages(int enable)
+{
+    g_config.hugepages = enable;
+}
+
+void set_recv_batch(int batch)
+{
+    g_config.recv_batch = batch;
+}
+
+void set_recv_timeout(int timeout_ms)
+{
+    g_config.recv_timeout_ms = timeout_ms;
+}
+
+void set_send_batch(int batch)
+{
+    g_config.send_batch = batch;
+}
+
+void set_send_flush(int flush_ms)
+{
+    g_config.send_flush_ms = flush_ms;
+}
+
+void set_zerocopy(int enable)
+{
+    g_config.zerocopy = enable;
+}
+
+void set_reorder_hold(int hold_ms)
+{
+    g_config.reorder_ms = hold_ms;
+}
+
+void set_gop_cache(int enable)
+{
+    g_config.gop_cache = enable;
+}
+
+void set_linger(int linger_ms)
+{
+    g_config.linger_ms = linger_ms;
+}
+
+void set_linger_max(int sessions)
+{
+    g_config.linger_max = sessions;
+}
+
+void set_linger_mb(int mb)
+{
+    g_config.linger_mb = mb;
+}
+
+void set_handshake_ttl(int ttl_ms)
+{
+    g_config.handshake_ttl_ms = ttl_ms;
+}
+
+void set_pipeline(int enable)
+{
+    g_config.pipeline = enable;
+}
+
+void set_dns_ttl(int ttl_ms)
+{
+    g_config.dns_ttl_ms = ttl_ms;
+}
+
+void set_stun_servers(const char *servers)
+{
+    g_config.stun_servers = servers;
+}
+
+// 格式为 min-max，防火墙只放行这一段端口
+int set_port_range(const char *range)
+{
+    int lo, hi;
+    if (sscanf(range, "%d-%d", &lo, &hi) != 2 || lo < 1 || hi > 65535 || hi <= lo)
+        return -1;
+    g_config.port_min = lo;
+    g_config.port_max = hi;
+    return 0;
+}
+
+void set_port_pool(int pairs)
+{
+    g_config.port_pool = pairs;
+}
+
+void set_stun_warmup(int enable)
+{
+    g_config.stun_warmup = enable;
+}
+
+void set_mcast_if(const char *ifname)
+{
+    g_config.mcast_if = ifname;
+}
+
+void set_lag_policy(int policy)
+{
+    g_config.lag_policy = policy;
+}
+
+// 占环形缓冲区的百分比，留出余量让客户端在缓冲区满之前跳走
+int set_lag_limit(int percent)
+{
+    if (percent < 10 || percent > 95)
+        return -1;
+    g_config.lag_limit = percent;
+    return 0;
+}
@@ -4,6 +4,19 @@
 #define MAX_RTP_BUFFER_SIZE 8192
 #define MAX_UDP_PACKET_SIZE 1536
 #define MAX_CONNECTIONS 3
+#define RECV_BATCH_SIZE 32
+#define SEND_BATCH_SIZE 64
+#define SEND_FLUSH_MS 10
+#define REORDER_HOLD_MS 20
+#define LINGER_MAX_SESSIONS 4
+#define LINGER_MAX_MB 64
+#define DNS_CACHE_TTL_MS 60000
+#define RTP_PORT_MIN 10000
+#define RTP_PORT_MAX 59999
+#define RTP_PORT_POOL 8
+#define RTP_SOCKET_RCVBUF (4 << 20)
+#define LAG_LIMIT_PERCENT 75
+#define STUN_SERVERS "stun.l.google.com:19302,stun1.l.google.com:19302,stun2.l.google.com:19302"
 
 struct server_config
 {
@@ -11,10 +24,32 @@ struct server_config
     int enable_nat;
     int max_rtp_buffer_size;
     int max_udp_packet_size;
+    int workers;
+    int hugepages;
+    int recv_batch;
+    int recv_timeout_ms;
+    int send_batch;
+    int send_flush_ms;
+    int zerocopy;
+    int reorder_ms;
+    int gop_cache;
+    int linger_ms;
+    int linger_max;
+    int linger_mb;
+    int handshake_ttl_ms;
+    int pipeline;
+    int dns_ttl_ms;
+    const char *stun_servers;
+    int port_min;
+    int port_max;
+    int port_pool;
+    int sock_rcvbuf;
+    int stun_warmup;
+    const char *mcast_if;
+    int lag_policy;
+    int lag_limit;
 };
 
-static struct server_config g_config = {0, 0, 8192, 1536};
-
 void init_server_config(void);
 
 const struct server_config *get_server_config(void);
@@ -26,4 +61,28 @@ void set_enable_nat(int enable);
 void set_max_rtp_buffer_size(int size);
 void set_max_udp_packet_size(int size);
 
-#endif
\ No newline at end of file
+void set_workers(int workers);
+void set_hugepages(int enable);
+
+void set_recv_batch(int batch);
+void set_recv_timeout(int timeout_ms);
+void set_send_batch(int batch);
+void set_send_flush(int flush_ms);
+void set_zerocopy(int enable);
+void set_reorder_hold(int hold_ms);
+void set_gop_cache(int enable);
+void set_linger(int linger_ms);
+void set_linger_max(int sessions);
+void set_linger_mb(int mb);
+void set_handshake_ttl(int ttl_ms);
+void set_pipeline(int enable);
+void set_dns_ttl(int ttl_ms);
+void set_stun_servers(const char *servers);
+int set_port_range(const char *range);
+void set_port_pool(int pairs);
+void set_stun_warmup(int enable);
+void set_mcast_if(const char *ifname);
+void set_lag_policy(int policy);
+int set_lag_limit(int percent);
+
+#endif
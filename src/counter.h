@@ -0,0 +1,30 @@
+#ifndef COUNTER_H
+#define COUNTER_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+// 单写者计数器：只有所属线程写入，其他线程随时读取。
+// 不用 atomic_fetch_add，热路径上只是普通的读和写，没有带 lock 前缀的指令
+static inline void stat_add(_Atomic uint64_t *c, uint64_t n)
+{
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+static inline void stat_max(_Atomic uint64_t *c, uint64_t v)
+{
+    if (v > atomic_load_explicit(c, memory_order_relaxed))
+        atomic_store_explicit(c, v, memory_order_relaxed);
+}
+
+static inline void stat_set(_Atomic uint64_t *c, uint64_t v)
+{
+    atomic_store_explicit(c, v, memory_order_relaxed);
+}
+
+static inline uint64_t stat_get(_Atomic uint64_t *c)
+{
+    return atomic_load_explicit(c, memory_order_relaxed);
+}
+
+#endif
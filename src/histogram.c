@@ -0,0 +1,104 @@
+#include "histogram.h"
+
+// 第 i 格覆盖的最大值
+static uint64_t hist_bucket_upper(int i)
+{
+    if (i < HIST_SUB)
+        return (uint64_t)i;
+
+    int e = i / HIST_SUB + HIST_SUB_BITS - 1;
+    uint64_t sub = (uint64_t)(i % HIST_SUB);
+    return ((HIST_SUB + sub + 1) << (e - HIST_SUB_BITS)) - 1;
+}
+
+void hist_merge(struct histogram *dst, struct histogram *src)
+{
+    uint64_t count = stat_get(&src->count);
+    if (count == 0)
+        return;
+
+    for (int i = 0; i < HIST_BUCKETS; i++)
+    {
+        uint64_t n = stat_get(&src->buckets[i]);
+        if (n)
+            stat_add(&dst->buckets[i], n);
+    }
+    stat_add(&dst->count, count);
+    stat_add(&dst->sum, stat_get(&src->sum));
+    stat_max(&dst->max, stat_get(&src->max));
+}
+
+void hist_merge_shared(struct histogram *dst, struct histogram *src)
+{
+    uint64_t count = stat_get(&src->count);
+    if (count == 0)
+        return;
+
+    for (int i = 0; i < HIST_BUCKETS; i++)
+    {
+        uint64_t n = stat_get(&src->buckets[i]);
+        if (n)
+            atomic_fetch_add_explicit(&dst->buckets[i], n, memory_order_relaxed);
+    }
+    atomic_fetch_add_explicit(&dst->count, count, memory_order_relaxed);
+    atomic_fetch_add_explicit(&dst->sum, stat_get(&src->sum), memory_order_relaxed);
+
+    uint64_t max = stat_get(&src->max);
+    uint64_t cur = stat_get(&dst->max);
+    while (max > cur && !atomic_compare_exchange_weak_explicit(&dst->max, &cur, max, memory_order_relaxed, memory_order_relaxed))
+        ;
+}
+
+void hist_snapshot_add(struct hist_snapshot *dst, struct histogram *src)
+{
+    uint64_t count = stat_get(&src->count);
+    if (count == 0)
+        return;
+
+    for (int i = 0; i < HIST_BUCKETS; i++)
+        dst->buckets[i] += stat_get(&src->buckets[i]);
+    dst->count += count;
+    dst->sum += stat_get(&src->sum);
+    uint64_t max = stat_get(&src->max);
+    if (max > dst->max)
+        dst->max = max;
+}
+
+void hist_snapshot_merge(struct hist_snapshot *dst, const struct hist_snapshot *src)
+{
+    if (src->count == 0)
+        return;
+
+    for (int i = 0; i < HIST_BUCKETS; i++)
+        dst->buckets[i] += src->buckets[i];
+    dst->count += src->count;
+    dst->sum += src->sum;
+    if (src->max > dst->max)
+        dst->max = src->max;
+}
+
+uint64_t hist_percentile(const struct hist_snapshot *h, double q)
+{
+    // 各格与 count 不是同一时刻读到的，以各格之和为准
+    uint64_t total = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++)
+        total += h->buckets[i];
+    if (total == 0)
+        return 0;
+
+    uint64_t rank = (uint64_t)(q * (double)total);
+    if (rank >= total)
+        rank = total - 1;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++)
+    {
+        seen += h->buckets[i];
+        if (seen > rank)
+        {
+            uint64_t upper = hist_bucket_upper(i);
+            return upper < h->max ? upper : h->max;
+        }
+    }
+    return h->max;
+}
@@ -0,0 +1,60 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+#include "counter.h"
+
+// 对数线性直方图：每个 2 的幂区间再等分 16 份，相对误差约 6%。
+// 数值单位为微秒，超过 2^28 us（约 4.5 分钟）的计入最后一格
+#define HIST_SUB_BITS 4
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_MAX_EXP 27
+#define HIST_BUCKETS ((HIST_MAX_EXP - HIST_SUB_BITS + 2) * HIST_SUB)
+
+// 单写者直方图，与其他计数一样由所属线程写入，其他线程随时读取
+struct histogram
+{
+    _Atomic uint64_t count;
+    _Atomic uint64_t sum;
+    _Atomic uint64_t max;
+    _Atomic uint64_t buckets[HIST_BUCKETS];
+};
+
+// 抓取时合并出来的普通副本
+struct hist_snapshot
+{
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[HIST_BUCKETS];
+};
+
+static inline int hist_bucket(uint64_t v)
+{
+    if (v < HIST_SUB)
+        return (int)v;
+    if (v >= (2ULL << HIST_MAX_EXP))
+        return HIST_BUCKETS - 1;
+
+    int e = 63 - __builtin_clzll(v);
+    return (e - HIST_SUB_BITS + 1) * HIST_SUB + (int)((v >> (e - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+static inline void hist_record(struct histogram *h, uint64_t v)
+{
+    stat_add(&h->buckets[hist_bucket(v)], 1);
+    stat_add(&h->count, 1);
+    stat_add(&h->sum, v);
+    stat_max(&h->max, v);
+}
+
+// 并入另一个单写者直方图，调用方保证 dst 没有其他写者
+void hist_merge(struct histogram *dst, struct histogram *src);
+// 并入多个线程共享的直方图
+void hist_merge_shared(struct histogram *dst, struct histogram *src);
+void hist_snapshot_add(struct hist_snapshot *dst, struct histogram *src);
+void hist_snapshot_merge(struct hist_snapshot *dst, const struct hist_snapshot *src);
+// q 取 0..1，返回该分位所在格的上界，不超过最大值
+uint64_t hist_percentile(const struct hist_snapshot *h, double q);
+
+#endif
@@ -1,38 +1,56 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <arpa/inet.h>
-#include <pthread.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/select.h>
 #include <strings.h>
 #include <signal.h>
 #include <getopt.h>
+#include <ctype.h>
 
 #include "rtsp.h"
+#include "session.h"
+#include "loop.h"
 #include "rtp.h"
 #include "rtcp.h"
 #include "logs.h"
 #include "config.h"
+#include "portpool.h"
+#include "metrics.h"
+#include "parse.h"
 
 
-typedef struct
+#define HTTP_REQUEST_TIMEOUT_MS 10000
+
+struct http_client
 {
-    int client_fd;
+    struct rtp_reader reader;
+    struct ev_timer timer;
     struct sockaddr_in client_addr;
-} client_info_t;
+    char buf[4096];
+    int len;
+    char rtsp_url[512];
+    char *out; // 统计接口的响应，写完即关闭
+    size_t out_len;
+    size_t out_sent;
+};
 
 int create_listen_socket(int port)
 {
-    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    int sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
     if (sockfd < 0)
     {
         perror("socket");
         return -1;
     }
 
+    int on = 1;
+    setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
     struct sockaddr_in addr;
     memset(&addr, 0, sizeof(addr));
     addr.sin_family = AF_INET;
@@ -46,7 +64,7 @@ int create_listen_socket(int port)
         return -1;
     }
 
-    if (listen(sockfd, 5) < 0)
+    if (listen(sockfd, SOMAXCONN) < 0)
     {
         perror("listen");
         close(sockfd);
@@ -56,114 +74,325 @@ int create_listen_socket(int port)
     return sockfd;
 }
 
-int parse_http_url(const char *url, char *host, int *port, char *path)
+static void client_free(struct ev_loop *loop, void *arg)
 {
+    struct http_client *client = (struct http_client *)arg;
 
-    if (strncmp(url, "/rtp/", 5) == 0)
-    {
-        if (sscanf(url + 5, "%127[^:]:%d/%511[^\n]", host, port, path) == 3)
-        {
-            return 0;
-        }
-    }
-    return -1;
+    free(client->reader.filtered);
+    free(client->reader.carry);
+    free(client->out);
+    free(client);
 }
 
-void *handle_http_request(void *arg)
+static void client_close(struct rtp_reader *reader)
 {
-    char buf[4096];
-    client_info_t *info = (client_info_t *)arg;
-    int client_fd = info->client_fd;
+    struct http_client *client = (struct http_client *)reader;
+
+    LOG_INFO("Client disconnected: %s:%d -> %s, %llu packets in %llu writes, %llu bytes zerocopy, %llu bytes copied", inet_ntoa(client->client_addr.sin_addr), ntohs(client->client_addr.sin_port), client->rtsp_url,
+             (unsigned long long)reader->send_packets, (unsigned long long)reader->send_calls,
+             (unsigned long long)reader->zc_bytes, (unsigned long long)reader->copied_bytes);
+    close(reader->http_sock);
+    loop_defer(loop_current(), client_free, client);
+}
+
+static void client_abort(struct ev_loop *loop, struct http_client *client)
+{
+    loop_timer_stop(loop, &client->timer);
+    loop_io_stop(loop, &client->reader.io);
+    client_close(&client->reader);
+}
+
+// 写一个错误状态后关闭，不等客户端读完
+static void client_reject(struct ev_loop *loop, struct http_client *client, const char *status)
+{
+    char resp[128];
+    int n = snprintf(resp, sizeof(resp), "HTTP/1.1 %s\r\nConnection: close\r\nContent-Length: 0\r\n\r\n", status);
+    send(client->reader.http_sock, resp, n, MSG_DONTWAIT | MSG_NOSIGNAL);
+    client_abort(loop, client);
+}
 
-    int n = recv(client_fd, buf, sizeof(buf) - 1, 0);
+// 把统计接口的响应写完后关闭，socket 写满时等 EPOLLOUT，不在工作线程上阻塞
+static void http_write_cb(struct ev_loop *loop, struct ev_io *io, uint32_t events)
+{
+    struct http_client *client = (struct http_client *)io->data;
 
-    if (n <= 0)
+    while (client->out_sent < client->out_len)
     {
-        LOG_ERROR("Failed to receive HTTP request or client disconnected.");
-        goto cleanup;
+        ssize_t n = send(client->reader.http_sock, client->out + client->out_sent, client->out_len - client->out_sent,
+                         MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            if (io->cb != http_write_cb)
+            {
+                io->cb = http_write_cb;
+                loop_io_modify(loop, io, EPOLLOUT);
+            }
+            return;
+        }
+        if (n < 0)
+        {
+            LOG_WARN("Failed to send metrics: %s", strerror(errno));
+            break;
+        }
+        client->out_sent += n;
     }
+    client_abort(loop, client);
+}
 
-    buf[n] = 0;
-
-    char url[512], host[128], path[256];
+static void handle_http_request(struct ev_loop *loop, struct http_client *client)
+{
+    char *buf = client->buf;
+    char url[512], host[PARSE_HOST_MAX], path[PARSE_PATH_MAX];
     int port;
 
-    if (sscanf(buf, "GET %511s HTTP/1.1", url) != 1)
+    int url_end = 0;
+    if (sscanf(buf, "GET %511s%n", url, &url_end) != 1)
     {
         LOG_ERROR("Failed to parse HTTP request URL");
-        goto cleanup;
+        client_abort(loop, client);
+        return;
     }
-    if (parse_http_url(url, host, &port, path) != 0)
+    // 超长的 URL 被截断后可能和别的地址撞上同一个会话
+    if (url_end - 4 == (int)sizeof(url) - 1 && !isspace((unsigned char)buf[url_end]))
     {
-        LOG_ERROR("Failed to parse URL: %s", url);
-        goto cleanup;
+        LOG_ERROR("HTTP request URL too long");
+        client_reject(loop, client, "414 URI Too Long");
+        return;
+    }
+    const char *version = buf + url_end;
+    while (*version == ' ')
+        version++;
+    if (version == buf + url_end || strncmp(version, "HTTP/1.", 7) != 0 || !isdigit((unsigned char)version[7]) ||
+        (version[8] != '\r' && version[8] != '\n'))
+    {
+        LOG_ERROR("Invalid HTTP version in request line");
+        client_reject(loop, client, "400 Bad Request");
+        return;
     }
 
-    char rtsp_url[512];
-    snprintf(rtsp_url, sizeof(rtsp_url), "rtsp://%s:%d/%s", host, port, path);
+    // 统计接口，写完即关闭连接
+    size_t url_len = strcspn(url, "?");
+    if ((url_len == 8 && strncmp(url, "/metrics", 8) == 0) || (url_len == 7 && strncmp(url, "/status", 7) == 0))
+    {
+        snprintf(client->rtsp_url, sizeof(client->rtsp_url), "%.*s", (int)url_len, url);
+        client->out = metrics_render(url_len == 7 ? METRICS_JSON : METRICS_PROMETHEUS, &client->out_len);
+        if (!client->out)
+        {
+            client_abort(loop, client);
+            return;
+        }
+        // 不读响应的抓取端最多占用一个请求超时
+        loop_timer_start(loop, &client->timer, HTTP_REQUEST_TIMEOUT_MS);
+        http_write_cb(loop, &client->reader.io, EPOLLOUT);
+        return;
+    }
+    // /udp/ 和 /rtp/ 后面是组播组地址时直接加入组播，不走 RTSP，端口后只能跟查询串
+    struct mcast_group group;
+    const char *rest;
+    int multicast = (strncmp(url, "/udp/", 5) == 0 || strncmp(url, "/rtp/", 5) == 0) &&
+                    parse_mcast_addr(url + 5, &group, &rest) == 0;
+    if (multicast)
+    {
+        snprintf(path, sizeof(path), "%s", rest);
+    }
+    else if (parse_http_url(url, host, &port, path) != 0)
+    {
+        LOG_ERROR("Failed to parse URL: %s", url);
+        client_abort(loop, client);
+        return;
+    }
 
-    LOG_INFO("New Client connect: %s:%d -> %s",
-             inet_ntoa(info->client_addr.sin_addr),
-             ntohs(info->client_addr.sin_port),
-             rtsp_url);
+    // 过滤参数按客户端生效，不进入上游 URL，不同过滤条件的客户端共享同一个上游
+    int program;
+    char drop[128];
+    int filter = parse_ts_options(path, &program, drop, sizeof(drop));
+    if (filter < 0 || (filter > 0 && rtp_reader_set_filter(&client->reader, program, drop) < 0))
+    {
+        LOG_ERROR("Invalid TS filter in URL: %s", url);
+        client_abort(loop, client);
+        return;
+    }
 
-    rtsp_play_stream(rtsp_url, client_fd);
+    // 慢客户端的处理方式可以按请求覆盖，同样不进入上游 URL
+    char lag[16];
+    int lag_set = parse_query_take(path, "lag", lag, sizeof(lag));
+    client->reader.lag_policy = lag_set > 0 ? rtp_lag_policy_parse(lag) : get_server_config()->lag_policy;
+    if (lag_set < 0 || client->reader.lag_policy < 0)
+    {
+        LOG_ERROR("Invalid lag policy in URL: %s", url);
+        client_abort(loop, client);
+        return;
+    }
 
-    goto cleanup;
+    // 同一个组的 /udp/ 和 /rtp/ 客户端共享一个 socket 和环形缓冲区。
+    // rtsp_url 也是共享会话的键，放不下时拒绝，不能截断
+    int n;
+    if (multicast)
+    {
+        char addr[128];
+        format_mcast_addr(&group, addr, sizeof(addr));
+        n = snprintf(client->rtsp_url, sizeof(client->rtsp_url), "udp://%s", addr);
+    }
+    else
+    {
+        n = snprintf(client->rtsp_url, sizeof(client->rtsp_url), "rtsp://%s:%d/%s", host, port, path);
+    }
+    if (n < 0 || n >= (int)sizeof(client->rtsp_url))
+    {
+        LOG_ERROR("Upstream URL too long: %s", url);
+        client_reject(loop, client, "414 URI Too Long");
+        return;
+    }
 
-cleanup:
-    LOG_INFO("Client disconnected: %s:%d -> %s", inet_ntoa(info->client_addr.sin_addr), ntohs(info->client_addr.sin_port), rtsp_url);
-    close(client_fd);
-    free(info);
-    return NULL;
+    snprintf(client->reader.name, sizeof(client->reader.name), "%s:%d",
+             inet_ntoa(client->client_addr.sin_addr), ntohs(client->client_addr.sin_port));
+    LOG_INFO("New Client connect: %s -> %s", client->reader.name, client->rtsp_url);
+    if (client->reader.lag_policy != RTP_LAG_BLOCK)
+        LOG_INFO("Lag policy: %s", rtp_lag_policy_name(client->reader.lag_policy));
+    if (filter > 0 && program >= 0)
+        LOG_INFO("TS filter: program %d, drop null%s%s", program, drop[0] ? "," : "", drop);
+    else if (filter > 0)
+        LOG_INFO("TS filter: drop null%s%s", drop[0] ? "," : "", drop);
+
+    loop_timer_stop(loop, &client->timer);
+    enum rtsp_transport transport = RTSP_TRANSPORT_AUTO;
+    if (multicast)
+        transport = RTSP_TRANSPORT_MULTICAST;
+    else if (strncmp(url, "/tcp/", 5) == 0)
+        transport = RTSP_TRANSPORT_TCP;
+    session_attach(&client->reader, client->rtsp_url, transport);
 }
 
-void start_http_server(const void *args)
+static void http_read_cb(struct ev_loop *loop, struct ev_io *io, uint32_t events)
 {
+    struct http_client *client = (struct http_client *)io->data;
 
-    const struct server_config *config = (const struct server_config *)args;
-
-    int server_sock = create_listen_socket(config->port);
-    if (server_sock < 0)
+    while (client->len < (int)sizeof(client->buf) - 1)
     {
-        LOG_ERROR("Failed to create HTTP server socket on port %d", config->port);
-        return;
+        int n = recv(client->reader.http_sock, client->buf + client->len, sizeof(client->buf) - 1 - client->len, 0);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            LOG_ERROR("Failed to receive HTTP request or client disconnected.");
+            client_abort(loop, client);
+            return;
+        }
+        client->len += n;
+        client->buf[client->len] = 0;
     }
 
-    LOG_INFO("HTTP server listening on port %d", config->port);
+    // 等待完整的请求头
+    if (strstr(client->buf, "\r\n\r\n") == NULL && client->len < (int)sizeof(client->buf) - 1)
+        return;
+
+    handle_http_request(loop, client);
+}
+
+static void http_timeout_cb(struct ev_loop *loop, struct ev_timer *timer)
+{
+    struct http_client *client = (struct http_client *)timer->data;
+
+    if (client->out)
+        LOG_WARN("Timed out sending %s", client->rtsp_url);
+    else
+        LOG_ERROR("Timed out waiting for HTTP request");
+    client_abort(loop, client);
+}
 
+static void accept_cb(struct ev_loop *loop, struct ev_io *io, uint32_t events)
+{
     while (1)
     {
         struct sockaddr_in client_addr;
         socklen_t client_len = sizeof(client_addr);
-        int client_sock = accept(server_sock, (struct sockaddr *)&client_addr, &client_len);
+        int client_sock = accept4(io->fd, (struct sockaddr *)&client_addr, &client_len, SOCK_NONBLOCK);
         if (client_sock < 0)
         {
-            perror("accept");
-            continue;
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                perror("accept");
+            break;
         }
 
-        client_info_t *info = malloc(sizeof(client_info_t));
-        if (!info)
+        struct http_client *client = NULL;
+        if (posix_memalign((void **)&client, CACHE_LINE_SIZE, sizeof(struct http_client)) != 0)
         {
-            LOG_ERROR("Failed to allocate memory for client_info_t");
+            LOG_ERROR("Failed to allocate memory for http_client");
             close(client_sock);
             continue;
         }
+        memset(client, 0, sizeof(*client));
 
-        info->client_fd = client_sock;
-        info->client_addr = client_addr;
+        client->client_addr = client_addr;
+        client->reader.http_sock = client_sock;
+        client->reader.on_close = client_close;
+        client->reader.io.cb = http_read_cb;
+        client->reader.io.data = client;
+        client->timer.cb = http_timeout_cb;
+        client->timer.data = client;
 
-        pthread_t thread_id;
-        if (pthread_create(&thread_id, NULL, handle_http_request, info) != 0)
+        if (loop_io_start(loop, &client->reader.io, client_sock, EPOLLIN) < 0)
         {
-            LOG_ERROR("Failed to create thread for client");
             close(client_sock);
-            free(info);
+            free(client);
             continue;
         }
-        pthread_detach(thread_id);
+        loop_timer_start(loop, &client->timer, HTTP_REQUEST_TIMEOUT_MS);
+    }
+}
+
+void start_http_server(const void *args)
+{
+
+    const struct server_config *config = (const struct server_config *)args;
+
+    int server_sock = create_listen_socket(config->port);
+    if (server_sock < 0)
+    {
+        LOG_ERROR("Failed to create HTTP server socket on port %d", config->port);
+        return;
+    }
+
+    if (loop_pool_init(config->workers) < 0)
+    {
+        LOG_ERROR("Failed to start event loops");
+        close(server_sock);
+        return;
+    }
+
+    if (portpool_init() < 0)
+    {
+        close(server_sock);
+        return;
+    }
+
+    // 每个工作线程都监听同一个 socket，EPOLLEXCLUSIVE 避免惊群
+    struct ev_io *listen_io = calloc(loop_pool_size(), sizeof(struct ev_io));
+    if (!listen_io)
+    {
+        LOG_ERROR("Failed to allocate memory for listen io");
+        close(server_sock);
+        return;
+    }
+    for (int i = 0; i < loop_pool_size(); i++)
+    {
+        listen_io[i].cb = accept_cb;
+        if (loop_io_start(loop_pool_get(i), &listen_io[i], server_sock, EPOLLIN | EPOLLEXCLUSIVE) < 0)
+        {
+            close(server_sock);
+            return;
+        }
     }
+
+    LOG_INFO("HTTP server listening on port %d, %d workers", config->port, loop_pool_size());
+
+    loop_pool_run();
 }
 
 int main(int argc, char *argv[])
@@ -177,10 +406,33 @@ int main(int argc, char *argv[])
         {"enable-nat", no_argument, NULL, 'n'},
         {"set-rtp-buffer-size", required_argument, NULL, 'r'},
         {"set-max-udp-packet-size", required_argument, NULL, 'u'},
+        {"workers", required_argument, NULL, 'w'},
+        {"hugepages", no_argument, NULL, 'H'},
+        {"recv-batch", required_argument, NULL, 'b'},
+        {"recv-timeout", required_argument, NULL, 't'},
+        {"send-batch", required_argument, NULL, 's'},
+        {"flush-ms", required_argument, NULL, 'f'},
+        {"zerocopy", no_argument, NULL, 'z'},
+        {"reorder-ms", required_argument, NULL, 'j'},
+        {"gop-cache", no_argument, NULL, 'g'},
+        {"linger-ms", required_argument, NULL, 'l'},
+        {"linger-max", required_argument, NULL, 'c'},
+        {"linger-mb", required_argument, NULL, 'm'},
+        {"handshake-ttl", required_argument, NULL, 'C'},
+        {"pipeline", no_argument, NULL, 'P'},
+        {"dns-ttl", required_argument, NULL, 'd'},
+        {"stun-servers", required_argument, NULL, 'S'},
+        {"port-range", required_argument, NULL, 'R'},
+        {"port-pool", required_argument, NULL, 'o'},
+        {"stun-warmup", no_argument, NULL, 'W'},
+        {"log-level", required_argument, NULL, 'L'},
+        {"mcast-if", required_argument, NULL, 'i'},
+        {"lag-policy", required_argument, NULL, 'O'},
+        {"lag-limit", required_argument, NULL, 'T'},
         {0, 0, 0, 0}};
 
     int opt;
-    while ((opt = getopt_long(argc, argv, "p:nr:u:", long_options, NULL)) != -1)
+    while ((opt = getopt_long(argc, argv, "p:nr:u:w:Hb:t:s:f:zj:gl:c:m:C:Pd:S:R:o:WL:i:O:T:", long_options, NULL)) != -1)
     {
         switch (opt)
         {
@@ -196,8 +448,95 @@ int main(int argc, char *argv[])
         case 'u':
             set_max_udp_packet_size(atoi(optarg));
             break;
+        case 'w':
+            set_workers(atoi(optarg));
+            break;
+        case 'H':
+            set_hugepages(1);
+            break;
+        case 'b':
+            set_recv_batch(atoi(optarg));
+            break;
+        case 't':
+            set_recv_timeout(atoi(optarg));
+            break;
+        case 's':
+            set_send_batch(atoi(optarg));
+            break;
+        case 'f':
+            set_send_flush(atoi(optarg));
+            break;
+        case 'z':
+            set_zerocopy(1);
+            break;
+        case 'j':
+            set_reorder_hold(atoi(optarg));
+            break;
+        case 'g':
+            set_gop_cache(1);
+            break;
+        case 'l':
+            set_linger(atoi(optarg));
+            break;
+        case 'c':
+            set_linger_max(atoi(optarg));
+            break;
+        case 'm':
+            set_linger_mb(atoi(optarg));
+            break;
+        case 'C':
+            set_handshake_ttl(atoi(optarg));
+            break;
+        case 'P':
+            set_pipeline(1);
+            break;
+        case 'd':
+            set_dns_ttl(atoi(optarg));
+            break;
+        case 'S':
+            set_stun_servers(optarg);
+            break;
+        case 'R':
+            if (set_port_range(optarg) < 0)
+            {
+                fprintf(stderr, "Invalid port range: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'o':
+            set_port_pool(atoi(optarg));
+            break;
+        case 'W':
+            set_stun_warmup(1);
+            break;
+        case 'L':
+            if (log_parse_level(optarg) < 0)
+            {
+                fprintf(stderr, "Invalid log level: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            log_set_level(log_parse_level(optarg));
+            break;
+        case 'i':
+            set_mcast_if(optarg);
+            break;
+        case 'O':
+            if (rtp_lag_policy_parse(optarg) < 0)
+            {
+                fprintf(stderr, "Invalid lag policy: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            set_lag_policy(rtp_lag_policy_parse(optarg));
+            break;
+        case 'T':
+            if (set_lag_limit(atoi(optarg)) < 0)
+            {
+                fprintf(stderr, "Invalid lag limit: %s (10-95)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
         default:
-            fprintf(stderr, "Usage: %s [-p port] [-n enable nat punch] [--rtp-buffer-size size] [--udp-packet-size size]\n", argv[0]);
+            fprintf(stderr, "Usage: %s [-p port] [-n enable nat punch] [--rtp-buffer-size size] [--udp-packet-size size] [-w workers] [-H use hugepages] [-b recv batch] [-t recv timeout ms] [-s send batch] [-f flush ms] [-z zerocopy] [-j reorder hold ms] [-g gop cache] [-l linger ms] [-c linger max sessions] [-m linger max mb] [-C handshake cache ttl ms] [-P pipeline] [-d dns cache ttl ms] [-S stun servers] [-R port range min-max] [-o port pool size] [-W stun warmup] [-L log level] [-i multicast interface] [-O lag policy block|drop|skip|disconnect] [-T lag limit percent]\n", argv[0]);
             exit(EXIT_FAILURE);
             break;
         }
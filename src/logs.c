@@ -1,21 +1,302 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
 #include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
 #include "logs.h"
 
-void log_print(const char *level, const char *fmt, ...)
+#define LOG_MSG_MAX 1000
+#define LOG_RING_SIZE 128        // 每个线程的记录数，必须是 2 的幂
+#define LOG_IDLE_SLEEP_MS 10
+#define LOG_OUT_BUF (64 * 1024)
+#define LOG_RATELIMIT_MS 1000
+
+// 调用线程只做格式化，时间戳转换和写 stdout 都在后台线程里
+struct log_record
+{
+    uint64_t ts_ns; // CLOCK_REALTIME
+    int level;
+    int len;
+    char msg[LOG_MSG_MAX];
+};
+
+// 每个线程一个单生产者单消费者环形队列，满时丢弃并计数，调用线程永远不会阻塞
+struct log_ring
+{
+    _Alignas(64) _Atomic uint64_t head; // 生产者写入
+    _Atomic uint64_t dropped;
+    _Atomic int closed;                 // 所属线程已退出，读空后释放
+    _Alignas(64) _Atomic uint64_t tail; // 后台线程写入
+    struct log_ring *next;
+    struct log_record records[LOG_RING_SIZE];
+};
+
+int log_level = LOG_LEVEL_INFO;
+
+static pthread_once_t g_log_once = PTHREAD_ONCE_INIT;
+static pthread_key_t g_log_key;
+static pthread_mutex_t g_rings_lock = PTHREAD_MUTEX_INITIALIZER; // 保护环形队列链表，只在线程首次写日志时加锁
+static pthread_mutex_t g_drain_lock = PTHREAD_MUTEX_INITIALIZER; // 同一时刻只有一个消费者
+static struct log_ring *g_rings = NULL;
+static __thread struct log_ring *t_ring = NULL;
+static int g_writer_ok = 0;
+
+static const char *level_names[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+
+static uint64_t now_ns(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void write_all(const char *buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(STDOUT_FILENO, buf, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        buf += n;
+        len -= n;
+    }
+}
+
+struct log_out
+{
+    char buf[LOG_OUT_BUF];
+    size_t len;
+    time_t sec;        // 同一秒内复用格式化好的时间
+    char stamp[32];
+};
+
+static void out_flush(struct log_out *out)
+{
+    write_all(out->buf, out->len);
+    out->len = 0;
+}
+
+static void out_line(struct log_out *out, uint64_t ts_ns, int level, const char *msg, int len)
+{
+    time_t sec = (time_t)(ts_ns / 1000000000ULL);
+    if (sec != out->sec || out->stamp[0] == '\0')
+    {
+        struct tm tm;
+        localtime_r(&sec, &tm);
+        strftime(out->stamp, sizeof(out->stamp), "%Y-%m-%d %H:%M:%S", &tm);
+        out->sec = sec;
+    }
+
+    if (out->len + len + 64 > sizeof(out->buf))
+        out_flush(out);
+    out->len += snprintf(out->buf + out->len, sizeof(out->buf) - out->len, "[%s] %s: %.*s\n",
+                         out->stamp, level_names[level], len, msg);
+}
+
+// 各线程的队列按时间戳归并输出，尽量保持全局的先后顺序。调用方持有 g_drain_lock
+static int log_drain(struct log_out *out)
+{
+    int written = 0;
+
+    while (1)
+    {
+        struct log_ring *best = NULL;
+        uint64_t best_ts = 0;
+
+        pthread_mutex_lock(&g_rings_lock);
+        for (struct log_ring **pp = &g_rings; *pp;)
+        {
+            struct log_ring *r = *pp;
+            uint64_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+            uint64_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+
+            uint64_t dropped = atomic_exchange_explicit(&r->dropped, 0, memory_order_relaxed);
+            if (dropped)
+            {
+                char msg[64];
+                int len = snprintf(msg, sizeof(msg), "%llu log lines dropped, queue full", (unsigned long long)dropped);
+                out_line(out, now_ns(CLOCK_REALTIME), LOG_LEVEL_WARN, msg, len);
+            }
+
+            if (tail == head)
+            {
+                // 线程已退出且队列已读空
+                if (atomic_load(&r->closed))
+                {
+                    *pp = r->next;
+                    free(r);
+                    continue;
+                }
+            }
+            else
+            {
+                uint64_t ts = r->records[tail & (LOG_RING_SIZE - 1)].ts_ns;
+                if (best == NULL || ts < best_ts)
+                {
+                    best = r;
+                    best_ts = ts;
+                }
+            }
+            pp = &r->next;
+        }
+        pthread_mutex_unlock(&g_rings_lock);
+
+        if (best == NULL)
+            break;
+
+        // 只有本线程释放队列，解锁后 best 仍然有效
+        uint64_t tail = atomic_load_explicit(&best->tail, memory_order_relaxed);
+        struct log_record *rec = &best->records[tail & (LOG_RING_SIZE - 1)];
+        out_line(out, rec->ts_ns, rec->level, rec->msg, rec->len);
+        atomic_store_explicit(&best->tail, tail + 1, memory_order_release);
+        written++;
+    }
+
+    if (out->len > 0)
+        out_flush(out);
+    return written;
+}
+
+static void *log_writer(void *arg)
 {
-    time_t t = time(NULL);
-    struct tm tm;
-    localtime_r(&t, &tm);
-    char buf[64];
-    strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm);
+    static struct log_out out;
 
-    printf("[%s] %s: ", buf, level);
+    while (1)
+    {
+        pthread_mutex_lock(&g_drain_lock);
+        int written = log_drain(&out);
+        pthread_mutex_unlock(&g_drain_lock);
 
+        if (written == 0)
+        {
+            struct timespec ts = {0, LOG_IDLE_SLEEP_MS * 1000000L};
+            nanosleep(&ts, NULL);
+        }
+    }
+    return NULL;
+}
+
+static void log_thread_exit(void *arg)
+{
+    struct log_ring *r = (struct log_ring *)arg;
+    atomic_store(&r->closed, 1);
+}
+
+void log_flush(void)
+{
+    static struct log_out out;
+
+    pthread_mutex_lock(&g_drain_lock);
+    log_drain(&out);
+    pthread_mutex_unlock(&g_drain_lock);
+}
+
+static void log_init(void)
+{
+    pthread_key_create(&g_log_key, log_thread_exit);
+    atexit(log_flush);
+
+    pthread_t tid;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    g_writer_ok = pthread_create(&tid, &attr, log_writer, NULL) == 0;
+    pthread_attr_destroy(&attr);
+}
+
+static struct log_ring *log_thread_ring(void)
+{
+    if (t_ring)
+        return t_ring;
+
+    struct log_ring *r = NULL;
+    if (posix_memalign((void **)&r, 64, sizeof(*r)) != 0)
+        return NULL;
+    memset(r, 0, sizeof(*r));
+
+    pthread_mutex_lock(&g_rings_lock);
+    r->next = g_rings;
+    g_rings = r;
+    pthread_mutex_unlock(&g_rings_lock);
+
+    pthread_setspecific(g_log_key, r);
+    t_ring = r;
+    return r;
+}
+
+void log_print(int level, const char *fmt, ...)
+{
+    if (level < LOG_LEVEL_DEBUG || level > LOG_LEVEL_ERROR)
+        level = LOG_LEVEL_ERROR;
+
+    pthread_once(&g_log_once, log_init);
+
+    struct log_ring *r = log_thread_ring();
+    if (r == NULL)
+        return;
+
+    uint64_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&r->tail, memory_order_acquire) >= LOG_RING_SIZE)
+    {
+        // 后台线程没能启动时，由调用线程自己写出
+        if (!g_writer_ok)
+            log_flush();
+        if (head - atomic_load_explicit(&r->tail, memory_order_acquire) >= LOG_RING_SIZE)
+        {
+            atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed);
+            return;
+        }
+    }
+
+    struct log_record *rec = &r->records[head & (LOG_RING_SIZE - 1)];
     va_list ap;
     va_start(ap, fmt);
-    vprintf(fmt, ap);
+    int len = vsnprintf(rec->msg, sizeof(rec->msg), fmt, ap);
     va_end(ap);
+    if (len < 0)
+        len = 0;
+    if (len >= (int)sizeof(rec->msg))
+        len = sizeof(rec->msg) - 1;
+
+    rec->len = len;
+    rec->level = level;
+    rec->ts_ns = now_ns(CLOCK_REALTIME);
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+
+    if (!g_writer_ok)
+        log_flush();
+}
+
+void log_set_level(int level)
+{
+    log_level = level;
+}
+
+int log_parse_level(const char *name)
+{
+    for (int i = LOG_LEVEL_DEBUG; i <= LOG_LEVEL_ERROR; i++)
+    {
+        if (strcasecmp(name, level_names[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+int log_ratelimit_allow(struct log_ratelimit *rl, uint64_t *suppressed)
+{
+    uint64_t now = now_ns(CLOCK_MONOTONIC_COARSE) / 1000000;
+    uint64_t next = atomic_load_explicit(&rl->next_ms, memory_order_relaxed);
 
-    printf("\n");
-}
\ No newline at end of file
+    if (now < next || !atomic_compare_exchange_strong(&rl->next_ms, &next, now + LOG_RATELIMIT_MS))
+    {
+        atomic_fetch_add_explicit(&rl->suppressed, 1, memory_order_relaxed);
+        return 0;
+    }
+    *suppressed = atomic_exchange_explicit(&rl->suppressed, 0, memory_order_relaxed);
+    return 1;
+}
@@ -3,12 +3,68 @@
 #define LOGS_H
 
 #include <stdarg.h>
+#include <stdint.h>
+#include <stdatomic.h>
 
-void log_print(const char *level, const char *fmt, ...);
+enum log_level
+{
+    LOG_LEVEL_DEBUG = 0,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_ERROR,
+};
 
-#define LOG_INFO(fmt, ...)  log_print("INFO", fmt, ##__VA_ARGS__)
-#define LOG_WARN(fmt, ...)  log_print("WARN", fmt, ##__VA_ARGS__)
-#define LOG_ERROR(fmt, ...) log_print("ERROR", fmt, ##__VA_ARGS__)
-#define LOG_DEBUG(fmt, ...) log_print("DEBUG", fmt, ##__VA_ARGS__)
+// 低于该级别的日志在编译时去掉，例如 -DLOG_COMPILE_LEVEL=1 去掉所有 DEBUG
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_DEBUG
+#endif
 
-#endif
\ No newline at end of file
+extern int log_level; // 运行时级别，启动时设置一次
+
+// 每个调用点一份，多个线程共享
+struct log_ratelimit
+{
+    _Atomic uint64_t next_ms;
+    _Atomic uint64_t suppressed;
+};
+
+void log_print(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void log_set_level(int level);
+int log_parse_level(const char *name);
+// 返回 1 表示本次可以输出，*suppressed 为上次输出后被压制的条数
+int log_ratelimit_allow(struct log_ratelimit *rl, uint64_t *suppressed);
+// 把已缓存的日志写出，进程退出时自动调用
+void log_flush(void);
+
+// 级别不够时参数不会被求值
+#define LOG_AT(level, fmt, ...)                                      \
+    do                                                               \
+    {                                                                \
+        if ((level) >= LOG_COMPILE_LEVEL && (level) >= log_level)    \
+            log_print(level, fmt, ##__VA_ARGS__);                    \
+    } while (0)
+
+// 逐包的告警每个调用点每秒最多输出一条
+#define LOG_AT_RATELIMIT(level, fmt, ...)                                                      \
+    do                                                                                         \
+    {                                                                                          \
+        static struct log_ratelimit log_rl_;                                                   \
+        uint64_t log_suppressed_;                                                              \
+        if ((level) >= LOG_COMPILE_LEVEL && (level) >= log_level &&                            \
+            log_ratelimit_allow(&log_rl_, &log_suppressed_))                                   \
+        {                                                                                      \
+            if (log_suppressed_)                                                               \
+                log_print(level, fmt " (%llu similar suppressed)", ##__VA_ARGS__,              \
+                          (unsigned long long)log_suppressed_);                                \
+            else                                                                               \
+                log_print(level, fmt, ##__VA_ARGS__);                                          \
+        }                                                                                      \
+    } while (0)
+
+#define LOG_INFO(fmt, ...)  LOG_AT(LOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+#define LOG_WARN(fmt, ...)  LOG_AT(LOG_LEVEL_WARN, fmt, ##__VA_ARGS__)
+#define LOG_ERROR(fmt, ...) LOG_AT(LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+#define LOG_DEBUG(fmt, ...) LOG_AT(LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+#define LOG_WARN_RATELIMIT(fmt, ...) LOG_AT_RATELIMIT(LOG_LEVEL_WARN, fmt, ##__VA_ARGS__)
+
+#endif
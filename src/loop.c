@@ -0,0 +1,414 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "loop.h"
+#include "logs.h"
+
+#define LOOP_MAX_EVENTS 64
+#define LOOP_TIMERS_INIT 64
+
+struct ev_task
+{
+    ev_task_cb cb;
+    void *arg;
+    struct ev_task *next;
+};
+
+struct ev_loop
+{
+    int index;
+    int epfd;
+    int wakefd;
+    struct ev_io wake_io;
+    pthread_t thread;
+
+    // 定时器最小堆，启动、停止和重设都是 O(log n)
+    struct ev_timer **timers;
+    size_t ntimers;
+    size_t timers_cap;
+    uint64_t timer_seq;
+
+    pthread_mutex_t post_lock;
+    struct ev_task *posted;
+    struct ev_task **posted_tail;
+
+    struct ev_task *deferred;
+    struct ev_task **deferred_tail;
+};
+
+static struct ev_loop *g_loops = NULL;
+static int g_nloops = 0;
+static __thread struct ev_loop *t_loop = NULL;
+
+uint64_t loop_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0)
+        return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+struct ev_loop *loop_current(void)
+{
+    return t_loop;
+}
+
+int loop_index(struct ev_loop *loop)
+{
+    return loop->index;
+}
+
+int loop_pool_size(void)
+{
+    return g_nloops;
+}
+
+struct ev_loop *loop_pool_get(int index)
+{
+    return &g_loops[index % g_nloops];
+}
+
+int loop_io_start(struct ev_loop *loop, struct ev_io *io, int fd, uint32_t events)
+{
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = io;
+
+    io->fd = fd;
+    io->events = events;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+    {
+        LOG_ERROR("epoll_ctl add fd %d: %s", fd, strerror(errno));
+        io->fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+int loop_io_modify(struct ev_loop *loop, struct ev_io *io, uint32_t events)
+{
+    if (io->fd < 0 || io->events == events)
+        return 0;
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = io;
+
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_MOD, io->fd, &ev) < 0)
+    {
+        LOG_ERROR("epoll_ctl mod fd %d: %s", io->fd, strerror(errno));
+        return -1;
+    }
+    io->events = events;
+    return 0;
+}
+
+void loop_io_stop(struct ev_loop *loop, struct ev_io *io)
+{
+    if (io->fd < 0)
+        return;
+    epoll_ctl(loop->epfd, EPOLL_CTL_DEL, io->fd, NULL);
+    io->fd = -1;
+}
+
+static int timer_before(const struct ev_timer *a, const struct ev_timer *b)
+{
+    return a->expire < b->expire || (a->expire == b->expire && a->seq < b->seq);
+}
+
+static void heap_set(struct ev_loop *loop, size_t i, struct ev_timer *timer)
+{
+    loop->timers[i] = timer;
+    timer->slot = i;
+}
+
+static void heap_up(struct ev_loop *loop, size_t i)
+{
+    struct ev_timer *timer = loop->timers[i];
+    while (i > 0)
+    {
+        size_t parent = (i - 1) / 2;
+        if (!timer_before(timer, loop->timers[parent]))
+            break;
+        heap_set(loop, i, loop->timers[parent]);
+        i = parent;
+    }
+    heap_set(loop, i, timer);
+}
+
+static void heap_down(struct ev_loop *loop, size_t i)
+{
+    struct ev_timer *timer = loop->timers[i];
+    while (1)
+    {
+        size_t child = 2 * i + 1;
+        if (child >= loop->ntimers)
+            break;
+        if (child + 1 < loop->ntimers && timer_before(loop->timers[child + 1], loop->timers[child]))
+            child++;
+        if (!timer_before(loop->timers[child], timer))
+            break;
+        heap_set(loop, i, loop->timers[child]);
+        i = child;
+    }
+    heap_set(loop, i, timer);
+}
+
+static void heap_remove(struct ev_loop *loop, struct ev_timer *timer)
+{
+    size_t i = timer->slot;
+    struct ev_timer *last = loop->timers[--loop->ntimers];
+    if (last != timer)
+    {
+        heap_set(loop, i, last);
+        if (i > 0 && timer_before(last, loop->timers[(i - 1) / 2]))
+            heap_up(loop, i);
+        else
+            heap_down(loop, i);
+    }
+    timer->active = 0;
+}
+
+void loop_timer_start(struct ev_loop *loop, struct ev_timer *timer, uint64_t after_ms)
+{
+    uint64_t expire = loop_now_ms() + after_ms;
+
+    // 到期时间不变时不用动堆
+    if (timer->active && timer->expire == expire)
+        return;
+    if (timer->active)
+        heap_remove(loop, timer);
+
+    if (loop->ntimers == loop->timers_cap)
+    {
+        size_t cap = loop->timers_cap ? loop->timers_cap * 2 : LOOP_TIMERS_INIT;
+        struct ev_timer **timers = (struct ev_timer **)realloc(loop->timers, cap * sizeof(*timers));
+        if (timers == NULL)
+        {
+            LOG_ERROR("Failed to allocate memory for loop timers");
+            return;
+        }
+        loop->timers = timers;
+        loop->timers_cap = cap;
+    }
+
+    timer->expire = expire;
+    timer->seq = loop->timer_seq++;
+    timer->active = 1;
+    loop->timers[loop->ntimers++] = timer;
+    heap_up(loop, loop->ntimers - 1);
+}
+
+void loop_timer_stop(struct ev_loop *loop, struct ev_timer *timer)
+{
+    if (!timer->active)
+        return;
+    heap_remove(loop, timer);
+}
+
+static struct ev_task *task_new(ev_task_cb cb, void *arg)
+{
+    struct ev_task *task = (struct ev_task *)malloc(sizeof(struct ev_task));
+    if (task == NULL)
+    {
+        LOG_ERROR("Failed to allocate memory for loop task");
+        return NULL;
+    }
+    task->cb = cb;
+    task->arg = arg;
+    task->next = NULL;
+    return task;
+}
+
+int loop_post(struct ev_loop *loop, ev_task_cb cb, void *arg)
+{
+    struct ev_task *task = task_new(cb, arg);
+    if (task == NULL)
+        return -1;
+
+    pthread_mutex_lock(&loop->post_lock);
+    int was_empty = loop->posted == NULL;
+    *loop->posted_tail = task;
+    loop->posted_tail = &task->next;
+    pthread_mutex_unlock(&loop->post_lock);
+
+    if (was_empty)
+    {
+        uint64_t one = 1;
+        if (write(loop->wakefd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+            LOG_ERROR("Failed to wake loop %d: %s", loop->index, strerror(errno));
+    }
+    return 0;
+}
+
+int loop_defer(struct ev_loop *loop, ev_task_cb cb, void *arg)
+{
+    struct ev_task *task = task_new(cb, arg);
+    if (task == NULL)
+        return -1;
+
+    *loop->deferred_tail = task;
+    loop->deferred_tail = &task->next;
+    return 0;
+}
+
+static void run_tasks(struct ev_loop *loop, struct ev_task *task)
+{
+    while (task)
+    {
+        struct ev_task *next = task->next;
+        task->cb(loop, task->arg);
+        free(task);
+        task = next;
+    }
+}
+
+static void wake_cb(struct ev_loop *loop, struct ev_io *io, uint32_t events)
+{
+    uint64_t v;
+    while (read(io->fd, &v, sizeof(v)) > 0)
+        ;
+
+    pthread_mutex_lock(&loop->post_lock);
+    struct ev_task *task = loop->posted;
+    loop->posted = NULL;
+    loop->posted_tail = &loop->posted;
+    pthread_mutex_unlock(&loop->post_lock);
+
+    run_tasks(loop, task);
+}
+
+static int next_timeout(struct ev_loop *loop)
+{
+    if (loop->ntimers == 0)
+        return -1;
+
+    uint64_t now = loop_now_ms();
+    if (loop->timers[0]->expire <= now)
+        return 0;
+    return (int)(loop->timers[0]->expire - now);
+}
+
+static void run_timers(struct ev_loop *loop)
+{
+    uint64_t now = loop_now_ms();
+
+    while (loop->ntimers > 0 && loop->timers[0]->expire <= now)
+    {
+        struct ev_timer *timer = loop->timers[0];
+        heap_remove(loop, timer);
+        timer->cb(loop, timer);
+    }
+}
+
+static void run_deferred(struct ev_loop *loop)
+{
+    while (loop->deferred)
+    {
+        struct ev_task *task = loop->deferred;
+        loop->deferred = NULL;
+        loop->deferred_tail = &loop->deferred;
+        run_tasks(loop, task);
+    }
+}
+
+static void *loop_run(void *arg)
+{
+    struct ev_loop *loop = (struct ev_loop *)arg;
+    struct epoll_event events[LOOP_MAX_EVENTS];
+
+    t_loop = loop;
+
+    while (1)
+    {
+        int n = epoll_wait(loop->epfd, events, LOOP_MAX_EVENTS, next_timeout(loop));
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            LOG_ERROR("epoll_wait: %s", strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            struct ev_io *io = (struct ev_io *)events[i].data.ptr;
+            // 同一轮中先处理的回调可能已经停止了这个 io
+            if (io->fd >= 0)
+                io->cb(loop, io, events[i].events);
+        }
+
+        run_timers(loop);
+        run_deferred(loop);
+    }
+
+    return NULL;
+}
+
+int loop_pool_init(int workers)
+{
+    if (workers <= 0)
+        workers = 1;
+
+    g_loops = (struct ev_loop *)calloc(workers, sizeof(struct ev_loop));
+    if (g_loops == NULL)
+    {
+        LOG_ERROR("Failed to allocate memory for event loops");
+        return -1;
+    }
+
+    for (int i = 0; i < workers; i++)
+    {
+        struct ev_loop *loop = &g_loops[i];
+        loop->index = i;
+        loop->posted_tail = &loop->posted;
+        loop->deferred_tail = &loop->deferred;
+        pthread_mutex_init(&loop->post_lock, NULL);
+
+        loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+        loop->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (loop->epfd < 0 || loop->wakefd < 0)
+        {
+            LOG_ERROR("Failed to create event loop %d: %s", i, strerror(errno));
+            return -1;
+        }
+
+        loop->wake_io.cb = wake_cb;
+        if (loop_io_start(loop, &loop->wake_io, loop->wakefd, EPOLLIN) < 0)
+            return -1;
+    }
+
+    g_nloops = workers;
+    return 0;
+}
+
+void loop_pool_run(void)
+{
+    // loop 0 在调用线程中运行
+    for (int i = 1; i < g_nloops; i++)
+    {
+        if (pthread_create(&g_loops[i].thread, NULL, loop_run, &g_loops[i]) != 0)
+        {
+            LOG_ERROR("Failed to create worker thread %d", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    loop_run(&g_loops[0]);
+}
@@ -0,0 +1,57 @@
+#ifndef LOOP_H
+#define LOOP_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct ev_loop;
+struct ev_io;
+struct ev_timer;
+
+typedef void (*ev_io_cb)(struct ev_loop *loop, struct ev_io *io, uint32_t events);
+typedef void (*ev_timer_cb)(struct ev_loop *loop, struct ev_timer *timer);
+typedef void (*ev_task_cb)(struct ev_loop *loop, void *arg);
+
+struct ev_io
+{
+    int fd;
+    uint32_t events;
+    ev_io_cb cb;
+    void *data;
+};
+
+struct ev_timer
+{
+    uint64_t expire;
+    uint64_t seq; // 到期时间相同时按启动顺序触发
+    int active;
+    size_t slot; // 在最小堆中的位置
+    ev_timer_cb cb;
+    void *data;
+};
+
+// 固定数量的 epoll 工作线程，每个线程一个 ev_loop
+int loop_pool_init(int workers);
+int loop_pool_size(void);
+struct ev_loop *loop_pool_get(int index);
+void loop_pool_run(void);
+
+struct ev_loop *loop_current(void);
+int loop_index(struct ev_loop *loop);
+uint64_t loop_now_ms(void);
+
+int loop_io_start(struct ev_loop *loop, struct ev_io *io, int fd, uint32_t events);
+int loop_io_modify(struct ev_loop *loop, struct ev_io *io, uint32_t events);
+void loop_io_stop(struct ev_loop *loop, struct ev_io *io);
+
+void loop_timer_start(struct ev_loop *loop, struct ev_timer *timer, uint64_t after_ms);
+void loop_timer_stop(struct ev_loop *loop, struct ev_timer *timer);
+
+// 跨线程投递任务，在目标 loop 线程中执行
+int loop_post(struct ev_loop *loop, ev_task_cb cb, void *arg);
+// 当前这一轮事件处理完后执行，用于安全释放仍可能有待处理事件的对象
+int loop_defer(struct ev_loop *loop, ev_task_cb cb, void *arg);
+
+int set_nonblocking(int fd);
+
+#endif
@@ -0,0 +1,116 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "mcast.h"
+#include "config.h"
+#include "logs.h"
+
+// 协议无关的 MCAST_JOIN_GROUP / MCAST_JOIN_SOURCE_GROUP，IPv4 发 IGMP，IPv6 发 MLD
+static int mcast_join(int s, const struct mcast_group *g, unsigned int ifindex)
+{
+    int level = g->family == AF_INET6 ? IPPROTO_IPV6 : IPPROTO_IP;
+    struct sockaddr_storage group = {0}, source = {0};
+    socklen_t len = g->family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+
+    group.ss_family = source.ss_family = g->family;
+    if (g->family == AF_INET6)
+    {
+        inet_pton(AF_INET6, g->group, &((struct sockaddr_in6 *)&group)->sin6_addr);
+        if (g->source[0])
+            inet_pton(AF_INET6, g->source, &((struct sockaddr_in6 *)&source)->sin6_addr);
+    }
+    else
+    {
+        inet_pton(AF_INET, g->group, &((struct sockaddr_in *)&group)->sin_addr);
+        if (g->source[0])
+            inet_pton(AF_INET, g->source, &((struct sockaddr_in *)&source)->sin_addr);
+    }
+
+    if (g->source[0])
+    {
+        struct group_source_req req = {0};
+        req.gsr_interface = ifindex;
+        memcpy(&req.gsr_group, &group, len);
+        memcpy(&req.gsr_source, &source, len);
+        return setsockopt(s, level, MCAST_JOIN_SOURCE_GROUP, &req, sizeof(req));
+    }
+
+    struct group_req req = {0};
+    req.gr_interface = ifindex;
+    memcpy(&req.gr_group, &group, len);
+    return setsockopt(s, level, MCAST_JOIN_GROUP, &req, sizeof(req));
+}
+
+int mcast_open(const struct mcast_group *g, const char *ifname)
+{
+    const struct server_config *config = get_server_config();
+    unsigned int ifindex = 0;
+
+    if (ifname && ifname[0])
+    {
+        ifindex = if_nametoindex(ifname);
+        if (ifindex == 0)
+        {
+            LOG_ERROR("Multicast interface %s: %s", ifname, strerror(errno));
+            return -1;
+        }
+    }
+
+    int s = socket(g->family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (s < 0)
+    {
+        LOG_ERROR("Failed to create multicast socket: %s", strerror(errno));
+        return -1;
+    }
+
+    // 同一个组可能被其他进程同时接收
+    int on = 1;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    setsockopt(s, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+    int rcvbuf = config->sock_rcvbuf;
+    if (rcvbuf > 0)
+        setsockopt(s, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    // 绑定到组地址而不是通配地址，同一端口上的其他组不会混进来
+    struct sockaddr_storage addr = {0};
+    socklen_t addr_len;
+    if (g->family == AF_INET6)
+    {
+        struct sockaddr_in6 *a6 = (struct sockaddr_in6 *)&addr;
+        a6->sin6_family = AF_INET6;
+        a6->sin6_port = htons(g->port);
+        a6->sin6_scope_id = ifindex;
+        inet_pton(AF_INET6, g->group, &a6->sin6_addr);
+        addr_len = sizeof(*a6);
+    }
+    else
+    {
+        struct sockaddr_in *a4 = (struct sockaddr_in *)&addr;
+        a4->sin_family = AF_INET;
+        a4->sin_port = htons(g->port);
+        inet_pton(AF_INET, g->group, &a4->sin_addr);
+        addr_len = sizeof(*a4);
+    }
+
+    if (bind(s, (struct sockaddr *)&addr, addr_len) < 0)
+    {
+        LOG_ERROR("Failed to bind multicast %s:%d: %s", g->group, g->port, strerror(errno));
+        close(s);
+        return -1;
+    }
+
+    if (mcast_join(s, g, ifindex) < 0)
+    {
+        LOG_ERROR("Failed to join multicast %s%s%s on %s: %s", g->source, g->source[0] ? "@" : "", g->group,
+                  ifindex ? ifname : "default interface", strerror(errno));
+        close(s);
+        return -1;
+    }
+    return s;
+}
@@ -0,0 +1,10 @@
+#ifndef MCAST_H
+#define MCAST_H
+
+#include "parse.h"
+
+// 绑定组地址和端口并加入组播组（有源地址时按 SSM 加入），成功返回非阻塞 socket。
+// ifname 为空时由内核按路由选择接口。关闭 socket 即离开组播组
+int mcast_open(const struct mcast_group *g, const char *ifname);
+
+#endif
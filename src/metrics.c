@@ -0,0 +1,694 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <pthread.h>
+#include "metrics.h"
+#include "session.h"
+#include "loop.h"
+#include "logs.h"
+
+// 已释放的会话累计的计数；在线会话的计数在抓取时现加
+static struct
+{
+    _Atomic uint64_t sessions;
+    _Atomic uint64_t clients;
+    _Atomic uint64_t rtp_packets;
+    _Atomic uint64_t rtp_bytes;
+    _Atomic uint64_t malformed;
+    _Atomic uint64_t rtp_lost;
+    _Atomic uint64_t rtp_reordered;
+    _Atomic uint64_t rtp_duplicates;
+    _Atomic uint64_t rtp_late;
+    _Atomic uint64_t rtp_foreign;
+    _Atomic uint64_t stalls;
+    _Atomic uint64_t ts_packets;
+    _Atomic uint64_t ts_cc_errors;
+    _Atomic uint64_t ts_sync_errors;
+    _Atomic uint64_t ts_tei;
+    _Atomic uint64_t sent_packets;
+    _Atomic uint64_t sent_bytes;
+    _Atomic uint64_t send_errors;
+    _Atomic uint64_t filtered_bytes;
+    _Atomic uint64_t lag_skips;
+    _Atomic uint64_t lag_skipped;
+    _Atomic uint64_t lag_disconnects;
+    _Atomic uint64_t phase_ms[METRICS_PHASES];
+    _Atomic uint64_t phase_count[METRICS_PHASES];
+    struct histogram latency;
+} g_totals;
+
+// 在线客户端的落后情况
+struct viewer_snapshot
+{
+    char name[64];
+    int policy;
+    uint64_t lag_slots;   // 读指针到 head 的槽位数
+    uint64_t lag_ms;      // 读指针处的包已经在缓冲区中停留的时间
+    uint64_t lag_max;
+    uint64_t lag_skips;
+    uint64_t lag_skipped;
+    uint64_t sent_bytes;
+};
+
+// 抓取时复制出来的会话状态，格式化时不再持锁
+struct session_snapshot
+{
+    char url[512];
+    int state;
+    int phase;
+    const char *transport;
+    int idle;
+    int clients;
+    uint64_t uptime_ms;
+    uint64_t rtp_packets;
+    uint64_t rtp_bytes;
+    uint64_t malformed;
+    uint64_t rtp_lost;
+    uint64_t rtp_reordered;
+    uint64_t rtp_duplicates;
+    uint64_t rtp_late;
+    uint64_t rtp_foreign;
+    uint64_t stalls;
+    uint64_t ts_packets;
+    uint64_t ts_cc_errors;
+    uint64_t ts_sync_errors;
+    uint64_t ts_tei;
+    uint64_t ring_size;
+    uint64_t ring_used;
+    uint64_t ring_hwm;
+    uint64_t sent_packets;
+    uint64_t sent_bytes;
+    uint64_t send_errors;
+    uint64_t filtered_bytes;
+    uint64_t lag_skips;
+    uint64_t lag_skipped;
+    uint64_t lag_disconnects;
+    uint64_t lag_max;     // 在线客户端中最大的当前落后
+    uint64_t phase_ms[METRICS_PHASES];
+    uint64_t jitter_us;
+    struct hist_snapshot latency;
+    struct viewer_snapshot *viewers;
+};
+
+struct snapshot_list
+{
+    struct session_snapshot *items;
+    int count;
+    int cap;
+};
+
+struct metrics_buf
+{
+    char *data;
+    size_t len;
+    size_t cap;
+    int failed;
+};
+
+void metrics_session_opened(void)
+{
+    atomic_fetch_add_explicit(&g_totals.sessions, 1, memory_order_relaxed);
+}
+
+void metrics_client_opened(void)
+{
+    atomic_fetch_add_explicit(&g_totals.clients, 1, memory_order_relaxed);
+}
+
+void metrics_session_retire(struct session_stats *stats)
+{
+    atomic_fetch_add_explicit(&g_totals.rtp_packets, stat_get(&stats->rtp_packets), memory_order_relaxed);
+    atomic_fetch_add_explicit(&g_totals.rtp_bytes, stat_get(&stats->rtp_bytes), memory_order_relaxed);
+    atomic_fetch_add_explicit(&g_totals.malformed, stat_get(&stats->malformed), memory_order_relaxed);
+    atomic_fetch_add_explicit(&g_totals.rtp_lost, stat_get(&stats->rtp_lost), memory_order_relaxed);
+    atomic_fetch_add_explicit(&g_totals.rtp_reordered, stat_get(&stats->rtp_reordered), memory_order_relaxed);
+    atomic_fetch_add_explicit(&g_totals.rtp_duplicates, stat_get(&stats->rtp_duplicates), memory_order_relaxed);
+    atomic_fetch_add_explicit(&g_totals.rtp_late, stat_get(&stats->rtp_late), memory_order_relaxed);
+    atomic_fetch_add_explicit(&g_totals.rtp_foreign, stat_get(&stats->rtp_foreign), memory_order_relaxed);
+    atomic_fetch_add_explicit(&g_totals.stalls, stat_get(&stats->stalls), memory_order_relaxed);
+    atomic_fetch_add_explicit(&g_totals.ts_packets, stat_get(&stats->ts_packets), memory_order_relaxed);
+    atomic_fetch_add_explicit(&g_totals.ts_cc_errors, stat_get(&stats->ts_cc_errors), memory_order_relaxed);
+    atomic_fetch_add_explicit(&g_totals.ts_sync_errors, stat_get(&stats->ts_sync_errors), memory_order_relaxed);
+    atomic_fetch_add_explicit(&g_totals.ts_tei, stat_get(&stats->ts_tei), memory_order_relaxed);
+    atomic_fetch_add_explicit(&g_totals.sent_packets, stat_get(&stats->sent_packets), memory_order_relaxed);
+    atomic_fetch_add_explicit(&g_totals.sent_bytes, stat_get(&stats->sent_bytes), memory_order_relaxed);
+    atomic_fetch_add_explicit(&g_totals.send_errors, stat_get(&stats->send_errors), memory_order_relaxed);
+    atomic_fetch_add_explicit(&g_totals.filtered_bytes, stat_get(&stats->filtered_bytes), memory_order_relaxed);
+    atomic_fetch_add_explicit(&g_totals.lag_skips, stat_get(&stats->lag_skips), memory_order_relaxed);
+    atomic_fetch_add_explicit(&g_totals.lag_skipped, stat_get(&stats->lag_skipped), memory_order_relaxed);
+    atomic_fetch_add_explicit(&g_totals.lag_disconnects, stat_get(&stats->lag_disconnects), memory_order_relaxed);
+    hist_merge_shared(&g_totals.latency, &stats->latency);
+}
+
+// 调用方持有 ctx->lock，离开的客户端的计数并入所属会话
+void metrics_reader_retire(struct session_stats *stats, struct rtp_reader *reader)
+{
+    stat_add(&stats->sent_packets, stat_get(&reader->send_packets));
+    stat_add(&stats->sent_bytes, stat_get(&reader->sent_bytes));
+    stat_add(&stats->send_errors, stat_get(&reader->send_errors));
+    stat_add(&stats->filtered_bytes, stat_get(&reader->filtered_bytes));
+    stat_add(&stats->lag_skips, stat_get(&reader->lag_skips));
+    stat_add(&stats->lag_skipped, stat_get(&reader->lag_skipped));
+    stat_add(&stats->lag_disconnects, stat_get(&reader->lag_disconnects));
+    hist_merge(&stats->latency, &reader->latency);
+}
+
+void metrics_phase_done(int phase, uint64_t ms)
+{
+    if (phase < 0 || phase >= METRICS_PHASES)
+        return;
+    atomic_fetch_add_explicit(&g_totals.phase_ms[phase], ms, memory_order_relaxed);
+    atomic_fetch_add_explicit(&g_totals.phase_count[phase], 1, memory_order_relaxed);
+}
+
+static uint64_t clock_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void snapshot_session(struct stream_session *s, void *arg)
+{
+    struct snapshot_list *list = (struct snapshot_list *)arg;
+    struct play_ctx *ctx = &s->ctx;
+
+    if (list->count == list->cap)
+    {
+        int cap = list->cap ? list->cap * 2 : 16;
+        struct session_snapshot *items = realloc(list->items, cap * sizeof(*items));
+        if (!items)
+            return;
+        list->items = items;
+        list->cap = cap;
+    }
+
+    struct session_snapshot *snap = &list->items[list->count++];
+    memset(snap, 0, sizeof(*snap));
+    snprintf(snap->url, sizeof(snap->url), "%s", s->rtsp_url);
+    snap->state = atomic_load(&ctx->state);
+    snap->phase = ctx->phase;
+    if (ctx->transport == RTSP_TRANSPORT_MULTICAST)
+        snap->transport = "multicast";
+    else
+        snap->transport = ctx->interleaved ? "tcp" : "udp";
+    snap->idle = s->idle;
+    snap->uptime_ms = ctx->start_ms ? loop_now_ms() - ctx->start_ms : 0;
+    snap->rtp_packets = stat_get(&ctx->stats.rtp_packets);
+    snap->rtp_bytes = stat_get(&ctx->stats.rtp_bytes);
+    snap->malformed = stat_get(&ctx->stats.malformed);
+    snap->rtp_lost = stat_get(&ctx->stats.rtp_lost);
+    snap->rtp_reordered = stat_get(&ctx->stats.rtp_reordered);
+    snap->rtp_duplicates = stat_get(&ctx->stats.rtp_duplicates);
+    snap->rtp_late = stat_get(&ctx->stats.rtp_late);
+    snap->rtp_foreign = stat_get(&ctx->stats.rtp_foreign);
+    snap->stalls = stat_get(&ctx->stats.stalls);
+    snap->ts_packets = stat_get(&ctx->stats.ts_packets);
+    snap->ts_cc_errors = stat_get(&ctx->stats.ts_cc_errors);
+    snap->ts_sync_errors = stat_get(&ctx->stats.ts_sync_errors);
+    snap->ts_tei = stat_get(&ctx->stats.ts_tei);
+    snap->ring_hwm = stat_get(&ctx->stats.ring_hwm);
+    snap->jitter_us = stat_get(&ctx->stats.jitter_us);
+    for (int i = 0; i < METRICS_PHASES; i++)
+        snap->phase_ms[i] = stat_get(&ctx->stats.phase_ms[i]);
+
+    pthread_mutex_lock(&ctx->lock);
+    snap->sent_packets = stat_get(&ctx->stats.sent_packets);
+    snap->sent_bytes = stat_get(&ctx->stats.sent_bytes);
+    snap->send_errors = stat_get(&ctx->stats.send_errors);
+    snap->filtered_bytes = stat_get(&ctx->stats.filtered_bytes);
+    snap->lag_skips = stat_get(&ctx->stats.lag_skips);
+    snap->lag_skipped = stat_get(&ctx->stats.lag_skipped);
+    snap->lag_disconnects = stat_get(&ctx->stats.lag_disconnects);
+    hist_snapshot_add(&snap->latency, &ctx->stats.latency);
+
+    int nreaders = 0;
+    for (struct rtp_reader *r = ctx->readers; r; r = r->next)
+        nreaders++;
+    if (nreaders > 0)
+        snap->viewers = calloc(nreaders, sizeof(struct viewer_snapshot));
+
+    uint64_t head = 0, min = 0;
+    if (ctx->rtp_buf)
+    {
+        head = atomic_load_explicit(&ctx->rtp_buf->head, memory_order_acquire);
+        min = head;
+        snap->ring_size = ctx->rtp_buf->size;
+    }
+    uint64_t now_ns = clock_now_ns();
+    uint64_t floor = atomic_load(&ctx->lag_floor);
+    for (struct rtp_reader *r = ctx->readers; r; r = r->next)
+    {
+        uint64_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+        if (head - tail > snap->lag_max)
+            snap->lag_max = head - tail;
+        // 落后太多的不阻塞型客户端的槽位可能已被覆盖，持锁期间保底位置之后的不会
+        uint64_t kept = tail < floor ? floor : tail;
+        if (kept < min)
+            min = kept;
+        snap->sent_packets += stat_get(&r->send_packets);
+        snap->sent_bytes += stat_get(&r->sent_bytes);
+        snap->send_errors += stat_get(&r->send_errors);
+        snap->filtered_bytes += stat_get(&r->filtered_bytes);
+        snap->lag_skips += stat_get(&r->lag_skips);
+        snap->lag_skipped += stat_get(&r->lag_skipped);
+        snap->lag_disconnects += stat_get(&r->lag_disconnects);
+        hist_snapshot_add(&snap->latency, &r->latency);
+
+        if (snap->viewers)
+        {
+            struct viewer_snapshot *v = &snap->viewers[snap->clients];
+            snprintf(v->name, sizeof(v->name), "%s", r->name);
+            v->policy = r->lag_policy;
+            v->lag_slots = head - tail;
+            if (kept != head)
+            {
+                uint64_t recv_ns = rtp_buffer_slot(ctx->rtp_buf, kept)->recv_ns;
+                v->lag_ms = now_ns > recv_ns ? (now_ns - recv_ns) / 1000000 : 0;
+            }
+            // 客户端只在发送时记录最大值，阻塞在 socket 上时以当前值为准
+            v->lag_max = stat_get(&r->lag_max);
+            if (v->lag_slots > v->lag_max)
+                v->lag_max = v->lag_slots;
+            v->lag_skips = stat_get(&r->lag_skips);
+            v->lag_skipped = stat_get(&r->lag_skipped);
+            v->sent_bytes = stat_get(&r->sent_bytes);
+        }
+        snap->clients++;
+    }
+    if (ctx->gop_valid && ctx->gop_start < min)
+        min = ctx->gop_start;
+    pthread_mutex_unlock(&ctx->lock);
+
+    snap->ring_used = head - min;
+    if (snap->ring_used > snap->ring_hwm)
+        snap->ring_hwm = snap->ring_used;
+}
+
+static void buf_printf(struct metrics_buf *b, const char *fmt, ...)
+{
+    if (b->failed)
+        return;
+
+    while (1)
+    {
+        va_list ap;
+        va_start(ap, fmt);
+        int n = vsnprintf(b->data + b->len, b->cap - b->len, fmt, ap);
+        va_end(ap);
+        if (n < 0)
+        {
+            b->failed = 1;
+            return;
+        }
+        if ((size_t)n < b->cap - b->len)
+        {
+            b->len += n;
+            return;
+        }
+
+        size_t cap = b->cap * 2 + n;
+        char *data = realloc(b->data, cap);
+        if (!data)
+        {
+            b->failed = 1;
+            return;
+        }
+        b->data = data;
+        b->cap = cap;
+    }
+}
+
+// Prometheus 标签值只允许 \\、\" 和 \n 三种转义，其他控制字符换成空格
+static void buf_label(struct metrics_buf *b, const char *s)
+{
+    for (; *s; s++)
+    {
+        unsigned char c = (unsigned char)*s;
+        if (c == '\\' || c == '"')
+            buf_printf(b, "\\%c", c);
+        else if (c == '\n')
+            buf_printf(b, "\\n");
+        else if (c < 0x20 || c == 0x7f)
+            buf_printf(b, " ");
+        else
+            buf_printf(b, "%c", c);
+    }
+}
+
+// JSON 字符串
+static void buf_json(struct metrics_buf *b, const char *s)
+{
+    for (; *s; s++)
+    {
+        unsigned char c = (unsigned char)*s;
+        if (c == '\\' || c == '"')
+            buf_printf(b, "\\%c", c);
+        else if (c == '\n')
+            buf_printf(b, "\\n");
+        else if (c < 0x20)
+            buf_printf(b, "\\u%04x", c);
+        else
+            buf_printf(b, "%c", c);
+    }
+}
+
+static const char *state_name(int state)
+{
+    switch (state)
+    {
+    case PLAY_STARTING:
+        return "starting";
+    case PLAY_PLAYING:
+        return "playing";
+    default:
+        return "closed";
+    }
+}
+
+struct metric_def
+{
+    const char *name;
+    const char *type;
+    const char *help;
+    size_t offset;          // 在 session_snapshot 中的位置
+    _Atomic uint64_t *done; // 已释放会话的累计值，为空时不输出全局总数
+};
+
+#define SNAP_FIELD(f) offsetof(struct session_snapshot, f)
+
+static const struct metric_def session_metrics[] = {
+    {"rtp_packets_total", "counter", "RTP packets received from upstream", SNAP_FIELD(rtp_packets), &g_totals.rtp_packets},
+    {"rtp_bytes_total", "counter", "RTP bytes received from upstream", SNAP_FIELD(rtp_bytes), &g_totals.rtp_bytes},
+    {"rtp_malformed_total", "counter", "Packets rejected by the RTP parser", SNAP_FIELD(malformed), &g_totals.malformed},
+    {"rtp_lost_total", "counter", "RTP sequence numbers given up by the reorder buffer", SNAP_FIELD(rtp_lost), &g_totals.rtp_lost},
+    {"rtp_reordered_total", "counter", "Sequence gaps filled by out-of-order packets", SNAP_FIELD(rtp_reordered), &g_totals.rtp_reordered},
+    {"rtp_duplicates_total", "counter", "RTP packets dropped as duplicates", SNAP_FIELD(rtp_duplicates), &g_totals.rtp_duplicates},
+    {"rtp_late_total", "counter", "RTP packets dropped for arriving after their gap was given up", SNAP_FIELD(rtp_late), &g_totals.rtp_late},
+    {"rtp_foreign_total", "counter", "UDP packets dropped for not coming from the negotiated server address", SNAP_FIELD(rtp_foreign), &g_totals.rtp_foreign},
+    {"ring_stalls_total", "counter", "Times the producer stopped because the ring was full", SNAP_FIELD(stalls), &g_totals.stalls},
+    {"ts_packets_total", "counter", "TS packets checked for integrity", SNAP_FIELD(ts_packets), &g_totals.ts_packets},
+    {"ts_cc_errors_total", "counter", "TS continuity counter errors", SNAP_FIELD(ts_cc_errors), &g_totals.ts_cc_errors},
+    {"ts_sync_errors_total", "counter", "TS packets with a bad sync byte or truncated", SNAP_FIELD(ts_sync_errors), &g_totals.ts_sync_errors},
+    {"ts_tei_total", "counter", "TS packets with transport_error_indicator set", SNAP_FIELD(ts_tei), &g_totals.ts_tei},
+    {"http_sent_packets_total", "counter", "RTP payloads written to HTTP clients", SNAP_FIELD(sent_packets), &g_totals.sent_packets},
+    {"http_sent_bytes_total", "counter", "Bytes written to HTTP clients", SNAP_FIELD(sent_bytes), &g_totals.sent_bytes},
+    {"http_send_errors_total", "counter", "HTTP client writes that failed", SNAP_FIELD(send_errors), &g_totals.send_errors},
+    {"ts_filtered_bytes_total", "counter", "TS bytes dropped by per-client PID filters", SNAP_FIELD(filtered_bytes), &g_totals.filtered_bytes},
+    {"client_lag_skips_total", "counter", "Times a lagging client skipped ahead under its lag policy", SNAP_FIELD(lag_skips), &g_totals.lag_skips},
+    {"client_lag_skipped_slots_total", "counter", "Ring slots lagging clients skipped instead of sending", SNAP_FIELD(lag_skipped), &g_totals.lag_skipped},
+    {"client_lag_disconnects_total", "counter", "Clients disconnected for lagging past the limit", SNAP_FIELD(lag_disconnects), &g_totals.lag_disconnects},
+    {"client_lag_max_slots", "gauge", "Largest current lag of an attached client", SNAP_FIELD(lag_max)},
+    {"ring_slots", "gauge", "Ring buffer capacity in slots", SNAP_FIELD(ring_size)},
+    {"ring_used_slots", "gauge", "Slots not yet consumed by the slowest client", SNAP_FIELD(ring_used)},
+    {"ring_high_water_slots", "gauge", "Highest ring occupancy seen", SNAP_FIELD(ring_hwm)},
+    {"uptime_ms", "gauge", "Milliseconds since the upstream session started", SNAP_FIELD(uptime_ms)},
+    {"jitter_us", "gauge", "RFC 3550 interarrival jitter of the upstream RTP stream", SNAP_FIELD(jitter_us)},
+};
+
+#define NUM_SESSION_METRICS (sizeof(session_metrics) / sizeof(session_metrics[0]))
+
+#define VIEWER_FIELD(f) offsetof(struct viewer_snapshot, f)
+
+// 逐客户端输出，标签为会话地址、客户端地址和落后策略
+static const struct metric_def viewer_metrics[] = {
+    {"lag_slots", "gauge", "Ring slots between the client's read position and the newest packet", VIEWER_FIELD(lag_slots)},
+    {"lag_ms", "gauge", "Age of the oldest packet the client has not consumed", VIEWER_FIELD(lag_ms)},
+    {"lag_max_slots", "gauge", "Largest lag the client has reached", VIEWER_FIELD(lag_max)},
+    {"lag_skips_total", "counter", "Times the client skipped ahead under its lag policy", VIEWER_FIELD(lag_skips)},
+    {"lag_skipped_slots_total", "counter", "Ring slots the client skipped instead of sending", VIEWER_FIELD(lag_skipped)},
+    {"sent_bytes_total", "counter", "Bytes written to the client", VIEWER_FIELD(sent_bytes)},
+};
+
+#define NUM_VIEWER_METRICS (sizeof(viewer_metrics) / sizeof(viewer_metrics[0]))
+
+static uint64_t viewer_value(const struct viewer_snapshot *v, const struct metric_def *def)
+{
+    return *(const uint64_t *)((const char *)v + def->offset);
+}
+
+static uint64_t snap_value(const struct session_snapshot *snap, const struct metric_def *def)
+{
+    return *(const uint64_t *)((const char *)snap + def->offset);
+}
+
+static const double latency_quantiles[] = {0.5, 0.99, 0.999};
+static const char *latency_quantile_names[] = {"p50", "p99", "p999"};
+
+// url 为空时输出全局的 summary
+static void render_latency(struct metrics_buf *b, const char *name, const char *url, const struct hist_snapshot *h)
+{
+    for (int q = 0; q < 3; q++)
+    {
+        buf_printf(b, "%s{", name);
+        if (url)
+        {
+            buf_printf(b, "url=\"");
+            buf_label(b, url);
+            buf_printf(b, "\",");
+        }
+        buf_printf(b, "quantile=\"%g\"} %llu\n", latency_quantiles[q], (unsigned long long)hist_percentile(h, latency_quantiles[q]));
+    }
+
+    const char *suffix[] = {"_sum", "_count"};
+    uint64_t value[] = {h->sum, h->count};
+    for (int i = 0; i < 2; i++)
+    {
+        buf_printf(b, "%s%s", name, suffix[i]);
+        if (url)
+        {
+            buf_printf(b, "{url=\"");
+            buf_label(b, url);
+            buf_printf(b, "\"}");
+        }
+        buf_printf(b, " %llu\n", (unsigned long long)value[i]);
+    }
+}
+
+static void render_prometheus(struct metrics_buf *b, struct snapshot_list *list)
+{
+    int clients = 0;
+
+    for (int i = 0; i < list->count; i++)
+        clients += list->items[i].clients;
+
+    buf_printf(b, "# HELP rtspunch_sessions Upstream sessions currently open\n# TYPE rtspunch_sessions gauge\nrtspunch_sessions %d\n", list->count);
+    buf_printf(b, "# HELP rtspunch_clients HTTP clients currently attached\n# TYPE rtspunch_clients gauge\nrtspunch_clients %d\n", clients);
+    buf_printf(b, "# HELP rtspunch_sessions_total Upstream sessions opened\n# TYPE rtspunch_sessions_total counter\nrtspunch_sessions_total %llu\n",
+               (unsigned long long)stat_get(&g_totals.sessions));
+    buf_printf(b, "# HELP rtspunch_clients_total HTTP clients attached\n# TYPE rtspunch_clients_total counter\nrtspunch_clients_total %llu\n",
+               (unsigned long long)stat_get(&g_totals.clients));
+
+    // 全局总数 = 已释放会话的累计值 + 在线会话的当前值；缓冲区占用等只按会话给出
+    for (size_t m = 0; m < NUM_SESSION_METRICS; m++)
+    {
+        const struct metric_def *def = &session_metrics[m];
+        if (!def->done)
+            continue;
+
+        uint64_t total = stat_get(def->done);
+        for (int i = 0; i < list->count; i++)
+            total += snap_value(&list->items[i], def);
+        buf_printf(b, "# HELP rtspunch_%s %s\n# TYPE rtspunch_%s %s\nrtspunch_%s %llu\n",
+                   def->name, def->help, def->name, def->type, def->name, (unsigned long long)total);
+    }
+
+    buf_printf(b, "# HELP rtspunch_handshake_phase_ms_total Time spent in each RTSP handshake phase\n# TYPE rtspunch_handshake_phase_ms_total counter\n");
+    for (int p = 0; p <= RTSP_TEARDOWN; p++)
+    {
+        if (p == RTSP_KEEPALIVE)
+            continue;
+        buf_printf(b, "rtspunch_handshake_phase_ms_total{phase=\"%s\"} %llu\n", rtsp_phase_name(p),
+                   (unsigned long long)stat_get(&g_totals.phase_ms[p]));
+    }
+    buf_printf(b, "# HELP rtspunch_handshake_phase_count Completed RTSP handshake phases\n# TYPE rtspunch_handshake_phase_count counter\n");
+    for (int p = 0; p <= RTSP_TEARDOWN; p++)
+    {
+        if (p == RTSP_KEEPALIVE)
+            continue;
+        buf_printf(b, "rtspunch_handshake_phase_count{phase=\"%s\"} %llu\n", rtsp_phase_name(p),
+                   (unsigned long long)stat_get(&g_totals.phase_count[p]));
+    }
+
+    struct hist_snapshot *latency = calloc(1, sizeof(*latency));
+    if (latency)
+    {
+        hist_snapshot_add(latency, &g_totals.latency);
+        for (int i = 0; i < list->count; i++)
+            hist_snapshot_merge(latency, &list->items[i].latency);
+
+        buf_printf(b, "# HELP rtspunch_latency_us Time from RTP receive to handing the payload to an HTTP socket\n# TYPE rtspunch_latency_us summary\n");
+        render_latency(b, "rtspunch_latency_us", NULL, latency);
+        buf_printf(b, "# HELP rtspunch_latency_max_us Highest receive-to-send latency\n# TYPE rtspunch_latency_max_us gauge\nrtspunch_latency_max_us %llu\n",
+                   (unsigned long long)latency->max);
+        free(latency);
+    }
+
+    for (size_t m = 0; m < NUM_SESSION_METRICS; m++)
+    {
+        const struct metric_def *def = &session_metrics[m];
+        if (list->count == 0)
+            break;
+        buf_printf(b, "# HELP rtspunch_session_%s %s\n# TYPE rtspunch_session_%s %s\n",
+                   def->name, def->help, def->name, def->type);
+        for (int i = 0; i < list->count; i++)
+        {
+            buf_printf(b, "rtspunch_session_%s{url=\"", def->name);
+            buf_label(b, list->items[i].url);
+            buf_printf(b, "\"} %llu\n", (unsigned long long)snap_value(&list->items[i], def));
+        }
+    }
+
+    if (list->count > 0)
+    {
+        buf_printf(b, "# HELP rtspunch_session_clients HTTP clients attached to the session\n# TYPE rtspunch_session_clients gauge\n");
+        for (int i = 0; i < list->count; i++)
+        {
+            buf_printf(b, "rtspunch_session_clients{url=\"");
+            buf_label(b, list->items[i].url);
+            buf_printf(b, "\"} %d\n", list->items[i].clients);
+        }
+
+        buf_printf(b, "# HELP rtspunch_session_phase_ms Time the session spent in each RTSP phase\n# TYPE rtspunch_session_phase_ms gauge\n");
+        for (int i = 0; i < list->count; i++)
+        {
+            for (int p = 0; p <= RTSP_TEARDOWN; p++)
+            {
+                if (p == RTSP_KEEPALIVE)
+                    continue;
+                buf_printf(b, "rtspunch_session_phase_ms{url=\"");
+                buf_label(b, list->items[i].url);
+                buf_printf(b, "\",phase=\"%s\"} %llu\n", rtsp_phase_name(p), (unsigned long long)list->items[i].phase_ms[p]);
+            }
+        }
+
+        buf_printf(b, "# HELP rtspunch_session_latency_us Time from RTP receive to handing the payload to an HTTP socket\n# TYPE rtspunch_session_latency_us summary\n");
+        for (int i = 0; i < list->count; i++)
+            render_latency(b, "rtspunch_session_latency_us", list->items[i].url, &list->items[i].latency);
+
+        buf_printf(b, "# HELP rtspunch_session_latency_max_us Highest receive-to-send latency\n# TYPE rtspunch_session_latency_max_us gauge\n");
+        for (int i = 0; i < list->count; i++)
+        {
+            buf_printf(b, "rtspunch_session_latency_max_us{url=\"");
+            buf_label(b, list->items[i].url);
+            buf_printf(b, "\"} %llu\n", (unsigned long long)list->items[i].latency.max);
+        }
+
+        for (size_t m = 0; m < NUM_VIEWER_METRICS; m++)
+        {
+            const struct metric_def *def = &viewer_metrics[m];
+            buf_printf(b, "# HELP rtspunch_client_%s %s\n# TYPE rtspunch_client_%s %s\n",
+                       def->name, def->help, def->name, def->type);
+            for (int i = 0; i < list->count; i++)
+            {
+                const struct session_snapshot *snap = &list->items[i];
+                for (int c = 0; snap->viewers && c < snap->clients; c++)
+                {
+                    buf_printf(b, "rtspunch_client_%s{url=\"", def->name);
+                    buf_label(b, snap->url);
+                    buf_printf(b, "\",client=\"");
+                    buf_label(b, snap->viewers[c].name);
+                    buf_printf(b, "\",policy=\"%s\"} %llu\n", rtp_lag_policy_name(snap->viewers[c].policy),
+                               (unsigned long long)viewer_value(&snap->viewers[c], def));
+                }
+            }
+        }
+    }
+}
+
+static void render_json(struct metrics_buf *b, struct snapshot_list *list)
+{
+    buf_printf(b, "{\"sessions_total\":%llu,\"clients_total\":%llu,\"sessions\":[",
+               (unsigned long long)stat_get(&g_totals.sessions), (unsigned long long)stat_get(&g_totals.clients));
+
+    for (int i = 0; i < list->count; i++)
+    {
+        struct session_snapshot *snap = &list->items[i];
+
+        buf_printf(b, "%s{\"url\":\"", i ? "," : "");
+        buf_json(b, snap->url);
+        buf_printf(b, "\",\"state\":\"%s\",\"phase\":\"%s\",\"transport\":\"%s\",\"idle\":%s,\"clients\":%d",
+                   state_name(snap->state), rtsp_phase_name(snap->phase), snap->transport,
+                   snap->idle ? "true" : "false", snap->clients);
+        for (size_t m = 0; m < NUM_SESSION_METRICS; m++)
+            buf_printf(b, ",\"%s\":%llu", session_metrics[m].name, (unsigned long long)snap_value(snap, &session_metrics[m]));
+
+        buf_printf(b, ",\"phase_ms\":{");
+        int first = 1;
+        for (int p = 0; p <= RTSP_TEARDOWN; p++)
+        {
+            if (p == RTSP_KEEPALIVE)
+                continue;
+            buf_printf(b, "%s\"%s\":%llu", first ? "" : ",", rtsp_phase_name(p), (unsigned long long)snap->phase_ms[p]);
+            first = 0;
+        }
+
+        buf_printf(b, "},\"latency_us\":{\"count\":%llu", (unsigned long long)snap->latency.count);
+        for (int q = 0; q < 3; q++)
+            buf_printf(b, ",\"%s\":%llu", latency_quantile_names[q], (unsigned long long)hist_percentile(&snap->latency, latency_quantiles[q]));
+        buf_printf(b, ",\"max\":%llu}", (unsigned long long)snap->latency.max);
+
+        buf_printf(b, ",\"viewers\":[");
+        for (int c = 0; snap->viewers && c < snap->clients; c++)
+        {
+            buf_printf(b, "%s{\"client\":\"", c ? "," : "");
+            buf_json(b, snap->viewers[c].name);
+            buf_printf(b, "\",\"policy\":\"%s\"", rtp_lag_policy_name(snap->viewers[c].policy));
+            for (size_t m = 0; m < NUM_VIEWER_METRICS; m++)
+                buf_printf(b, ",\"%s\":%llu", viewer_metrics[m].name, (unsigned long long)viewer_value(&snap->viewers[c], &viewer_metrics[m]));
+            buf_printf(b, "}");
+        }
+        buf_printf(b, "]}");
+    }
+    buf_printf(b, "]}\n");
+}
+
+char *metrics_render(enum metrics_format format, size_t *len)
+{
+    struct snapshot_list list = {0};
+    struct metrics_buf body = {0};
+    char header[256];
+
+    session_foreach(snapshot_session, &list);
+
+    body.cap = 4096;
+    body.data = malloc(body.cap);
+    if (!body.data)
+        body.failed = 1;
+
+    if (format == METRICS_JSON)
+        render_json(&body, &list);
+    else
+        render_prometheus(&body, &list);
+    for (int i = 0; i < list.count; i++)
+        free(list.items[i].viewers);
+    free(list.items);
+
+    int n = snprintf(header, sizeof(header),
+                     "HTTP/1.1 200 OK\r\n"
+                     "Content-Type: %s\r\n"
+                     "Content-Length: %zu\r\n"
+                     "Cache-Control: no-cache\r\n"
+                     "Connection: close\r\n"
+                     "\r\n",
+                     format == METRICS_JSON ? "application/json" : "text/plain; version=0.0.4",
+                     body.len);
+
+    // 响应头和正文放在一起，由调用方非阻塞地写出
+    char *out = body.failed ? NULL : malloc(n + body.len);
+    if (out)
+    {
+        memcpy(out, header, n);
+        memcpy(out + n, body.data, body.len);
+        *len = n + body.len;
+    }
+    else
+    {
+        LOG_ERROR("Failed to render metrics");
+    }
+    free(body.data);
+    return out;
+}
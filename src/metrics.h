@@ -0,0 +1,63 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include "counter.h"
+#include "histogram.h"
+
+#define METRICS_PHASES 16
+
+// 上游会话的计数，除 sent_* 外都由会话所属的工作线程写入
+struct session_stats
+{
+    _Atomic uint64_t rtp_packets;  // 写入缓冲区的 RTP 包
+    _Atomic uint64_t rtp_bytes;
+    _Atomic uint64_t malformed;    // 被 get_rtp_payload 拒绝的包
+    _Atomic uint64_t stalls;       // 缓冲区满、暂停接收的次数
+    _Atomic uint64_t ts_packets;     // 做过完整性检查的 TS 包
+    _Atomic uint64_t ts_cc_errors;   // 连续计数错误
+    _Atomic uint64_t ts_sync_errors; // 同步字节错误
+    _Atomic uint64_t ts_tei;         // 传输错误指示置位
+    _Atomic uint64_t rtp_lost;       // 重排时放弃等待的序号
+    _Atomic uint64_t rtp_reordered;  // 缺口被乱序到达的包补上的次数
+    _Atomic uint64_t rtp_duplicates; // 重复的序号
+    _Atomic uint64_t rtp_late;       // 放弃等待之后才到达、被丢弃的包
+    _Atomic uint64_t rtp_foreign;    // 不是协商的服务器地址发来、被丢弃的包
+    _Atomic uint64_t ring_hwm;     // 生产者刷新最慢读指针时看到的最高占用（槽位）
+    _Atomic uint64_t phase_ms[METRICS_PHASES]; // 各握手阶段的累计耗时
+    uint64_t phase_since;          // 当前阶段的开始时间
+    _Atomic uint64_t jitter_us;    // RFC 3550 的到达间隔抖动
+    uint64_t last_arrival_ns;      // 以下三项计算抖动用，仅所属线程读写
+    uint32_t last_rtp_ts;
+    int64_t jitter_ns16;           // 抖动的 16 倍，按 RFC 3550 附录 A.8 的整数算法
+
+    // 已离开的客户端的发送计数，在 ctx->lock 下累加
+    _Atomic uint64_t sent_packets;
+    _Atomic uint64_t sent_bytes;
+    _Atomic uint64_t send_errors;
+    _Atomic uint64_t filtered_bytes;
+    _Atomic uint64_t lag_skips;
+    _Atomic uint64_t lag_skipped;
+    _Atomic uint64_t lag_disconnects;
+    struct histogram latency;      // 入环到交给内核的耗时（微秒）
+};
+
+struct rtp_reader;
+
+enum metrics_format
+{
+    METRICS_PROMETHEUS = 0,
+    METRICS_JSON,
+};
+
+void metrics_session_opened(void);
+void metrics_client_opened(void);
+// 会话释放、客户端离开时把计数并入全局总数，调用方持有会话表锁
+void metrics_session_retire(struct session_stats *stats);
+void metrics_reader_retire(struct session_stats *stats, struct rtp_reader *reader);
+void metrics_phase_done(int phase, uint64_t ms);
+
+// 生成 /metrics（Prometheus 文本格式）或 /status（JSON）的完整 HTTP 响应，调用方释放
+char *metrics_render(enum metrics_format format, size_t *len);
+
+#endif
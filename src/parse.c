@@ -0,0 +1,301 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <strings.h>
+#include <arpa/inet.h>
+#include "parse.h"
+
+int parse_http_url(const char *url, char *host, int *port, char *path)
+{
+
+    // /tcp/ 与 /rtp/ 相同，但要求上游使用交错 TCP 传输
+    if (strncmp(url, "/rtp/", 5) == 0 || strncmp(url, "/tcp/", 5) == 0)
+    {
+        if (sscanf(url + 5, "%127[^:]:%d/%511[^\n]", host, port, path) == 3)
+        {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int parse_ts_options(char *path, int *program, char *drop, size_t drop_len)
+{
+    *program = -1;
+    drop[0] = '\0';
+
+    char *query = strchr(path, '?');
+    if (!query)
+        return 0;
+
+    char params[PARSE_PATH_MAX];
+    if (snprintf(params, sizeof(params), "%s", query + 1) >= (int)sizeof(params))
+        return -1;
+
+    int found = 0;
+    char rest[PARSE_PATH_MAX];
+    size_t rest_len = 0;
+    char *save = NULL;
+    for (char *kv = strtok_r(params, "&", &save); kv; kv = strtok_r(NULL, "&", &save))
+    {
+        if (strncmp(kv, "program=", 8) == 0)
+        {
+            char *end;
+            long v = strtol(kv + 8, &end, 10);
+            if (*end != '\0' || end == kv + 8 || v < 1 || v > 65535)
+                return -1;
+            *program = (int)v;
+            found = 1;
+        }
+        else if (strncmp(kv, "drop=", 5) == 0)
+        {
+            if (snprintf(drop, drop_len, "%s", kv + 5) >= (int)drop_len)
+                return -1;
+            found = 1;
+        }
+        else if (rest_len < sizeof(rest))
+        {
+            rest_len += snprintf(rest + rest_len, sizeof(rest) - rest_len, "%s%s", rest_len ? "&" : "", kv);
+        }
+    }
+
+    // 没有过滤参数时不改动上游 URL；剩下的参数不会比原来长
+    if (!found)
+        return 0;
+    if (rest_len > 0)
+        memcpy(query + 1, rest, rest_len + 1);
+    else
+        *query = '\0';
+    return found;
+}
+
+int parse_query_take(char *path, const char *key, char *value, size_t value_len)
+{
+    value[0] = '\0';
+
+    char *query = strchr(path, '?');
+    if (!query)
+        return 0;
+
+    size_t key_len = strlen(key);
+    char *kv = query + 1;
+    while (*kv)
+    {
+        char *end = kv + strcspn(kv, "&");
+        if ((size_t)(end - kv) > key_len && strncmp(kv, key, key_len) == 0 && kv[key_len] == '=')
+        {
+            size_t n = end - kv - key_len - 1;
+            if (n >= value_len)
+                return -1;
+            memcpy(value, kv + key_len + 1, n);
+            value[n] = '\0';
+
+            // 连同一个分隔符一起删掉，没有其他参数时连 '?' 也删掉
+            if (*end == '&')
+                memmove(kv, end + 1, strlen(end + 1) + 1);
+            else if (kv == query + 1)
+                *query = '\0';
+            else
+                kv[-1] = '\0';
+            return 1;
+        }
+        kv = *end ? end + 1 : end;
+    }
+    return 0;
+}
+
+int parse_rtsp_uri(const char *uri, struct rtsp_uri *out)
+{
+    if (!uri || strncmp(uri, "rtsp://", 7) != 0)
+        return -1;
+    const char *p = uri + 7;
+    const char *slash = strchr(p, '/');
+    if (!slash)
+        return -1;
+    size_t hostlen = slash - p;
+    char hostport[sizeof(out->host)];
+    if (hostlen >= sizeof(hostport))
+        return -1;
+    memcpy(hostport, p, hostlen);
+    hostport[hostlen] = '\0';
+    char *colon = strchr(hostport, ':');
+    if (colon)
+    {
+        *colon = '\0';
+        out->port = atoi(colon + 1);
+        if (out->port <= 0)
+            out->port = 554;
+    }
+    else
+    {
+        out->port = 554;
+    }
+    // 截断时也保证以 '\0' 结尾
+    snprintf(out->host, sizeof(out->host), "%s", hostport);
+    snprintf(out->path, sizeof(out->path), "%s", slash); // include leading '/'
+    return 0;
+}
+
+// IPv6 地址必须带方括号，IPv4 不能带；转回文本得到规范写法，同一个组的不同写法共享会话
+static int parse_ip(const char *s, size_t len, int *family, struct in6_addr *addr, char *text)
+{
+    char buf[PARSE_ADDR_MAX];
+    int bracketed = len >= 2 && s[0] == '[' && s[len - 1] == ']';
+    if (bracketed)
+    {
+        s++;
+        len -= 2;
+    }
+    if (len == 0 || len >= sizeof(buf))
+        return -1;
+    memcpy(buf, s, len);
+    buf[len] = '\0';
+
+    if (!bracketed && inet_pton(AF_INET, buf, addr) == 1)
+        *family = AF_INET;
+    else if (bracketed && inet_pton(AF_INET6, buf, addr) == 1)
+        *family = AF_INET6;
+    else
+        return -1;
+    inet_ntop(*family, addr, text, PARSE_ADDR_MAX);
+    return 0;
+}
+
+static int is_multicast(int family, const struct in6_addr *addr)
+{
+    if (family == AF_INET)
+        return (ntohl(((const struct in_addr *)addr)->s_addr) >> 28) == 0xE;
+    return IN6_IS_ADDR_MULTICAST(addr);
+}
+
+int parse_mcast_addr(const char *s, struct mcast_group *out, const char **rest)
+{
+    struct in6_addr group, source;
+    int source_family = 0;
+
+    memset(out, 0, sizeof(*out));
+    const char *end = s + strcspn(s, "/?");
+    if (*end == '/')
+        return -1;
+
+    const char *at = memchr(s, '@', end - s);
+    if (at)
+    {
+        if (parse_ip(s, at - s, &source_family, &source, out->source) != 0)
+            return -1;
+        s = at + 1;
+    }
+
+    const char *colon;
+    if (*s == '[')
+    {
+        colon = memchr(s, ']', end - s);
+        if (colon)
+            colon++;
+    }
+    else
+    {
+        colon = memchr(s, ':', end - s);
+    }
+    if (!colon || colon >= end || *colon != ':')
+        return -1;
+    if (parse_ip(s, colon - s, &out->family, &group, out->group) != 0 || !is_multicast(out->family, &group))
+        return -1;
+    if (at && (source_family != out->family || is_multicast(source_family, &source)))
+        return -1;
+
+    long port = 0;
+    const char *p = colon + 1;
+    if (p == end)
+        return -1;
+    for (; p < end; p++)
+    {
+        if (!isdigit((unsigned char)*p) || (port = port * 10 + (*p - '0')) > 65535)
+            return -1;
+    }
+    if (port == 0)
+        return -1;
+    out->port = (int)port;
+    *rest = end;
+    return 0;
+}
+
+int format_mcast_addr(const struct mcast_group *g, char *buf, size_t len)
+{
+    const char *l = g->family == AF_INET6 ? "[" : "";
+    const char *r = g->family == AF_INET6 ? "]" : "";
+    int n;
+    if (g->source[0])
+        n = snprintf(buf, len, "%s%s%s@%s%s%s:%d", l, g->source, r, l, g->group, r, g->port);
+    else
+        n = snprintf(buf, len, "%s%s%s:%d", l, g->group, r, g->port);
+    return n < 0 || (size_t)n >= len ? -1 : 0;
+}
+
+int parse_status_code(const char *resp)
+{
+    int code = 0;
+    if (sscanf(resp, "RTSP/%*s %d", &code) == 1)
+        return code;
+    return -1;
+}
+
+char *get_header_value(char *resp, const char *header)
+{
+    // returns pointer into resp where value begins. Caller should not free.
+    char *h = strcasestr(resp, header);
+    if (!h)
+        return NULL;
+    char *colon = strchr(h, ':');
+    if (!colon)
+        return NULL;
+    char *v = colon + 1;
+    while (*v == ' ' || *v == '\t')
+        v++;
+    // trim end of line
+    char *eol = strchr(v, '\r');
+    if (!eol)
+        eol = strchr(v, '\n');
+    if (eol)
+        *eol = '\0';
+    return v;
+}
+
+size_t parse_response_length(const char *buf, size_t len)
+{
+    // 交错模式下响应后面可能紧跟二进制的 $ 帧，只在已收到的范围内查找，头部里也可能有 NUL
+    const char *end = memmem(buf, len, "\r\n\r\n", 4);
+    if (!end)
+        return 0;
+
+    size_t header_len = end + 4 - buf;
+    size_t body_len = 0;
+
+    const char *p = buf;
+    while (p < end)
+    {
+        const char *eol = memmem(p, end + 2 - p, "\r\n", 2);
+        if (!eol)
+            break;
+        if (eol - p >= 15 && strncasecmp(p, "Content-Length:", 15) == 0)
+        {
+            const char *v = p + 15;
+            while (v < eol && (*v == ' ' || *v == '\t'))
+                v++;
+            body_len = 0;
+            for (; v < eol && *v >= '0' && *v <= '9'; v++)
+            {
+                body_len = body_len * 10 + (*v - '0');
+                if (body_len > len)
+                    return 0;
+            }
+        }
+        p = eol + 2;
+    }
+
+    if (body_len > len - header_len)
+        return 0;
+    return header_len + body_len;
+}
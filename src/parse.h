@@ -0,0 +1,74 @@
+#ifndef PARSE_H
+#define PARSE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// 解析来自网络的不可信数据，单独成文件以便做基准测试和模糊测试
+
+// 按字节读取网络序整数，不要求地址对齐
+static inline uint16_t load_be16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static inline uint32_t load_be32(const uint8_t *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static inline void store_be16(uint8_t *p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static inline void store_be32(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+#define PARSE_HOST_MAX 128
+#define PARSE_PATH_MAX 512
+
+struct rtsp_uri
+{
+    char host[256];
+    int port;
+    char path[512];
+};
+
+// /rtp/host:port/path 与 /tcp/host:port/path，host 至少 PARSE_HOST_MAX 字节，path 至少 PARSE_PATH_MAX 字节
+int parse_http_url(const char *url, char *host, int *port, char *path);
+// 取出 path 查询串中的 program= 和 drop=，其余参数原样留给上游。
+// 返回 1 表示有过滤参数，0 表示没有，-1 表示参数无效
+int parse_ts_options(char *path, int *program, char *drop, size_t drop_len);
+// 取出并删除 path 查询串中的 key=value。返回 1 表示找到，0 表示没有，-1 表示值太长
+int parse_query_take(char *path, const char *key, char *value, size_t value_len);
+int parse_rtsp_uri(const char *uri, struct rtsp_uri *out);
+
+#define PARSE_ADDR_MAX 46 // INET6_ADDRSTRLEN
+
+// 组播地址 [source@]group:port，IPv6 地址写在方括号中，例如 10.0.0.1@239.1.1.1:5000 或 [ff3e::1]:5000
+struct mcast_group
+{
+    int family;                   // AF_INET 或 AF_INET6
+    char group[PARSE_ADDR_MAX];   // 规范化后的地址文本
+    char source[PARSE_ADDR_MAX];  // 为空表示任意源组播
+    int port;
+};
+
+// 成功时 *rest 指向端口之后的部分（只可能为空或以 '?' 开头）。不是组播组地址时返回 -1
+int parse_mcast_addr(const char *s, struct mcast_group *out, const char **rest);
+// 按 parse_mcast_addr 接受的格式写回，用作共享会话的键
+int format_mcast_addr(const struct mcast_group *g, char *buf, size_t len);
+int parse_status_code(const char *resp);
+// 返回 resp 中头部值的起始位置，并把该行行尾改成 '\0'
+char *get_header_value(char *resp, const char *header);
+// 返回 buf 中第一个完整 RTSP 响应（含 body）的长度，不完整时返回 0。buf 不要求以 NUL 结尾
+size_t parse_response_length(const char *buf, size_t len);
+
+#endif
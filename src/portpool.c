@@ -0,0 +1,300 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "portpool.h"
+#include "resolve.h"
+#include "stun.h"
+#include "config.h"
+#include "loop.h"
+#include "logs.h"
+
+#define STUN_WARMUP_TIMEOUT_MS 1000
+
+static pthread_mutex_t g_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct port_pair **g_queue = NULL; // 空闲端口对的环形队列
+static int g_capacity = 0;
+static int g_head = 0;
+static int g_count = 0;
+static int g_next_port = 0;               // 下一次绑定从这里开始找，受 g_pool_lock 保护
+
+static int bind_udp(int port)
+{
+    const struct server_config *config = get_server_config();
+    int s = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (s < 0)
+        return -1;
+
+    // 码率突发时内核缓冲区要能装下一批包
+    int rcvbuf = config->sock_rcvbuf;
+    if (rcvbuf > 0)
+        setsockopt(s, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+    if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        close(s);
+        return -1;
+    }
+    return s;
+}
+
+// 在配置的端口范围内找一对空闲端口，已被占用的跳过
+static struct port_pair *bind_pair(void)
+{
+    const struct server_config *config = get_server_config();
+    int lo = (config->port_min + 1) & ~1;
+    int hi = config->port_max;
+    int pairs = (hi - lo + 1) / 2;
+
+    if (pairs <= 0)
+    {
+        LOG_ERROR("Invalid RTP port range %d-%d", config->port_min, config->port_max);
+        return NULL;
+    }
+
+    for (int i = 0; i < pairs; i++)
+    {
+        pthread_mutex_lock(&g_pool_lock);
+        if (g_next_port < lo || g_next_port + 1 > hi)
+            g_next_port = lo;
+        int port = g_next_port;
+        g_next_port += 2;
+        pthread_mutex_unlock(&g_pool_lock);
+
+        int rtp = bind_udp(port);
+        if (rtp < 0)
+            continue;
+        // 收包时由内核打时间戳，统计的停留时间包含在 socket 缓冲区中排队的部分
+        int on = 1;
+        setsockopt(rtp, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+        int rtcp = bind_udp(port + 1);
+        if (rtcp < 0)
+        {
+            close(rtp);
+            continue;
+        }
+
+        struct port_pair *pair = (struct port_pair *)calloc(1, sizeof(struct port_pair));
+        if (pair == NULL)
+        {
+            close(rtp);
+            close(rtcp);
+            LOG_ERROR("Failed to allocate memory for port pair");
+            return NULL;
+        }
+        pair->rtp_sock = rtp;
+        pair->rtcp_sock = rtcp;
+        pair->port = port;
+        return pair;
+    }
+
+    LOG_ERROR("No free RTP/RTCP port pair in %d-%d", lo, hi);
+    return NULL;
+}
+
+static void free_pair(struct port_pair *pair)
+{
+    close(pair->rtp_sock);
+    close(pair->rtcp_sock);
+    free(pair);
+}
+
+static void drain(int fd)
+{
+    char buf[2048];
+    while (recv(fd, buf, sizeof(buf), MSG_DONTWAIT) > 0)
+        ;
+}
+
+static struct port_pair *pop_locked(void)
+{
+    if (g_count == 0)
+        return NULL;
+    struct port_pair *pair = g_queue[g_head];
+    g_head = (g_head + 1) % g_capacity;
+    g_count--;
+    return pair;
+}
+
+static int push_locked(struct port_pair *pair)
+{
+    if (g_count == g_capacity)
+        return -1;
+    g_queue[(g_head + g_count) % g_capacity] = pair;
+    g_count++;
+    return 0;
+}
+
+struct port_pair *portpool_get(void)
+{
+    pthread_mutex_lock(&g_pool_lock);
+    struct port_pair *pair = pop_locked();
+    pthread_mutex_unlock(&g_pool_lock);
+
+    if (pair)
+        return pair;
+    return bind_pair();
+}
+
+void portpool_put(struct port_pair *pair)
+{
+    if (pair == NULL)
+        return;
+
+    // 上一个上游在 TEARDOWN 之后可能还发来几个包
+    drain(pair->rtp_sock);
+    drain(pair->rtcp_sock);
+
+    pthread_mutex_lock(&g_pool_lock);
+    int queued = pair->pooled && push_locked(pair) == 0;
+    pthread_mutex_unlock(&g_pool_lock);
+
+    if (!queued)
+        free_pair(pair);
+}
+
+void portpool_discard(struct port_pair *pair)
+{
+    if (pair)
+        free_pair(pair);
+}
+
+int portpool_mapped_port(struct port_pair *pair)
+{
+    int mapped = 0;
+
+    pthread_mutex_lock(&g_pool_lock);
+    if (pair->mapped_port && loop_now_ms() - pair->mapped_at < PORT_PAIR_MAPPING_TTL_MS)
+        mapped = pair->mapped_port;
+    pthread_mutex_unlock(&g_pool_lock);
+
+    return mapped;
+}
+
+void portpool_set_mapping(struct port_pair *pair, int mapped_port)
+{
+    pthread_mutex_lock(&g_pool_lock);
+    pair->mapped_port = mapped_port;
+    pair->mapped_at = loop_now_ms();
+    pthread_mutex_unlock(&g_pool_lock);
+}
+
+// 用端口对的 RTP socket 做一次 STUN，既得到映射也刷新 NAT 上的映射表项
+static void warmup_pair(struct port_pair *pair)
+{
+    const struct server_config *config = get_server_config();
+    struct stun_server servers[STUN_MAX_SERVERS];
+    struct sockaddr_in addrs[STUN_MAX_SERVERS];
+    unsigned char req[STUN_REQUEST_SIZE], tid[12];
+    int n = stun_parse_servers(config->stun_servers, servers, STUN_MAX_SERVERS);
+    int naddrs = 0;
+
+    for (int i = 0; i < n; i++)
+    {
+        struct resolve_result res;
+        if (resolve_blocking(servers[i].host, servers[i].port, AF_INET, SOCK_DGRAM, &res) == 0 &&
+            res.addrs[0].family == AF_INET)
+            memcpy(&addrs[naddrs++], &res.addrs[0].addr, sizeof(addrs[0]));
+    }
+    if (naddrs == 0)
+        return;
+
+    stun_build_request(req, tid);
+    for (int i = 0; i < naddrs; i++)
+        sendto(pair->rtp_sock, req, sizeof(req), 0, (struct sockaddr *)&addrs[i], sizeof(addrs[i]));
+
+    uint64_t deadline = loop_now_ms() + STUN_WARMUP_TIMEOUT_MS;
+    struct pollfd pfd = {pair->rtp_sock, POLLIN, 0};
+    uint64_t now;
+    while ((now = loop_now_ms()) < deadline && poll(&pfd, 1, deadline - now) > 0)
+    {
+        unsigned char rsp[1500];
+        char pub_ip[64];
+        int wan_port = 0;
+        ssize_t len = recv(pair->rtp_sock, rsp, sizeof(rsp), MSG_DONTWAIT);
+        if (len > 0 && stun_parse_response(rsp, len, tid, pub_ip, sizeof(pub_ip), &wan_port) == 0 && wan_port)
+        {
+            portpool_set_mapping(pair, wan_port);
+            LOG_DEBUG("Warm mapping %s:%d -> %d", pub_ip, wan_port, pair->port);
+            return;
+        }
+    }
+}
+
+// 依次取出池中的端口对刷新映射，期间会话取用其余的端口对
+static void *warmup_thread(void *arg)
+{
+    while (1)
+    {
+        pthread_mutex_lock(&g_pool_lock);
+        int count = g_count;
+        pthread_mutex_unlock(&g_pool_lock);
+
+        for (int i = 0; i < count; i++)
+        {
+            pthread_mutex_lock(&g_pool_lock);
+            struct port_pair *pair = pop_locked();
+            pthread_mutex_unlock(&g_pool_lock);
+            if (pair == NULL)
+                break;
+
+            warmup_pair(pair);
+
+            pthread_mutex_lock(&g_pool_lock);
+            int queued = push_locked(pair) == 0;
+            pthread_mutex_unlock(&g_pool_lock);
+            if (!queued)
+                free_pair(pair);
+        }
+
+        usleep(PORT_WARMUP_INTERVAL_MS * 1000);
+    }
+
+    return NULL;
+}
+
+int portpool_init(void)
+{
+    const struct server_config *config = get_server_config();
+
+    if (config->port_pool <= 0)
+        return 0;
+
+    g_queue = (struct port_pair **)calloc(config->port_pool, sizeof(struct port_pair *));
+    if (g_queue == NULL)
+    {
+        LOG_ERROR("Failed to allocate memory for port pool");
+        return -1;
+    }
+    g_capacity = config->port_pool;
+
+    for (int i = 0; i < config->port_pool; i++)
+    {
+        struct port_pair *pair = bind_pair();
+        if (pair == NULL)
+            break;
+        pair->pooled = 1;
+        push_locked(pair);
+    }
+    LOG_INFO("Port pool: %d RTP/RTCP pairs in %d-%d", g_count, config->port_min, config->port_max);
+
+    if (config->stun_warmup && config->enable_nat)
+    {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, warmup_thread, NULL) != 0)
+            LOG_ERROR("Failed to create STUN warm-up thread");
+        else
+            pthread_detach(tid);
+    }
+
+    return 0;
+}
@@ -0,0 +1,34 @@
+#ifndef PORTPOOL_H
+#define PORTPOOL_H
+
+#include <stdint.h>
+
+#define PORT_PAIR_MAPPING_TTL_MS 20000
+#define PORT_WARMUP_INTERVAL_MS 15000
+
+// 绑定好的 RTP/RTCP 端口对，RTP 用偶数端口，RTCP 用相邻的奇数端口
+struct port_pair
+{
+    int rtp_sock;
+    int rtcp_sock;
+    int port;
+    int mapped_port;    // STUN 得到的公网端口，0 表示未知
+    uint64_t mapped_at;
+    int pooled;         // 属于预绑定的池，归还时放回池中
+};
+
+// 启动时预绑定 --port-pool 个端口对，开启 --stun-warmup 时在后台为它们维持公网映射
+int portpool_init(void);
+
+// O(1) 取出一个端口对；池空时在端口范围内现绑一个，冲突时换下一个端口
+struct port_pair *portpool_get(void);
+// 读空残留数据后放回池尾，最久未用的先被取出
+void portpool_put(struct port_pair *pair);
+// 上游可能还在往这对端口发送时直接关闭，不放回池中
+void portpool_discard(struct port_pair *pair);
+
+// 映射未过期时返回公网端口，否则返回 0
+int portpool_mapped_port(struct port_pair *pair);
+void portpool_set_mapping(struct port_pair *pair, int mapped_port);
+
+#endif
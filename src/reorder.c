@@ -0,0 +1,172 @@
+#include <stdlib.h>
+#include <string.h>
+#include "reorder.h"
+#include "loop.h"
+#include "logs.h"
+
+int rtp_reorder_init(struct rtp_reorder *ro, size_t stride, int hold_ms, struct session_stats *stats)
+{
+    memset(ro, 0, sizeof(*ro));
+    ro->stride = stride;
+    ro->hold_ms = hold_ms;
+    ro->stats = stats;
+
+    ro->staging = (uint8_t *)malloc(stride * RTP_REORDER_WINDOW);
+    if (ro->staging == NULL)
+    {
+        LOG_ERROR("Failed to allocate memory for RTP reorder buffer");
+        return -1;
+    }
+    return 0;
+}
+
+void rtp_reorder_free(struct rtp_reorder *ro)
+{
+    free(ro->staging);
+    ro->staging = NULL;
+}
+
+static struct rtp_slot *staging_slot(struct rtp_reorder *ro, uint16_t seq)
+{
+    return (struct rtp_slot *)(ro->staging + (seq % RTP_REORDER_WINDOW) * ro->stride);
+}
+
+static void slot_copy(struct rtp_slot *dst, const struct rtp_slot *src)
+{
+    if (dst != src)
+        memcpy(dst, src, sizeof(*src) + src->offset + src->len);
+}
+
+static int is_staged(struct rtp_reorder *ro, uint16_t seq)
+{
+    int i = seq % RTP_REORDER_WINDOW;
+    return ro->used[i] && ro->seqs[i] == seq;
+}
+
+// 发布 expected，同一位置上更早放弃的序号不再需要记住
+static void advance(struct rtp_reorder *ro)
+{
+    ro->gone[ro->expected % RTP_REORDER_WINDOW] = 0;
+    ro->expected++;
+}
+
+// 把从 expected 开始连续的暂存包发布出去
+static void drain(struct rtp_reorder *ro, struct rtp_buffer *rtp_buf, uint64_t limit, uint64_t *head)
+{
+    while (ro->staged > 0 && *head < limit && is_staged(ro, ro->expected))
+    {
+        slot_copy(rtp_buffer_slot(rtp_buf, *head), staging_slot(ro, ro->expected));
+        ro->used[ro->expected % RTP_REORDER_WINDOW] = 0;
+        ro->staged--;
+        advance(ro);
+        (*head)++;
+    }
+}
+
+// 跳过当前缺口，直到下一个暂存的包
+static void skip_gap(struct rtp_reorder *ro)
+{
+    for (int d = 1; d < RTP_REORDER_WINDOW; d++)
+    {
+        if (is_staged(ro, (uint16_t)(ro->expected + d)))
+        {
+            stat_add(&ro->stats->rtp_lost, d);
+            for (int k = 0; k < d; k++, ro->expected++)
+            {
+                ro->gone_seqs[ro->expected % RTP_REORDER_WINDOW] = ro->expected;
+                ro->gone[ro->expected % RTP_REORDER_WINDOW] = 1;
+            }
+            return;
+        }
+    }
+}
+
+// 放弃所有缺口并重新从 seq 开始同步。暂存包之间的缺口由 skip_gap 计入丢失，
+// 向前跳变时最后一个暂存包到 seq 之间的序号再计一次，每个序号只算一次
+static void resync(struct rtp_reorder *ro, struct rtp_buffer *rtp_buf, uint16_t seq, int forward, uint64_t *head)
+{
+    while (ro->staged > 0)
+    {
+        skip_gap(ro);
+        drain(ro, rtp_buf, UINT64_MAX, head);
+    }
+    if (forward)
+        stat_add(&ro->stats->rtp_lost, (uint16_t)(seq - ro->expected));
+    ro->expected = seq;
+}
+
+void rtp_reorder_push(struct rtp_reorder *ro, struct rtp_buffer *rtp_buf, uint64_t landing, uint16_t seq, uint64_t *head)
+{
+    struct rtp_slot *slot = rtp_buffer_slot(rtp_buf, landing);
+
+    if (!ro->synced)
+    {
+        ro->expected = seq;
+        ro->synced = 1;
+    }
+
+    int16_t d = (int16_t)(seq - ro->expected);
+
+    // 序号跳变太大（源切换或长时间丢包），放弃等待
+    if (d >= RTP_REORDER_WINDOW || d <= -RTP_REORDER_WINDOW)
+    {
+        resync(ro, rtp_buf, seq, d > 0, head);
+        d = 0;
+    }
+
+    if (d < 0)
+    {
+        // 放弃等待后才到的包已经算过丢失，改记为迟到；其余是已经发布过的重复包
+        int i = seq % RTP_REORDER_WINDOW;
+        if (ro->gone[i] && ro->gone_seqs[i] == seq)
+        {
+            ro->gone[i] = 0;
+            stat_set(&ro->stats->rtp_lost, stat_get(&ro->stats->rtp_lost) - 1);
+            stat_add(&ro->stats->rtp_late, 1);
+        }
+        else
+        {
+            stat_add(&ro->stats->rtp_duplicates, 1);
+        }
+        return;
+    }
+
+    if (d == 0)
+    {
+        slot_copy(rtp_buffer_slot(rtp_buf, *head), slot);
+        (*head)++;
+        advance(ro);
+        if (ro->staged > 0)
+        {
+            stat_add(&ro->stats->rtp_reordered, 1);
+            drain(ro, rtp_buf, UINT64_MAX, head);
+            ro->hold_since = loop_now_ms();
+        }
+        return;
+    }
+
+    if (is_staged(ro, seq))
+    {
+        stat_add(&ro->stats->rtp_duplicates, 1);
+        return;
+    }
+
+    if (ro->staged == 0)
+        ro->hold_since = loop_now_ms();
+    slot_copy(staging_slot(ro, seq), slot);
+    ro->seqs[seq % RTP_REORDER_WINDOW] = seq;
+    ro->used[seq % RTP_REORDER_WINDOW] = 1;
+    ro->staged++;
+}
+
+void rtp_reorder_expire(struct rtp_reorder *ro, struct rtp_buffer *rtp_buf, uint64_t now, uint64_t limit, uint64_t *head)
+{
+    if (ro->staged == 0 || now - ro->hold_since < (uint64_t)ro->hold_ms)
+        return;
+
+    if (!is_staged(ro, ro->expected))
+        skip_gap(ro);
+    // 缓冲区没有空位时剩下的包继续暂存，下次再发布
+    drain(ro, rtp_buf, limit, head);
+    ro->hold_since = now;
+}
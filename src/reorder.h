@@ -0,0 +1,39 @@
+#ifndef REORDER_H
+#define REORDER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "rtp.h"
+
+#define RTP_REORDER_WINDOW 64
+
+// 按 RTP 序号重排。按序到达的包留在接收时的槽位中直接发布，不增加延迟；
+// 只有提前到达的包被拷贝到暂存区，等缺口补上或超过 hold_ms 后放弃缺口再发布
+struct rtp_reorder
+{
+    uint8_t *staging;                   // RTP_REORDER_WINDOW 个槽位，布局与环形缓冲区相同
+    size_t stride;
+    uint16_t seqs[RTP_REORDER_WINDOW];
+    uint8_t used[RTP_REORDER_WINDOW];
+    int staged;                         // 暂存的包数
+    uint16_t expected;                  // 下一个要发布的序号
+    int synced;
+    int hold_ms;
+    uint64_t hold_since;                // 当前缺口开始等待的时间
+
+    uint16_t gone_seqs[RTP_REORDER_WINDOW]; // 最近放弃的序号，之后再到达的算迟到而不是重复
+    uint8_t gone[RTP_REORDER_WINDOW];
+
+    struct session_stats *stats; // rtp_lost、rtp_reordered、rtp_duplicates、rtp_late
+};
+
+int rtp_reorder_init(struct rtp_reorder *ro, size_t stride, int hold_ms, struct session_stats *stats);
+void rtp_reorder_free(struct rtp_reorder *ro);
+
+// 处理收在槽位 landing 的包，按序的包发布到 *head。调用方保证 landing >= *head + staged
+void rtp_reorder_push(struct rtp_reorder *ro, struct rtp_buffer *rtp_buf, uint64_t landing, uint16_t seq, uint64_t *head);
+
+// 放弃等待超时的缺口，最多发布到 limit 之前
+void rtp_reorder_expire(struct rtp_reorder *ro, struct rtp_buffer *rtp_buf, uint64_t now, uint64_t limit, uint64_t *head);
+
+#endif
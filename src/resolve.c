@@ -0,0 +1,308 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <netdb.h>
+#include "resolve.h"
+#include "config.h"
+#include "logs.h"
+
+struct resolve_req
+{
+    struct ev_loop *loop;
+    resolve_cb cb;
+    void *arg;
+    int posted;    // 已交给 loop，由投递任务释放；受 g_resolve_lock 保护
+    int cancelled; // 只在所属 loop 线程中访问
+    struct resolve_result result;
+    struct resolve_req *next;
+};
+
+struct resolve_entry
+{
+    char host[256];
+    int port;
+    int family;
+    int socktype;
+    int resolving;
+    uint64_t expires;
+    uint64_t used;
+    struct resolve_result result;
+    struct resolve_req *waiters;
+    struct resolve_entry *next_job;
+};
+
+static pthread_mutex_t g_resolve_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_resolve_cond = PTHREAD_COND_INITIALIZER;
+static pthread_once_t g_resolve_once = PTHREAD_ONCE_INIT;
+static struct resolve_entry g_entries[RESOLVE_CACHE_MAX];
+static struct resolve_entry *g_jobs = NULL;
+static struct resolve_entry **g_jobs_tail = &g_jobs;
+
+static void copy_addrinfo(struct resolve_result *out, struct addrinfo *res)
+{
+    out->count = 0;
+    for (struct addrinfo *rp = res; rp && out->count < RESOLVE_MAX_ADDRS; rp = rp->ai_next)
+    {
+        if (rp->ai_addrlen > sizeof(struct sockaddr_storage))
+            continue;
+        struct resolve_addr *a = &out->addrs[out->count++];
+        a->family = rp->ai_family;
+        a->socktype = rp->ai_socktype;
+        a->protocol = rp->ai_protocol;
+        a->addrlen = rp->ai_addrlen;
+        memcpy(&a->addr, rp->ai_addr, rp->ai_addrlen);
+    }
+    out->status = out->count > 0 ? 0 : -1;
+}
+
+static int do_getaddrinfo(const char *host, int port, int family, int socktype, int flags, struct resolve_result *out)
+{
+    struct addrinfo hints, *res = NULL;
+    char portstr[16];
+    snprintf(portstr, sizeof(portstr), "%d", port);
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = family;
+    hints.ai_socktype = socktype;
+    hints.ai_flags = flags;
+
+    if (getaddrinfo(host, portstr, &hints, &res) != 0)
+        return -1;
+    copy_addrinfo(out, res);
+    freeaddrinfo(res);
+    return out->status;
+}
+
+static struct resolve_entry *find_locked(const char *host, int port, int family, int socktype)
+{
+    for (int i = 0; i < RESOLVE_CACHE_MAX; i++)
+    {
+        struct resolve_entry *e = &g_entries[i];
+        if (e->host[0] && e->port == port && e->family == family && e->socktype == socktype &&
+            strcmp(e->host, host) == 0)
+            return e;
+    }
+    return NULL;
+}
+
+// 替换最久未用且没有查询在进行的条目
+static struct resolve_entry *alloc_locked(void)
+{
+    struct resolve_entry *victim = NULL;
+    for (int i = 0; i < RESOLVE_CACHE_MAX; i++)
+    {
+        struct resolve_entry *e = &g_entries[i];
+        if (e->host[0] == '\0')
+            return e;
+        if (!e->resolving && (victim == NULL || e->used < victim->used))
+            victim = e;
+    }
+    return victim;
+}
+
+static void deliver_task(struct ev_loop *loop, void *arg)
+{
+    struct resolve_req *req = (struct resolve_req *)arg;
+
+    if (!req->cancelled)
+        req->cb(req->arg, &req->result);
+    free(req);
+}
+
+static void *resolve_thread(void *arg)
+{
+    while (1)
+    {
+        pthread_mutex_lock(&g_resolve_lock);
+        while (g_jobs == NULL)
+            pthread_cond_wait(&g_resolve_cond, &g_resolve_lock);
+        struct resolve_entry *e = g_jobs;
+        g_jobs = e->next_job;
+        if (g_jobs == NULL)
+            g_jobs_tail = &g_jobs;
+        char host[256];
+        int port = e->port, family = e->family, socktype = e->socktype;
+        snprintf(host, sizeof(host), "%s", e->host);
+        pthread_mutex_unlock(&g_resolve_lock);
+
+        struct resolve_result result;
+        memset(&result, 0, sizeof(result));
+        uint64_t start = loop_now_ms();
+        if (do_getaddrinfo(host, port, family, socktype, 0, &result) < 0)
+        {
+            result.status = -1;
+            result.count = 0;
+            LOG_WARN("Failed to resolve host %s", host);
+        }
+        LOG_DEBUG("Resolved %s in %llu ms", host, (unsigned long long)(loop_now_ms() - start));
+
+        pthread_mutex_lock(&g_resolve_lock);
+        int ttl = result.status == 0 ? get_server_config()->dns_ttl_ms : RESOLVE_NEGATIVE_TTL_MS;
+        e->result = result;
+        e->resolving = 0;
+        e->used = loop_now_ms();
+        e->expires = e->used + (ttl > 0 ? ttl : 0);
+        struct resolve_req *waiters = e->waiters;
+        e->waiters = NULL;
+        for (struct resolve_req *r = waiters; r; r = r->next)
+        {
+            r->result = result;
+            r->posted = 1;
+        }
+        pthread_mutex_unlock(&g_resolve_lock);
+
+        while (waiters)
+        {
+            struct resolve_req *next = waiters->next;
+            if (loop_post(waiters->loop, deliver_task, waiters) < 0)
+                LOG_ERROR("Failed to deliver DNS result for %s", host);
+            waiters = next;
+        }
+    }
+
+    return NULL;
+}
+
+static void resolve_init(void)
+{
+    for (int i = 0; i < RESOLVE_THREADS; i++)
+    {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, resolve_thread, NULL) != 0)
+        {
+            LOG_ERROR("Failed to create resolver thread");
+            continue;
+        }
+        pthread_detach(tid);
+    }
+}
+
+int resolve_lookup(const char *host, int port, int family, int socktype, struct resolve_result *out)
+{
+    // 上游通常直接写 IP 地址，不需要经过缓存和解析线程
+    if (do_getaddrinfo(host, port, family, socktype, AI_NUMERICHOST, out) == 0)
+        return 1;
+
+    int hit = 0;
+    pthread_mutex_lock(&g_resolve_lock);
+    struct resolve_entry *e = find_locked(host, port, family, socktype);
+    if (e && !e->resolving && loop_now_ms() < e->expires)
+    {
+        *out = e->result;
+        e->used = loop_now_ms();
+        hit = 1;
+    }
+    pthread_mutex_unlock(&g_resolve_lock);
+
+    return hit;
+}
+
+int resolve_blocking(const char *host, int port, int family, int socktype, struct resolve_result *out)
+{
+    if (resolve_lookup(host, port, family, socktype, out))
+        return out->status;
+
+    memset(out, 0, sizeof(*out));
+    if (do_getaddrinfo(host, port, family, socktype, 0, out) < 0)
+        out->status = -1;
+
+    pthread_mutex_lock(&g_resolve_lock);
+    struct resolve_entry *e = find_locked(host, port, family, socktype);
+    if (e == NULL)
+    {
+        e = alloc_locked();
+        if (e)
+        {
+            memset(e, 0, sizeof(*e));
+            snprintf(e->host, sizeof(e->host), "%s", host);
+            e->port = port;
+            e->family = family;
+            e->socktype = socktype;
+        }
+    }
+    // 正在进行的异步查询完成时会自己写入结果
+    if (e && !e->resolving)
+    {
+        int ttl = out->status == 0 ? get_server_config()->dns_ttl_ms : RESOLVE_NEGATIVE_TTL_MS;
+        e->result = *out;
+        e->used = loop_now_ms();
+        e->expires = e->used + (ttl > 0 ? ttl : 0);
+    }
+    pthread_mutex_unlock(&g_resolve_lock);
+
+    return out->status;
+}
+
+struct resolve_req *resolve_start(struct ev_loop *loop, const char *host, int port, int family, int socktype,
+                                  resolve_cb cb, void *arg)
+{
+    pthread_once(&g_resolve_once, resolve_init);
+
+    struct resolve_req *req = (struct resolve_req *)calloc(1, sizeof(struct resolve_req));
+    if (req == NULL)
+    {
+        LOG_ERROR("Failed to allocate memory for DNS request");
+        return NULL;
+    }
+    req->loop = loop;
+    req->cb = cb;
+    req->arg = arg;
+
+    pthread_mutex_lock(&g_resolve_lock);
+    struct resolve_entry *e = find_locked(host, port, family, socktype);
+    if (e == NULL || !e->resolving)
+    {
+        if (e == NULL)
+            e = alloc_locked();
+        if (e == NULL)
+        {
+            pthread_mutex_unlock(&g_resolve_lock);
+            free(req);
+            LOG_ERROR("DNS cache full of in-flight queries");
+            return NULL;
+        }
+        memset(e, 0, sizeof(*e));
+        snprintf(e->host, sizeof(e->host), "%s", host);
+        e->port = port;
+        e->family = family;
+        e->socktype = socktype;
+        e->resolving = 1;
+        *g_jobs_tail = e;
+        g_jobs_tail = &e->next_job;
+        pthread_cond_signal(&g_resolve_cond);
+    }
+    req->next = e->waiters;
+    e->waiters = req;
+    pthread_mutex_unlock(&g_resolve_lock);
+
+    return req;
+}
+
+void resolve_cancel(struct resolve_req *req)
+{
+    if (req == NULL)
+        return;
+
+    pthread_mutex_lock(&g_resolve_lock);
+    if (!req->posted)
+    {
+        // 还在等待解析结果，从等待列表中摘除
+        for (int i = 0; i < RESOLVE_CACHE_MAX; i++)
+        {
+            for (struct resolve_req **pp = &g_entries[i].waiters; *pp; pp = &(*pp)->next)
+            {
+                if (*pp == req)
+                {
+                    *pp = req->next;
+                    pthread_mutex_unlock(&g_resolve_lock);
+                    free(req);
+                    return;
+                }
+            }
+        }
+    }
+    pthread_mutex_unlock(&g_resolve_lock);
+
+    // 结果已经投递到 loop，投递任务会释放它
+    req->cancelled = 1;
+}
@@ -0,0 +1,45 @@
+#ifndef RESOLVE_H
+#define RESOLVE_H
+
+#include <sys/socket.h>
+#include "loop.h"
+
+#define RESOLVE_MAX_ADDRS 8
+#define RESOLVE_CACHE_MAX 64
+#define RESOLVE_THREADS 2
+#define RESOLVE_NEGATIVE_TTL_MS 5000
+
+struct resolve_addr
+{
+    int family;
+    int socktype;
+    int protocol;
+    socklen_t addrlen;
+    struct sockaddr_storage addr;
+};
+
+struct resolve_result
+{
+    int status; // 0 成功，-1 解析失败
+    int count;
+    struct resolve_addr addrs[RESOLVE_MAX_ADDRS];
+};
+
+// 在发起查询的 loop 线程中回调
+typedef void (*resolve_cb)(void *arg, const struct resolve_result *res);
+
+struct resolve_req;
+
+// 进程内共享的解析缓存：IP 字面量直接转换；命中（包括失败的负缓存）返回 1，未命中返回 0
+int resolve_lookup(const char *host, int port, int family, int socktype, struct resolve_result *out);
+
+// 未命中时交给解析线程，同一主机并发的查询共用一次 getaddrinfo
+struct resolve_req *resolve_start(struct ev_loop *loop, const char *host, int port, int family, int socktype,
+                                  resolve_cb cb, void *arg);
+// 供后台线程使用：未命中时在当前线程解析并写入缓存，返回 0 表示成功
+int resolve_blocking(const char *host, int port, int family, int socktype, struct resolve_result *out);
+
+// 在发起查询的 loop 线程中调用，之后不会再回调
+void resolve_cancel(struct resolve_req *req);
+
+#endif
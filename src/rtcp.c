@@ -11,16 +11,6 @@ struct rtcp_rr {
     uint32_t ssrc;
 } __attribute__((packed));
 
-int rtcp_open(int client_port) {
-    int s = socket(AF_INET, SOCK_DGRAM, 0);
-    struct sockaddr_in addr = {0};
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = INADDR_ANY;
-    addr.sin_port = htons(client_port + 1);
-    if (bind(s, (struct sockaddr*)&addr, sizeof(addr)) < 0) return -1;
-    return s;
-}
-
 int rtcp_send_rr(int sockfd, struct sockaddr_in *server, uint32_t ssrc) {
     struct rtcp_rr rr;
     rr.v_p_count = (2 << 6);  // V=2, P=0, count=0
@@ -28,6 +18,4 @@ int rtcp_send_rr(int sockfd, struct sockaddr_in *server, uint32_t ssrc) {
     rr.length = htons(1);     // 1 word (4 bytes after header)
     rr.ssrc = htonl(ssrc);
     return sendto(sockfd, &rr, sizeof(rr), 0, (struct sockaddr*)server, sizeof(*server));
-}
-
-void rtcp_close(int sockfd) { close(sockfd); }
\ No newline at end of file
+}
\ No newline at end of file
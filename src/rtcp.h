@@ -3,8 +3,6 @@
 #include <stdint.h>
 #include <netinet/in.h>
 
-int rtcp_open(int client_port);
 int rtcp_send_rr(int sockfd, struct sockaddr_in *server, uint32_t ssrc);
-void rtcp_close(int sockfd);
 
 #endif
\ No newline at end of file
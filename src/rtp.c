@@ -1,66 +1,94 @@
-
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <arpa/inet.h>
-#include <pthread.h>
 #include "rtp.h"
 #include <errno.h>
 #include "config.h"
 #include "logs.h"
+#include "parse.h"
 #include "rtsp.h"
+#include "reorder.h"
 #include <fcntl.h>
 #include "config.h"
 #include <stdlib.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <linux/errqueue.h>
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#define RTP_RECV_BUDGET 64
+
 #define likely(x) __builtin_expect(!!(x), 1)
 #define unlikely(x) __builtin_expect(!!(x), 0)
 
-int rtp_open(int client_port)
+#define HUGE_PAGE_SIZE (2UL << 20)
+
+static size_t align_up(size_t n, size_t align)
 {
-    int s = socket(AF_INET, SOCK_DGRAM, 0);
-    struct sockaddr_in addr = {0};
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = INADDR_ANY;
-    addr.sin_port = htons(client_port);
-    if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0)
-        return -1;
-    return s;
+    return (n + align - 1) & ~(align - 1);
+}
+
+static void *map_slab(size_t size, int flags)
+{
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE | flags, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
 }
 
-int init_rtp_buffer(struct rtp_buffer *rtp_buf)
+// 在上游 SETUP 成功后才分配，整个环形缓冲区只占一块预先缺页的连续内存
+struct rtp_buffer *init_rtp_buffer(void)
 {
     const struct server_config *config = get_server_config();
 
-    rtp_buf->buffer = (uint8_t **)malloc(config->max_rtp_buffer_size * sizeof(uint8_t *));
-    rtp_buf->payload_sizes = (size_t *)malloc(config->max_rtp_buffer_size * sizeof(size_t));
+    size_t stride = align_up(sizeof(struct rtp_slot) + config->max_udp_packet_size, CACHE_LINE_SIZE);
+    size_t size = sizeof(struct rtp_buffer) + stride * config->max_rtp_buffer_size;
+    struct rtp_buffer *rtp_buf = NULL;
+    int hugepages = 0;
 
-    if (!rtp_buf->buffer || !rtp_buf->payload_sizes)
+    if (config->hugepages)
     {
-
-        LOG_ERROR("Failed to allocate memory for RTP buffer or payload_sizes");
-        return -1;
+        rtp_buf = map_slab(align_up(size, HUGE_PAGE_SIZE), MAP_HUGETLB);
+        if (rtp_buf)
+        {
+            size = align_up(size, HUGE_PAGE_SIZE);
+            hugepages = 1;
+        }
+        else
+        {
+            LOG_WARN("Failed to map RTP buffer with huge pages, falling back: %s", strerror(errno));
+        }
     }
 
-    for (int i = 0; i < config->max_rtp_buffer_size; i++)
+    if (rtp_buf == NULL)
     {
-        rtp_buf->buffer[i] = (uint8_t *)malloc(config->max_udp_packet_size);
-        if (!rtp_buf->buffer[i])
+        size = align_up(size, (size_t)sysconf(_SC_PAGESIZE));
+        rtp_buf = map_slab(size, 0);
+        if (rtp_buf == NULL)
         {
-            for (int j = 0; j < i; j++)
-            {
-                free(rtp_buf->buffer[j]);
-            }
-            free(rtp_buf->buffer);
-            free(rtp_buf->payload_sizes);
-            LOG_ERROR("Failed to allocate memory for RTP packet");
-            return -2;
+            LOG_ERROR("Failed to allocate memory for RTP buffer: %s", strerror(errno));
+            return NULL;
         }
+        // 透明大页可以减少遍历整个环时的 TLB 缺失
+        if (size >= HUGE_PAGE_SIZE)
+            madvise(rtp_buf, size, MADV_HUGEPAGE);
     }
 
-    rtp_buf->head = 0;
-    rtp_buf->tail = 0;
+    rtp_buf->slab_size = size;
+    rtp_buf->stride = stride;
+    rtp_buf->size = config->max_rtp_buffer_size;
+    rtp_buf->hugepages = hugepages;
+    atomic_init(&rtp_buf->head, 0);
+    rtp_buf->min_tail = 0;
 
-    return 0;
+    return rtp_buf;
 }
 
 void free_rtp_buffer(struct rtp_buffer *rtp_buf)
@@ -68,14 +96,7 @@ void free_rtp_buffer(struct rtp_buffer *rtp_buf)
     if (rtp_buf == NULL)
         return;
 
-    const struct server_config *config = get_server_config();
-
-    for (int i = 0; i < config->max_rtp_buffer_size; i++)
-    {
-        free(rtp_buf->buffer[i]);
-    }
-    free(rtp_buf->buffer);
-    free(rtp_buf->payload_sizes);
+    munmap(rtp_buf, rtp_buf->slab_size);
 }
 
 int rtp_send_trigger(int sockfd, struct sockaddr_in *server, uint32_t ssrc)
@@ -104,8 +125,6 @@ int rtp_send_trigger(int sockfd, struct sockaddr_in *server, uint32_t ssrc)
     return 0;
 }
 
-void rtp_close(int sockfd) { close(sockfd); }
-
 void send_http_response(int sock)
 {
     const char *response_header =
@@ -127,7 +146,7 @@ int get_rtp_payload(uint8_t *buf, int recv_len, uint8_t **payload, int *size, ui
 
         if (seqn)
         {
-            *seqn = ntohs(*(uint16_t *)(buf + 2));
+            *seqn = load_be16(buf + 2);
         }
 
         flags = buf[0];
@@ -140,10 +159,10 @@ int get_rtp_payload(uint8_t *buf, int recv_len, uint8_t **payload, int *size, ui
 
             if (unlikely(payloadstart + 4 > recv_len))
             {
-                printf("Malformed RTP packet: extension header truncated\n");
+                LOG_DEBUG("Malformed RTP packet: extension header truncated");
                 return -1;
             }
-            payloadstart += 4 + 4 * ntohs(*((uint16_t *)(buf + payloadstart + 2)));
+            payloadstart += 4 + 4 * load_be16(buf + payloadstart + 2);
         }
 
         payloadlength = recv_len - payloadstart;
@@ -155,7 +174,7 @@ int get_rtp_payload(uint8_t *buf, int recv_len, uint8_t **payload, int *size, ui
 
         if (unlikely(payloadlength <= 0) || unlikely(payloadstart + payloadlength > recv_len))
         {
-            printf("Malformed RTP packet: invalid payload length\n");
+            LOG_DEBUG("Malformed RTP packet: invalid payload length");
             return -1;
         }
 
@@ -171,106 +190,1046 @@ int get_rtp_payload(uint8_t *buf, int recv_len, uint8_t **payload, int *size, ui
     }
 }
 
-void *rtp_receive_thread(void *arg)
+static uint64_t clock_ns(clockid_t clock)
 {
-    struct play_ctx *ctx = (struct play_ctx *)arg;
-    struct rtp_buffer *rtp_buf = ctx->rtp_buf;
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
 
-    uint8_t *buf = (uint8_t *)malloc(ctx->max_udp_packet_size);
-    if (buf == NULL)
+// 内核时间戳是 CLOCK_REALTIME，按本批次读到的两个时钟之差换算成单调时钟
+static uint64_t rtp_recv_time(struct msghdr *msg, uint64_t mono_now, uint64_t real_now)
+{
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(msg); cm; cm = CMSG_NXTHDR(msg, cm))
     {
-        LOG_ERROR("Failed to allocate memory for UDP receive buffer.");
-        return NULL;
+        if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_TIMESTAMPNS)
+            continue;
+
+        struct timespec ts;
+        memcpy(&ts, CMSG_DATA(cm), sizeof(ts));
+        uint64_t real = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+        if (real >= real_now)
+            return mono_now;
+        return mono_now - (real_now - real);
     }
+    return mono_now;
+}
 
-    ssize_t n = 0;
-    const struct server_config *config = get_server_config();
+// 单播只收 SETUP 协商的服务器地址发来的包，端口不比较，有的服务器不从 server_port 发送
+static int rtp_foreign_packet(const struct play_ctx *ctx, const struct sockaddr_in *peer)
+{
+    if (ctx->transport == RTSP_TRANSPORT_MULTICAST || ctx->rtp_server.sin_addr.s_addr == INADDR_ANY)
+        return 0;
+    return peer->sin_family != AF_INET || peer->sin_addr.s_addr != ctx->rtp_server.sin_addr.s_addr;
+}
 
-    uint16_t seqn = 0;
-    uint16_t not_first = 0;
+// RFC 3550 的到达间隔抖动，MP2T 的 RTP 时间戳为 90kHz
+static void rtp_update_jitter(struct play_ctx *ctx, const uint8_t *pkt, uint64_t recv_ns)
+{
+    struct session_stats *st = &ctx->stats;
+    uint32_t rtp_ts = load_be32(pkt + 4);
+
+    if (st->last_arrival_ns)
+    {
+        int64_t d = (int64_t)(recv_ns - st->last_arrival_ns) - (int64_t)(int32_t)(rtp_ts - st->last_rtp_ts) * 100000 / 9;
+        if (d < 0)
+            d = -d;
+        st->jitter_ns16 += d - ((st->jitter_ns16 + 8) >> 4);
+        stat_set(&st->jitter_us, (uint64_t)(st->jitter_ns16 >> 4) / 1000);
+    }
+    st->last_arrival_ns = recv_ns;
+    st->last_rtp_ts = rtp_ts;
+}
+
+static void wake_fd(int fd)
+{
+    uint64_t one = 1;
+    if (write(fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        LOG_ERROR("Failed to signal eventfd: %s", strerror(errno));
+}
+
+// 最慢的阻塞型客户端决定上游的接收节奏
+static uint64_t rtp_min_tail(struct play_ctx *ctx, uint64_t head)
+{
+    uint64_t min = head;
+    int overrun = 0;
+
+    pthread_mutex_lock(&ctx->lock);
+    for (struct rtp_reader *r = ctx->readers; r; r = r->next)
+    {
+        uint64_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+        // 不阻塞上游的客户端落后超过上限后不再占住缓冲区，通知它自己跳走
+        if (r->lag_policy != RTP_LAG_BLOCK && head - tail >= ctx->lag_limit)
+        {
+            if (!atomic_exchange(&r->lagging, 1))
+                wake_fd(r->wake_fd);
+            overrun = 1;
+            continue;
+        }
+        if (tail < min)
+            min = tail;
+    }
+    // 关键帧缓存也占住缓冲区，但太旧时放弃，不能让它挡住上游
+    if (ctx->gop_valid && head - ctx->gop_start > (uint64_t)ctx->rtp_buf->size * 3 / 4)
+        ctx->gop_valid = 0;
+    if (ctx->gop_valid && ctx->gop_start < min)
+        min = ctx->gop_start;
+
+    // 先公布保底位置再看各客户端正在读的槽位，与 rtp_reader_pin 配对：
+    // 要么客户端看到新的保底位置后不再读旧槽位，要么这里看到它在读，暂时不覆盖
+    if (overrun)
+    {
+        atomic_store(&ctx->lag_floor, min);
+        for (struct rtp_reader *r = ctx->readers; r; r = r->next)
+        {
+            uint64_t pin = atomic_load(&r->pin);
+            if (pin && pin - 1 < min)
+                min = pin - 1;
+        }
+    }
+    pthread_mutex_unlock(&ctx->lock);
+
+    return min;
+}
+
+// 扫描新发布的槽位：检查 TS 的完整性；开启关键帧缓存时记下最近的 PAT 和视频关键帧
+static void rtp_scan_published(struct play_ctx *ctx, struct rtp_buffer *rtp_buf, uint64_t head)
+{
+    struct ts_check_result check = {0};
+
+    for (; ctx->scanned < head; ctx->scanned++)
+    {
+        struct rtp_slot *slot = rtp_buffer_slot(rtp_buf, ctx->scanned);
+        if (ctx->ts_cc)
+            ts_check(ctx->ts_cc, rtp_slot_payload(slot), slot->len, &check);
+        if (!ctx->gop_cache && !atomic_load_explicit(&ctx->rap_readers, memory_order_relaxed))
+            continue;
+
+        int found = ts_scan(&ctx->psi, rtp_slot_payload(slot), slot->len);
+
+        if (found & TS_FOUND_PAT)
+        {
+            ctx->last_pat = ctx->scanned;
+            ctx->pat_seen = 1;
+        }
+        if (found & TS_FOUND_RAP)
+        {
+            // 从关键帧前的 PAT 开始，客户端可以立即得到 PAT/PMT；PAT 已被覆盖时从关键帧开始
+            uint64_t start = ctx->scanned;
+            if (ctx->pat_seen && ctx->scanned - ctx->last_pat < (uint64_t)rtp_buf->size / 2)
+                start = ctx->last_pat;
+
+            // 按 skip 策略跳过的客户端从这里继续；head 发布之后才能读到这个槽位
+            atomic_store_explicit(&ctx->last_rap, start + 1, memory_order_release);
+            if (!ctx->gop_cache)
+                continue;
+
+            pthread_mutex_lock(&ctx->lock);
+            ctx->gop_start = start;
+            ctx->gop_valid = 1;
+            pthread_mutex_unlock(&ctx->lock);
+            // 缓存的读指针可能比新的起点更靠前，挂载到起点的客户端不能被覆盖
+            if (start < rtp_buf->min_tail)
+                rtp_buf->min_tail = start;
+        }
+    }
+
+    if (check.packets == 0)
+        return;
+    stat_add(&ctx->stats.ts_packets, check.packets);
+    if (check.cc_errors)
+        stat_add(&ctx->stats.ts_cc_errors, check.cc_errors);
+    if (check.sync_errors)
+        stat_add(&ctx->stats.ts_sync_errors, check.sync_errors);
+    if (check.tei)
+        stat_add(&ctx->stats.ts_tei, check.tei);
+}
+
+// 新客户端的起始槽位，调用方持有 ctx->lock
+uint64_t rtp_reader_start(struct play_ctx *ctx)
+{
+    if (ctx->rtp_buf == NULL)
+        return 0;
+
+    uint64_t head = atomic_load_explicit(&ctx->rtp_buf->head, memory_order_acquire);
+    // 起点不能已经超过落后上限，否则按策略跳过的客户端一挂载就要跳走
+    if (ctx->gop_valid && head - ctx->gop_start <= (uint64_t)ctx->rtp_buf->size / 2 && head - ctx->gop_start < ctx->lag_limit)
+        return ctx->gop_start;
+    return head;
+}
+
+// 刷新缓存的最慢读指针，顺便记录占用的最高值；只在缓冲区看起来快满时才会走到这里
+static void rtp_refresh_min_tail(struct play_ctx *ctx, struct rtp_buffer *rtp_buf, uint64_t head)
+{
+    rtp_buf->min_tail = rtp_min_tail(ctx, head);
+    stat_max(&ctx->stats.ring_hwm, head - rtp_buf->min_tail);
+}
+
+static int rtp_buffer_full(struct play_ctx *ctx, struct rtp_buffer *rtp_buf, uint64_t head)
+{
+    // 缓存的读指针说明还有空位时不必访问读者列表。有不阻塞上游的客户端时，到落后上限就刷新一次，
+    // 让落后的客户端在缓冲区满之前跳走
+    uint64_t check = rtp_buf->size;
+    if (atomic_load_explicit(&ctx->lossy_readers, memory_order_relaxed))
+        check = ctx->lag_limit;
+    if (head - rtp_buf->min_tail < check)
+        return 0;
+
+    rtp_refresh_min_tail(ctx, rtp_buf, head);
+    return head - rtp_buf->min_tail >= (uint64_t)rtp_buf->size;
+}
+
+void rtp_resume(struct play_ctx *ctx)
+{
+    if (ctx->stop)
+        return;
+    loop_io_modify(ctx->loop, &ctx->rtp_io, EPOLLIN);
+}
+
+// 开始播放前收到的包直接丢弃
+static int rtp_drain(struct play_ctx *ctx)
+{
+    int received = 0;
+
+    while (received < RTP_RECV_BUDGET)
+    {
+        ssize_t n = recv(ctx->rtp_sock, ctx->recv_buf, ctx->max_udp_packet_size, MSG_DONTWAIT);
+        if (n < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            if (errno == EINTR)
+                continue;
+            LOG_WARN("Error receiving RTP data: %s", strerror(errno));
+            return -1;
+        }
+        received++;
+    }
+
+    return received;
+}
+
+static void rtp_reorder_arm(struct play_ctx *ctx)
+{
+    struct rtp_reorder *ro = &ctx->reorder;
+
+    if (ro->staged == 0 || ctx->reorder_timer.active)
+        return;
 
-    int first_package = 0;
+    uint64_t waited = loop_now_ms() - ro->hold_since;
+    loop_timer_start(ctx->loop, &ctx->reorder_timer, waited < (uint64_t)ro->hold_ms ? ro->hold_ms - waited : 1);
+}
 
-    send_http_response(ctx->http_sock);
+int rtp_receive(struct play_ctx *ctx)
+{
+    if (!ctx->play)
+        return rtp_drain(ctx);
 
-    if (!config->enable_nat)
-        rtp_send_trigger(ctx->rtp_sock, &ctx->rtp_server, ctx->ssrc);
+    struct rtp_buffer *rtp_buf = ctx->rtp_buf;
+    uint64_t head = atomic_load_explicit(&rtp_buf->head, memory_order_relaxed);
+    uint16_t seqn = 0;
+    int received = 0;
 
-    while (!ctx->stop)
+    while (!ctx->stop && received < RTP_RECV_BUDGET)
     {
-        n = recv(ctx->rtp_sock, buf, ctx->max_udp_packet_size, 0);
-        if (n <= 0)
+        // 暂存区里的包之后会发布到 head 之后，新包收在它们后面，保证重排时不会覆盖未处理的包
+        uint64_t land = head + ctx->reorder.staged;
+
+        // 缓冲区满时停止读取 socket，由最慢的客户端在腾出空位后唤醒
+        if (rtp_buffer_full(ctx, rtp_buf, land))
         {
-            if (n == 0)
+            atomic_store(&ctx->stalled, 1);
+            atomic_thread_fence(memory_order_seq_cst);
+            if (rtp_buffer_full(ctx, rtp_buf, land) || !atomic_exchange(&ctx->stalled, 0))
             {
-                LOG_WARN("RTP socket closed by peer");
+                stat_add(&ctx->stats.stalls, 1);
+                loop_io_modify(ctx->loop, &ctx->rtp_io, 0);
+                break;
             }
+        }
+
+        int want = ctx->recv_batch;
+        if (land + want - rtp_buf->min_tail > (uint64_t)rtp_buf->size)
+        {
+            rtp_refresh_min_tail(ctx, rtp_buf, head);
+            if (land + want - rtp_buf->min_tail > (uint64_t)rtp_buf->size)
+                want = rtp_buf->size - (land - rtp_buf->min_tail);
+        }
+
+        // 直接收进接下来的空闲槽位，一次系统调用取一批
+        for (int i = 0; i < want; i++)
+        {
+            ctx->iovs[i].iov_base = rtp_buffer_slot(rtp_buf, land + i)->data;
+            ctx->iovs[i].iov_len = ctx->max_udp_packet_size;
+            ctx->msgs[i].msg_hdr.msg_iov = &ctx->iovs[i];
+            ctx->msgs[i].msg_hdr.msg_iovlen = 1;
+            ctx->msgs[i].msg_hdr.msg_control = ctx->ctrls + i * RTP_CTRL_SIZE;
+            ctx->msgs[i].msg_hdr.msg_controllen = RTP_CTRL_SIZE;
+            ctx->msgs[i].msg_hdr.msg_name = &ctx->peers[i];
+            ctx->msgs[i].msg_hdr.msg_namelen = sizeof(ctx->peers[i]);
+        }
+
+        int n = recvmmsg(ctx->rtp_sock, ctx->msgs, want, MSG_DONTWAIT, NULL);
+        if (n < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            if (errno == EINTR)
+                continue;
+            LOG_WARN("Error receiving RTP data: %s", strerror(errno));
+            return -1;
+        }
+        received += n;
+        ctx->recv_calls++;
+
+        uint64_t bytes = 0;
+        int rejected = 0;
+        int foreign = 0;
+        uint64_t mono_now = clock_ns(CLOCK_MONOTONIC);
+        uint64_t real_now = clock_ns(CLOCK_REALTIME);
+
+        for (int i = 0; i < n; i++)
+        {
+            struct rtp_slot *slot = rtp_buffer_slot(rtp_buf, land + i);
+            uint8_t *payload = NULL;
+            int payload_size = 0;
+
+            slot->recv_ns = rtp_recv_time(&ctx->msgs[i].msg_hdr, mono_now, real_now);
+
+            // 端口对可能刚被别的会话用过，之前的上游在会话超时前还会发来旧频道的包
+            if (rtp_foreign_packet(ctx, &ctx->peers[i]))
+            {
+                LOG_WARN_RATELIMIT("RTP packet from unexpected address %s, skipping", inet_ntoa(ctx->peers[i].sin_addr));
+                foreign++;
+                slot->offset = 0;
+                slot->len = 0;
+                if (!ctx->reorder_ms)
+                    head++;
+                continue;
+            }
+
+            // 负载留在原处，只记录偏移；非 RTP 包记为空槽位，发送时跳过。组播可以直接承载 TS，整个包就是负载
+            int is_rtp = get_rtp_payload(slot->data, ctx->msgs[i].msg_len, &payload, &payload_size, &seqn);
+            if (is_rtp < 0 || (is_rtp == 0 && !(ctx->raw_ts && payload[0] == TS_SYNC_BYTE)))
+            {
+                LOG_WARN_RATELIMIT("Non-RTP packet received, skipping");
+                rejected++;
+                slot->offset = 0;
+                slot->len = 0;
+                if (!ctx->reorder_ms)
+                    head++;
+                continue;
+            }
+            slot->offset = payload - slot->data;
+            slot->len = payload_size;
+            bytes += ctx->msgs[i].msg_len;
+            if (is_rtp)
+                rtp_update_jitter(ctx, slot->data, slot->recv_ns);
+
+            if (ctx->reorder_ms)
+                rtp_reorder_push(&ctx->reorder, rtp_buf, land + i, seqn, &head);
             else
+                head++;
+        }
+        // 只有来自服务器的包才说明 UDP 通路可用
+        ctx->recv_packets += n - foreign;
+        stat_add(&ctx->stats.rtp_packets, n - rejected - foreign);
+        stat_add(&ctx->stats.rtp_bytes, bytes);
+        if (rejected)
+            stat_add(&ctx->stats.malformed, rejected);
+        if (foreign)
+            stat_add(&ctx->stats.rtp_foreign, foreign);
+        if (ctx->reorder_ms)
+            rtp_reorder_expire(&ctx->reorder, rtp_buf, loop_now_ms(), rtp_buf->min_tail + rtp_buf->size, &head);
+        rtp_scan_published(ctx, rtp_buf, head);
+        atomic_store_explicit(&rtp_buf->head, head, memory_order_release);
+
+        // socket 已读空；设置了批量超时时先停一会儿，让下一批攒得更满
+        if (n < want)
+        {
+            if (ctx->recv_timeout_ms > 0 && n < ctx->recv_batch)
             {
-                LOG_WARN("Error receiving RTP data: %s", strerror(errno));
+                loop_io_modify(ctx->loop, &ctx->rtp_io, 0);
+                loop_timer_start(ctx->loop, &ctx->batch_timer, ctx->recv_timeout_ms);
             }
             break;
         }
+    }
 
-        uint8_t *payload = NULL;
-        int payload_size = 0;
+    if (ctx->reorder_ms)
+        rtp_reorder_arm(ctx);
 
-        int is_rtp = get_rtp_payload(buf, n, &payload, &payload_size, &seqn);
-        if (is_rtp <= 0)
+    return received;
+}
+
+// 交错模式下从控制连接取出的一个 RTP 包。缓冲区满时返回 0，调用方保留数据并暂停读取
+int rtp_ingest(struct play_ctx *ctx, const uint8_t *pkt, size_t len)
+{
+    struct rtp_buffer *rtp_buf = ctx->rtp_buf;
+    if (!ctx->play || rtp_buf == NULL)
+        return 1;
+
+    if (len > (size_t)ctx->max_udp_packet_size)
+    {
+        LOG_WARN_RATELIMIT("Interleaved RTP packet too large (%zu bytes), skipping", len);
+        return 1;
+    }
+
+    uint64_t head = atomic_load_explicit(&rtp_buf->head, memory_order_relaxed);
+    uint64_t land = head + ctx->reorder.staged;
+
+    if (rtp_buffer_full(ctx, rtp_buf, land))
+    {
+        atomic_store(&ctx->stalled, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (rtp_buffer_full(ctx, rtp_buf, land) || !atomic_exchange(&ctx->stalled, 0))
         {
-            LOG_WARN("Non-RTP packet received, skipping");
-            continue;
+            stat_add(&ctx->stats.stalls, 1);
+            return 0;
         }
-        else
-        {
+    }
+
+    struct rtp_slot *slot = rtp_buffer_slot(rtp_buf, land);
+    uint8_t *payload = NULL;
+    int payload_size = 0;
+    uint16_t seqn = 0;
+
+    memcpy(slot->data, pkt, len);
+    if (get_rtp_payload(slot->data, len, &payload, &payload_size, &seqn) <= 0)
+    {
+        LOG_WARN_RATELIMIT("Non-RTP packet received, skipping");
+        stat_add(&ctx->stats.malformed, 1);
+        return 1;
+    }
+    slot->offset = payload - slot->data;
+    slot->len = payload_size;
+    slot->recv_ns = clock_ns(CLOCK_MONOTONIC);
+    rtp_update_jitter(ctx, slot->data, slot->recv_ns);
+    ctx->recv_packets++;
+    stat_add(&ctx->stats.rtp_packets, 1);
+    stat_add(&ctx->stats.rtp_bytes, len);
+
+    if (ctx->reorder_ms)
+    {
+        rtp_reorder_push(&ctx->reorder, rtp_buf, land, seqn, &head);
+        rtp_reorder_expire(&ctx->reorder, rtp_buf, loop_now_ms(), rtp_buf->min_tail + rtp_buf->size, &head);
+    }
+    else
+    {
+        head++;
+    }
+    rtp_scan_published(ctx, rtp_buf, head);
+    atomic_store_explicit(&rtp_buf->head, head, memory_order_release);
+
+    if (ctx->reorder_ms)
+        rtp_reorder_arm(ctx);
+
+    return 1;
+}
+
+// 缺口等待超时：没有新包到达时也要按时放弃缺口
+void rtp_reorder_timeout(struct play_ctx *ctx)
+{
+    struct rtp_buffer *rtp_buf = ctx->rtp_buf;
+    if (ctx->stop || rtp_buf == NULL)
+        return;
+
+    uint64_t head = atomic_load_explicit(&rtp_buf->head, memory_order_relaxed);
+    rtp_buf->min_tail = rtp_min_tail(ctx, head);
+    rtp_reorder_expire(&ctx->reorder, rtp_buf, loop_now_ms(), rtp_buf->min_tail + rtp_buf->size, &head);
+    rtp_scan_published(ctx, rtp_buf, head);
+    atomic_store_explicit(&rtp_buf->head, head, memory_order_release);
 
+    rtp_notify_readers(ctx);
+    rtp_reorder_arm(ctx);
+}
+
+// 只唤醒已经读空并挂起的客户端，其余客户端会在发送循环中自己看到新的 head
+void rtp_notify_readers(struct play_ctx *ctx)
+{
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load(&ctx->nwaiting) == 0)
+        return;
+
+    pthread_mutex_lock(&ctx->lock);
+    for (struct rtp_reader *r = ctx->readers; r; r = r->next)
+    {
+        if (atomic_exchange(&r->waiting, 0))
+        {
+            atomic_fetch_sub(&ctx->nwaiting, 1);
+            wake_fd(r->wake_fd);
         }
+    }
+    pthread_mutex_unlock(&ctx->lock);
+}
 
-        while ((rtp_buf->head + 1) % ctx->max_rtp_buffer_size == rtp_buf->tail)
+// 状态变化时唤醒所有客户端
+void rtp_wake_readers(struct play_ctx *ctx)
+{
+    pthread_mutex_lock(&ctx->lock);
+    for (struct rtp_reader *r = ctx->readers; r; r = r->next)
+    {
+        if (atomic_exchange(&r->waiting, 0))
+            atomic_fetch_sub(&ctx->nwaiting, 1);
+        wake_fd(r->wake_fd);
+    }
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+// 满 -> 非满：生产者因为缓冲区满而停止读取时唤醒它
+static void rtp_reader_release(struct rtp_reader *reader, uint64_t tail)
+{
+    struct play_ctx *ctx = reader->ctx;
+
+    atomic_store_explicit(&reader->tail, tail, memory_order_release);
+
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load(&ctx->stalled) && atomic_exchange(&ctx->stalled, 0))
+        wake_fd(ctx->wake_fd);
+}
+
+static int rtp_filtered_pending(struct rtp_reader *reader)
+{
+    return reader->filtered && reader->filtered->sent < reader->filtered->len;
+}
+
+// 把 [pos, head) 中最多 batch 个槽位过滤后拷入客户端自己的缓冲区，返回新的读位置
+static uint64_t rtp_filtered_fill(struct rtp_reader *reader, uint64_t pos, uint64_t head, int batch)
+{
+    struct rtp_filtered *fb = reader->filtered;
+    struct rtp_buffer *rtp_buf = reader->ctx->rtp_buf;
+    uint64_t dropped = 0;
+
+    fb->len = 0;
+    fb->sent = 0;
+    fb->count = 0;
+    for (; pos != head && fb->count < batch; pos++)
+    {
+        struct rtp_slot *slot = rtp_buffer_slot(rtp_buf, pos);
+        if (fb->len + slot->len > fb->cap)
+            break;
+
+        size_t n = ts_filter_apply(&fb->filter, rtp_slot_payload(slot), slot->len, fb->buf + fb->len);
+        dropped += slot->len - n;
+        if (n == 0)
+            continue;
+        fb->len += n;
+        fb->slots[fb->count].end = fb->len;
+        fb->slots[fb->count].recv_ns = slot->recv_ns;
+        fb->count++;
+    }
+    stat_add(&reader->filtered_bytes, dropped);
+    return pos;
+}
+
+static const char *lag_policy_names[] = {"block", "drop", "skip", "disconnect"};
+
+int rtp_lag_policy_parse(const char *name)
+{
+    for (int i = 0; i < (int)(sizeof(lag_policy_names) / sizeof(lag_policy_names[0])); i++)
+    {
+        if (strcmp(name, lag_policy_names[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+const char *rtp_lag_policy_name(int policy)
+{
+    if (policy < 0 || policy >= (int)(sizeof(lag_policy_names) / sizeof(lag_policy_names[0])))
+        return "unknown";
+    return lag_policy_names[policy];
+}
+
+// 落后超过上限：disconnect 立即断开，其余策略交给 rtp_reader_skip
+static void rtp_reader_note_lag(struct rtp_reader *reader, uint64_t lag)
+{
+    if (reader->lag_policy == RTP_LAG_BLOCK)
+        return;
+
+    if (reader->lag_policy == RTP_LAG_DISCONNECT)
+    {
+        if (!reader->stop)
         {
-            usleep(1000);
+            LOG_WARN("Client %s lagging %llu slots behind %s, disconnecting", reader->name,
+                     (unsigned long long)lag, reader->ctx->rtsp_url);
+            stat_add(&reader->lag_disconnects, 1);
         }
+        reader->stop = 1;
+        return;
+    }
+    if (!reader->lag_pending && !reader->await_rap)
+    {
+        LOG_WARN_RATELIMIT("Client %s lagging %llu slots behind %s, %s", reader->name, (unsigned long long)lag,
+                           reader->ctx->rtsp_url, reader->lag_policy == RTP_LAG_DROP ? "dropping oldest" : "skipping to next keyframe");
+        stat_add(&reader->lag_skips, 1);
+    }
+    reader->lag_pending = 1;
+}
+
+// 开始读 pos 之后的槽位前调用。返回 0 表示 pos 可能已被覆盖，要先跳走
+static int rtp_reader_pin(struct rtp_reader *reader, uint64_t pos)
+{
+    atomic_store(&reader->pin, pos + 1);
+    return pos >= atomic_load(&reader->ctx->lag_floor);
+}
+
+// 把发了一半的槽位剩下的部分拷出来，之后不再读这个槽位，写出的数据仍然 188 字节对齐
+static int rtp_reader_take_carry(struct rtp_reader *reader, uint64_t pos)
+{
+    struct play_ctx *ctx = reader->ctx;
+    struct rtp_slot *slot = rtp_buffer_slot(ctx->rtp_buf, pos);
+
+    if (reader->carry == NULL)
+        reader->carry = malloc(ctx->max_udp_packet_size);
+    if (reader->carry == NULL)
+        return -1;
+    reader->carry_len = slot->len - reader->sent;
+    reader->carry_sent = 0;
+    memcpy(reader->carry, rtp_slot_payload(slot) + reader->sent, reader->carry_len);
+    reader->sent = 0;
+    return 0;
+}
 
-        if (ctx->play)
+// 跳到更新的位置，返回新的发送位置。新位置不早于生产者公布的保底位置
+static uint64_t rtp_reader_skip(struct rtp_reader *reader, uint64_t pos, uint64_t head)
+{
+    struct play_ctx *ctx = reader->ctx;
+    uint64_t floor = atomic_load(&ctx->lag_floor);
+    uint64_t to = pos;
+    uint64_t from = pos;
+
+    if (reader->lag_policy == RTP_LAG_SKIP)
+    {
+        uint64_t rap = atomic_load_explicit(&ctx->last_rap, memory_order_acquire);
+        uint64_t start = rap - 1;
+        if (rap && start <= head && start >= floor && (start > pos || (reader->await_rap && start >= pos)))
         {
-            memcpy(rtp_buf->buffer[rtp_buf->head], payload, payload_size);
-            rtp_buf->payload_sizes[rtp_buf->head] = payload_size;
-            rtp_buf->head = (rtp_buf->head + 1) % ctx->max_rtp_buffer_size;
+            to = start;
+            reader->await_rap = 0;
+        }
+        else if (reader->await_rap && head - (reader->await_rap - 1) >= ctx->lag_limit)
+        {
+            // 等了一个上限的数据量还没有随机访问点（比如识别不出视频），不再等，从最新位置继续
+            to = head;
+            reader->await_rap = 0;
         }
         else
         {
+            // 丢到最新位置，之后的数据不发，直到下一个随机访问点出现
+            to = head;
+            if (!reader->await_rap)
+                reader->await_rap = head + 1;
         }
     }
+    else if (head - pos > ctx->lag_limit / 2 || pos < floor)
+    {
+        to = head - ctx->lag_limit / 2;
+        if (to < floor)
+            to = floor;
+    }
+
+    if (reader->sent > 0 && to > pos + 1)
+    {
+        if (rtp_reader_take_carry(reader, pos) < 0)
+            return pos;
+        from = pos + 1;
+    }
+
+    reader->lag_pending = 0;
+    if (reader->sent == 0 && to > from)
+    {
+        stat_add(&reader->lag_skipped, to - from);
+        reader->send_pos = to;
+    }
+    return reader->send_pos;
+}
+
+// 跳过前剩下的半个槽位
+static int rtp_reader_send_carry(struct rtp_reader *reader)
+{
+    while (reader->carry_sent < reader->carry_len)
+    {
+        ssize_t n = send(reader->http_sock, reader->carry + reader->carry_sent, reader->carry_len - reader->carry_sent,
+                         MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            stat_add(&reader->send_errors, 1);
+            reader->stop = 1;
+            return -1;
+        }
+        stat_add(&reader->send_calls, 1);
+        stat_add(&reader->sent_bytes, n);
+        reader->copied_bytes += n;
+        reader->carry_sent += n;
+    }
+    return 1;
+}
+
+void rtp_reader_lag(struct rtp_reader *reader)
+{
+    if (!atomic_exchange(&reader->lagging, 0))
+        return;
 
-    free(buf);
+    uint64_t head = atomic_load_explicit(&reader->ctx->rtp_buf->head, memory_order_acquire);
+    uint64_t lag = head - reader->send_pos;
+    stat_max(&reader->lag_max, lag);
+    // 零拷贝未完成时读指针落后于发送位置，这时生产者看到的落后不算数
+    if (lag < reader->ctx->lag_limit)
+        return;
+    rtp_reader_note_lag(reader, lag);
 
-    return NULL;
+    // 阻塞在 EPOLLOUT 上的客户端不会进入 flush，就地跳过并交还槽位
+    if (reader->lag_pending)
+    {
+        rtp_reader_skip(reader, reader->send_pos, head);
+        if (reader->zc_count == 0)
+            rtp_reader_release(reader, reader->send_pos);
+    }
 }
 
-void *rtp_send_thread(void *arg)
+int rtp_reader_flush(struct rtp_reader *reader)
 {
-    struct play_ctx *ctx = (struct play_ctx *)arg;
+    const struct server_config *config = get_server_config();
+    struct play_ctx *ctx = reader->ctx;
     struct rtp_buffer *rtp_buf = ctx->rtp_buf;
+    uint64_t pos = reader->send_pos;
+    uint64_t head = atomic_load_explicit(&rtp_buf->head, memory_order_acquire);
+    struct iovec iov[RTP_SEND_IOV_MAX];
+    int batch = config->send_batch;
+    int advanced = 0;
 
-    while (!ctx->stop)
+    if (batch < 1)
+        batch = 1;
+    if (batch > RTP_SEND_IOV_MAX)
+        batch = RTP_SEND_IOV_MAX;
+
+    stat_max(&reader->lag_max, head - pos);
+    if (head - pos >= ctx->lag_limit)
+        rtp_reader_note_lag(reader, head - pos);
+    if (reader->stop)
+        return -1;
+
+    int lossy = reader->lag_policy != RTP_LAG_BLOCK;
+    while (1)
     {
-        while (rtp_buf->head == rtp_buf->tail)
+        if (reader->lag_pending || reader->await_rap)
         {
-            usleep(1000);
+            pos = rtp_reader_skip(reader, pos, head);
+            advanced = 1;
         }
 
-        ssize_t sent = send(ctx->http_sock,
-                            rtp_buf->buffer[rtp_buf->tail],
-                            rtp_buf->payload_sizes[rtp_buf->tail],
-                            0);
+        if (reader->carry_sent < reader->carry_len)
+        {
+            int r = rtp_reader_send_carry(reader);
+            if (r < 0)
+                break;
+            if (r == 0)
+            {
+                loop_io_modify(reader->loop, &reader->io, RTP_READER_EVENTS | EPOLLOUT);
+                break;
+            }
+        }
+
+        if (pos == head && !rtp_filtered_pending(reader))
+        {
+            head = atomic_load_explicit(&rtp_buf->head, memory_order_acquire);
+            if (pos != head)
+                continue;
+
+            // 读空后挂起，生产者发布新数据时通过 eventfd 唤醒
+            atomic_store(&reader->waiting, 1);
+            atomic_fetch_add(&ctx->nwaiting, 1);
+            head = atomic_load(&rtp_buf->head);
+            if (pos == head)
+            {
+                loop_io_modify(reader->loop, &reader->io, RTP_READER_EVENTS);
+                break;
+            }
+            if (atomic_exchange(&reader->waiting, 0))
+                atomic_fetch_sub(&ctx->nwaiting, 1);
+            continue;
+        }
+
+        // 不足一批时先攒一攒，最早的包最多等 send_flush_ms
+        if (head - pos < (uint64_t)batch && reader->sent == 0 && !rtp_filtered_pending(reader) && config->send_flush_ms > 0)
+        {
+            uint64_t now = loop_now_ms();
+            if (!reader->holding)
+            {
+                reader->holding = 1;
+                reader->hold_since = now;
+            }
+            if (now - reader->hold_since < (uint64_t)config->send_flush_ms)
+            {
+                if (!reader->flush_timer.active)
+                    loop_timer_start(reader->loop, &reader->flush_timer,
+                                     config->send_flush_ms - (now - reader->hold_since));
+                loop_io_modify(reader->loop, &reader->io, RTP_READER_EVENTS);
+                break;
+            }
+        }
+
+        // 未完成的零拷贝发送太多时，等错误队列里的完成通知（EPOLLERR）再继续
+        if (reader->zc_count == RTP_ZC_PENDING_MAX)
+        {
+            loop_io_modify(reader->loop, &reader->io, RTP_READER_EVENTS);
+            break;
+        }
+
+        // 生产者可能已经越过了落后的客户端，读槽位之前确认它们还没被覆盖
+        if (lossy && !rtp_reader_pin(reader, pos))
+        {
+            rtp_reader_note_lag(reader, head - pos);
+            if (reader->stop)
+                break;
+            continue;
+        }
+
+        // 每个槽位都是完整的 TS 包，按槽位边界切分保证写出的数据始终 188 字节对齐
+        int iovcnt = 0;
+        size_t total = 0;
+        if (reader->filtered)
+        {
+            struct rtp_filtered *fb = reader->filtered;
+            if (fb->sent == fb->len)
+            {
+                pos = rtp_filtered_fill(reader, pos, head, batch);
+                reader->send_pos = pos;
+                advanced = 1;
+                if (fb->len == 0)
+                    continue;
+            }
+            iov[0].iov_base = fb->buf + fb->sent;
+            iov[0].iov_len = fb->len - fb->sent;
+            total = iov[0].iov_len;
+            iovcnt = 1;
+        }
+        else
+        {
+            size_t offset = reader->sent;
+            for (uint64_t idx = pos; idx != head && iovcnt < batch; idx++)
+            {
+                struct rtp_slot *slot = rtp_buffer_slot(rtp_buf, idx);
+                iov[iovcnt].iov_base = rtp_slot_payload(slot) + offset;
+                iov[iovcnt].iov_len = slot->len - offset;
+                total += iov[iovcnt].iov_len;
+                iovcnt++;
+                offset = 0;
+            }
+        }
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+
+        // 小批量零拷贝的页面固定和完成通知开销比拷贝更大
+        int flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+        if (reader->zerocopy && !reader->filtered && total >= RTP_ZC_MIN_BYTES)
+            flags |= MSG_ZEROCOPY;
+
+        ssize_t sent = sendmsg(reader->http_sock, &msg, flags);
+        if (sent < 0 && errno == ENOBUFS && (flags & MSG_ZEROCOPY))
+        {
+            // 超出 optmem 限制，这一批退回普通拷贝
+            flags &= ~MSG_ZEROCOPY;
+            sent = sendmsg(reader->http_sock, &msg, flags);
+        }
         if (sent < 0)
         {
-            ctx->stop = 1;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                loop_io_modify(reader->loop, &reader->io, RTP_READER_EVENTS | EPOLLOUT);
+                break;
+            }
+            if (errno == EINTR)
+                continue;
+            stat_add(&reader->send_errors, 1);
+            reader->stop = 1;
+            break;
+        }
+        stat_add(&reader->send_calls, 1);
+        stat_add(&reader->sent_bytes, sent);
+        reader->holding = 0;
+        loop_timer_stop(reader->loop, &reader->flush_timer);
+
+        uint64_t packets = 0;
+        uint64_t now = clock_ns(CLOCK_MONOTONIC);
+        if (reader->filtered)
+        {
+            // 槽位在拷入时已经交还，这里只统计这次写完的部分
+            struct rtp_filtered *fb = reader->filtered;
+            size_t before = fb->sent;
+            fb->sent += sent;
+            for (int i = 0; i < fb->count; i++)
+            {
+                if (fb->slots[i].end > before && fb->slots[i].end <= fb->sent)
+                {
+                    packets++;
+                    hist_record(&reader->latency, (now - fb->slots[i].recv_ns) / 1000);
+                }
+            }
+        }
+        else
+        {
+            // 跳过已完整发出的槽位，短写时记住在当前槽位中的偏移
+            size_t left = reader->sent + sent;
+            while (pos != head)
+            {
+                struct rtp_slot *slot = rtp_buffer_slot(rtp_buf, pos);
+                if (left < slot->len)
+                    break;
+                left -= slot->len;
+                pos++;
+                packets++;
+                hist_record(&reader->latency, (now - slot->recv_ns) / 1000);
+            }
+            reader->sent = left;
+            reader->send_pos = pos;
+        }
+        stat_add(&reader->send_packets, packets);
+
+        // 零拷贝发送的槽位要等内核完成通知后才能交还给生产者
+        if (flags & MSG_ZEROCOPY)
+        {
+            struct rtp_zc_pending *p = &reader->zc_pending[(reader->zc_head + reader->zc_count) % RTP_ZC_PENDING_MAX];
+            p->end = pos;
+            p->bytes = sent;
+            reader->zc_count++;
+            reader->zc_next_id++;
+        }
+        else
+        {
+            reader->copied_bytes += sent;
+            if (reader->zc_count == 0)
+                advanced = 1;
+        }
+
+        // 短写说明 socket 发送缓冲区已满，等待可写。不阻塞上游的客户端等待期间不占住槽位，
+        // 发了一半的槽位先拷出来
+        if ((size_t)sent < total)
+        {
+            if (lossy && reader->sent > 0 && rtp_reader_take_carry(reader, pos) == 0)
+            {
+                reader->send_pos = ++pos;
+                stat_add(&reader->send_packets, 1);
+                advanced = 1;
+            }
+            loop_io_modify(reader->loop, &reader->io, RTP_READER_EVENTS | EPOLLOUT);
             break;
         }
+    }
+
+    if (lossy)
+        atomic_store_explicit(&reader->pin, 0, memory_order_release);
+    if (advanced)
+        rtp_reader_release(reader, reader->send_pos);
+
+    return reader->stop ? -1 : 0;
+}
+
+// 读取 MSG_ZEROCOPY 的完成通知，把已经不再被内核引用的槽位交还给生产者
+int rtp_reader_complete(struct rtp_reader *reader)
+{
+    char control[128];
+    uint64_t release = 0;
+    int completed = 0;
+
+    while (1)
+    {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (recvmsg(reader->http_sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm))
+        {
+            if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                  (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)))
+                continue;
+
+            struct sock_extended_err *serr = (struct sock_extended_err *)CMSG_DATA(cm);
+            if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno != 0)
+                return -1;
+
+            // [ee_info, ee_data] 是已完成的发送编号区间，TCP 上按顺序完成
+            uint32_t hi = serr->ee_data;
+            int copied = serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED;
+            while (reader->zc_count > 0)
+            {
+                uint32_t id = reader->zc_next_id - reader->zc_count;
+                if ((int32_t)(hi - id) < 0)
+                    break;
+
+                struct rtp_zc_pending *p = &reader->zc_pending[reader->zc_head];
+                if (copied)
+                    reader->copied_bytes += p->bytes;
+                else
+                    reader->zc_bytes += p->bytes;
+                release = p->end;
+                completed = 1;
+                reader->zc_head = (reader->zc_head + 1) % RTP_ZC_PENDING_MAX;
+                reader->zc_count--;
+            }
+        }
+    }
+
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(reader->http_sock, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err != 0)
+        return -1;
 
-        rtp_buf->tail = (rtp_buf->tail + 1) % ctx->max_rtp_buffer_size;
+    // 全部完成后，之后用普通拷贝发出的槽位也可以一并释放
+    if (completed)
+        rtp_reader_release(reader, reader->zc_count == 0 ? reader->send_pos : release);
+
+    return 0;
+}
+
+int rtp_reader_set_filter(struct rtp_reader *reader, int program, const char *drop)
+{
+    // 一批最多 RTP_SEND_IOV_MAX 个槽位，过滤后不会比原来大
+    size_t cap = (size_t)RTP_SEND_IOV_MAX * get_server_config()->max_udp_packet_size;
+    struct rtp_filtered *fb = malloc(sizeof(*fb) + cap);
+    if (fb == NULL)
+        return -1;
+
+    if (ts_filter_init(&fb->filter, program, drop) < 0)
+    {
+        free(fb);
+        return -1;
     }
+    fb->len = 0;
+    fb->sent = 0;
+    fb->count = 0;
+    fb->cap = cap;
+    reader->filtered = fb;
+    return 0;
+}
 
-    return NULL;
-}
\ No newline at end of file
+// 开启失败时退回普通发送
+void rtp_reader_enable_zerocopy(struct rtp_reader *reader)
+{
+    int one = 1;
+
+    if (setsockopt(reader->http_sock, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) < 0)
+    {
+        LOG_WARN("Failed to enable SO_ZEROCOPY, using copy sends: %s", strerror(errno));
+        return;
+    }
+    reader->zerocopy = 1;
+}
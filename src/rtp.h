@@ -1,28 +1,165 @@
 #ifndef RTP_H
 #define RTP_H
 #include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
 #include <netinet/in.h>
+#include <sys/epoll.h>
 #include "config.h"
+#include "loop.h"
+#include "metrics.h"
+#include "ts.h"
 
+#define CACHE_LINE_SIZE 64
+#define RTP_READER_EVENTS (EPOLLIN | EPOLLRDHUP)
+#define RTP_SEND_IOV_MAX 64
+#define RTP_ZC_PENDING_MAX 64
+#define RTP_ZC_MIN_BYTES 16384
+#define RTP_CTRL_SIZE 64 // 容纳一个 SCM_TIMESTAMPNS 控制消息
+
+// 槽位头部与收到的整个 RTP 包放在一起，负载在包内的偏移和长度由 get_rtp_payload 给出
+struct rtp_slot
+{
+    uint32_t offset;
+    uint32_t len;
+    uint64_t recv_ns; // 收到的时间（CLOCK_MONOTONIC），有内核时间戳时取内核的
+    uint8_t data[];
+};
+
+// 单生产者多读者的环形缓冲区，每个读者与生产者之间是一条 SPSC 通道。
+// 结构体本身位于 slab 起始处，之后是按固定步长排列的槽位，整个缓冲区只有一次 mmap。
 struct rtp_buffer
 {
-    uint8_t **buffer;      // 动态分配的缓冲区指针数组
-    size_t *payload_sizes; // 用于存储每个 RTP 包的负载大小
-    int head;              // 接收包的指针
-    int tail;              // 发送包的指针
+    size_t slab_size; // mmap 的总长度
+    size_t stride;    // 槽位步长，缓存行对齐
+    int size;
+    int hugepages;
+
+    // 生产者独占的缓存行
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint64_t head; // 已发布的包序号，release 写入
+    uint64_t min_tail;                               // 缓存的最慢读指针，只在看起来已满时刷新
+
+    _Alignas(CACHE_LINE_SIZE) uint8_t slots[];
+};
+
+static inline uint8_t *rtp_slot_payload(struct rtp_slot *slot)
+{
+    return slot->data + slot->offset;
+}
+
+static inline struct rtp_slot *rtp_buffer_slot(struct rtp_buffer *rtp_buf, uint64_t idx)
+{
+    return (struct rtp_slot *)(rtp_buf->slots + (idx % rtp_buf->size) * rtp_buf->stride);
+}
+
+struct play_ctx;
+
+// 客户端落后超过 --lag-limit 时的处理方式。生产者从不覆盖未发送的槽位，除 block 外都由客户端自己跳到更新的位置
+enum rtp_lag_policy
+{
+    RTP_LAG_BLOCK = 0,  // 等客户端追上，缓冲区满时上游暂停接收
+    RTP_LAG_DROP,       // 丢掉最旧的数据，只留上限的一半
+    RTP_LAG_SKIP,       // 跳到最近的随机访问点（关键帧前的 PAT）
+    RTP_LAG_DISCONNECT, // 断开连接
+};
+
+// 一次 MSG_ZEROCOPY 发送，完成前 end 之前的槽位仍被内核引用
+struct rtp_zc_pending
+{
+    uint64_t end;
+    size_t bytes;
+};
+
+// 按 TS 过滤的客户端：保留的包先拷到自己的缓冲区再发送，槽位拷完即可交还。
+// 缓冲区中的数据与槽位内容不再一一对应，所以不走零拷贝
+struct rtp_filtered
+{
+    struct ts_filter filter;
+    size_t len;  // 缓冲区中的字节数
+    size_t sent; // 其中已发送的字节数
+    int count;   // 缓冲区中的数据来自几个槽位
+    struct
+    {
+        size_t end; // 该槽位的数据在缓冲区中的结束位置
+        uint64_t recv_ns;
+    } slots[RTP_SEND_IOV_MAX];
+    size_t cap;
+    uint8_t buf[];
+};
+
+struct rtp_reader
+{
+    struct ev_io io;
+    struct ev_io wake_io;  // 空 -> 非空时由生产者唤醒
+    struct ev_timer flush_timer; // 凑批等待的上限
+    int http_sock;         // HTTP 客户端连接
+    int wake_fd;
+    struct ev_loop *loop;  // 客户端所在的工作线程
+    struct play_ctx *ctx;
+    uint64_t send_pos;     // 下一个要发送的包；零拷贝时 tail 要等完成通知才跟上
+    size_t sent;           // 当前包已发送的字节数
+    int holding;           // 数据不足一批，等待更多包
+    uint64_t hold_since;
+    _Atomic uint64_t send_calls;   // 以下四项由客户端所在线程写入，/metrics 随时读取
+    _Atomic uint64_t send_packets;
+    _Atomic uint64_t sent_bytes;   // 交给内核的字节数
+    _Atomic uint64_t send_errors;
+    struct histogram latency;      // 每个包入环到交给内核的耗时（微秒）
+    _Atomic uint64_t filtered_bytes; // 被 TS 过滤掉的字节数
+    struct rtp_filtered *filtered; // 为空时原样转发，由调用方在挂载前设置、在释放读者时释放
+    int zerocopy;
+    uint32_t zc_next_id;   // 下一次零拷贝发送的编号，与内核计数一致
+    int zc_head;
+    int zc_count;
+    struct rtp_zc_pending zc_pending[RTP_ZC_PENDING_MAX];
+    uint64_t zc_bytes;     // 内核确认未拷贝的字节数
+    uint64_t copied_bytes; // 普通发送及内核退回拷贝的字节数
+    int header_sent;
+    int stop;
+    int lag_policy;        // enum rtp_lag_policy，挂载前设置
+    int lag_pending;       // 落后超过上限，等下一次发送时跳
+    uint64_t await_rap;    // 开始等随机访问点时的位置 + 1，0 表示没有在等
+    _Atomic int lagging;   // 生产者发现该客户端落后超过上限
+    _Atomic uint64_t pin;  // 不阻塞上游的客户端正在读的最旧槽位 + 1，0 表示没有在读，这时它的槽位可以被覆盖
+    uint8_t *carry;        // 跳过时当前槽位没发完的部分，先发完再从新位置继续，由调用方在释放读者时释放
+    size_t carry_len;
+    size_t carry_sent;
+    _Atomic uint64_t lag_max;     // 以下四项由客户端所在线程写入
+    _Atomic uint64_t lag_skips;   // 按策略跳过的次数
+    _Atomic uint64_t lag_skipped; // 跳过的槽位数
+    _Atomic uint64_t lag_disconnects;
+    char name[64];         // 客户端地址，用于日志和逐客户端指标
+    void (*on_close)(struct rtp_reader *reader);
+    struct rtp_reader *next;
+
+    // 读者独占的缓存行
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint64_t tail; // 每个客户端独立的读指针，release 写入
+    _Atomic int waiting;                             // 已读空并等待唤醒
 };
 
-int rtp_open(int client_port);
 int rtp_send_trigger(int sockfd, struct sockaddr_in *server, uint32_t ssrc);
-void rtp_close(int sockfd);
 
 void send_http_response(int sock);
 int get_rtp_payload(uint8_t *buf, int recv_len, uint8_t **payload, int *size, uint16_t *seqn);
 
-void *rtp_send_thread(void *arg);
-void *rtp_receive_thread(void *arg);
+int rtp_receive(struct play_ctx *ctx);
+int rtp_ingest(struct play_ctx *ctx, const uint8_t *pkt, size_t len);
+void rtp_resume(struct play_ctx *ctx);
+void rtp_reorder_timeout(struct play_ctx *ctx);
+void rtp_notify_readers(struct play_ctx *ctx);
+void rtp_wake_readers(struct play_ctx *ctx);
+int rtp_reader_flush(struct rtp_reader *reader);
+int rtp_reader_complete(struct rtp_reader *reader);
+void rtp_reader_enable_zerocopy(struct rtp_reader *reader);
+// 只转发 program 节目（-1 不限）并丢弃 drop 中的 PID，参数无效时返回 -1
+int rtp_reader_set_filter(struct rtp_reader *reader, int program, const char *drop);
+uint64_t rtp_reader_start(struct play_ctx *ctx);
+// 生产者标记落后后由客户端所在线程调用，按策略跳过或断开
+void rtp_reader_lag(struct rtp_reader *reader);
+int rtp_lag_policy_parse(const char *name);
+const char *rtp_lag_policy_name(int policy);
 
-int init_rtp_buffer(struct rtp_buffer *rtp_buf);
+struct rtp_buffer *init_rtp_buffer(void);
 void free_rtp_buffer(struct rtp_buffer *rtp_buf);
 
-#endif
\ No newline at end of file
+#endif
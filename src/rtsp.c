@@ -4,524 +4,1192 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <pthread.h>
+#include <time.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include "rtp.h"
 #include "rtcp.h"
 #include "logs.h"
 #include <errno.h>
 #include "stun.h"
 #include "rtsp.h"
+#include "rtsp_cache.h"
 #include "config.h"
+#include "parse.h"
+#include "mcast.h"
+
+#define RTSP_REQUEST_TIMEOUT_MS 10000
+#define RTSP_TEARDOWN_TIMEOUT_MS 2000
+#define RTSP_KEEPALIVE_INTERVAL_MS 10000
+// RFC 5389 的重传间隔：RTO 从 500ms 起每次加倍。Rc 取 3 而不是 7，
+// 约 3.5 秒后放弃并改用交错 TCP，不让起播等上 39.5 秒
+#define STUN_RTO_MS 500
+#define STUN_TRIES 3
+#define RTSP_UDP_PROBE_MS 3000
+
+static const char *phase_names[] = {
+    "INIT", "STUN", "CONNECT", "OPTIONS", "DESCRIBE", "SETUP", "PLAY", "GET_PARAMETER", "TEARDOWN", "DONE",
+};
+
+_Static_assert(sizeof(phase_names) / sizeof(phase_names[0]) <= METRICS_PHASES, "too many RTSP phases for metrics");
 
-struct rtsp_uri
+const char *rtsp_phase_name(enum rtsp_phase phase)
 {
-    char host[256];
-    int port;
-    char path[512];
-};
+    return phase_names[phase];
+}
 
-static void *rtp_thread(void *arg)
+// 切换握手阶段，记下上一阶段的耗时
+static void set_phase(struct play_ctx *ctx, enum rtsp_phase phase)
 {
-    struct play_ctx *ctx = (struct play_ctx *)arg;
+    uint64_t now = loop_now_ms();
+    uint64_t ms = now - ctx->stats.phase_since;
+
+    stat_add(&ctx->stats.phase_ms[ctx->phase], ms);
+    if (ctx->phase != RTSP_KEEPALIVE)
+        metrics_phase_done(ctx->phase, ms);
+    ctx->stats.phase_since = now;
+    ctx->phase = phase;
+}
 
-    ctx->rtp_buf->head = 0;
-    ctx->rtp_buf->tail = 0;
+static void rtsp_finish(struct play_ctx *ctx)
+{
+    if (ctx->phase == RTSP_DONE)
+        return;
 
-    pthread_t recv_thread;
-    if (pthread_create(&recv_thread, NULL, rtp_receive_thread, ctx) != 0)
-    {
-        fprintf(stderr, "Failed to create receive thread\n");
-        return NULL;
-    }
-    else
-    {
-        // LOG_INFO("Start rtp receive thread");
-    }
+    set_phase(ctx, RTSP_DONE);
+    ctx->stop = 1;
+    ctx->play = 0;
 
-    pthread_t send_thread;
-    if (pthread_create(&send_thread, NULL, rtp_send_thread, ctx) != 0)
-    {
-        fprintf(stderr, "Failed to create send thread\n");
-        return NULL;
-    }
+    loop_timer_stop(ctx->loop, &ctx->timer);
+    loop_timer_stop(ctx->loop, &ctx->keepalive);
+    loop_timer_stop(ctx->loop, &ctx->batch_timer);
+    loop_timer_stop(ctx->loop, &ctx->reorder_timer);
+    loop_timer_stop(ctx->loop, &ctx->probe_timer);
+    loop_io_stop(ctx->loop, &ctx->ctrl_io);
+    loop_io_stop(ctx->loop, &ctx->rtp_io);
+    loop_io_stop(ctx->loop, &ctx->rtcp_io);
+
+    if (ctx->sockfd >= 0)
+        close(ctx->sockfd);
+    // 组播 socket 不属于端口池，关闭即离开组播组
+    if (ctx->transport == RTSP_TRANSPORT_MULTICAST && ctx->rtp_sock >= 0)
+        close(ctx->rtp_sock);
+    // 没有确认 TEARDOWN 的上游会一直发到会话超时，这对端口不能给下一个会话
+    if (ctx->session_id[0] && !ctx->torn_down)
+        portpool_discard(ctx->ports);
     else
+        portpool_put(ctx->ports);
+    ctx->ports = NULL;
+    ctx->sockfd = ctx->rtp_sock = ctx->rtcp_sock = -1;
+
+    resolve_cancel(ctx->dns_req);
+    ctx->dns_req = NULL;
+    for (int i = 0; i < ctx->stun_ntargets; i++)
     {
-        // LOG_INFO("Start rtp send thread");
+        resolve_cancel(ctx->stun_targets[i].dns_req);
+        ctx->stun_targets[i].dns_req = NULL;
     }
+    free(ctx->recv_buf);
+    free(ctx->msgs);
+    free(ctx->peers);
+    free(ctx->iovs);
+    free(ctx->ctrls);
+    free(ctx->ts_cc);
+    ctx->recv_buf = NULL;
+    ctx->msgs = NULL;
+    ctx->peers = NULL;
+    ctx->iovs = NULL;
+    ctx->ctrls = NULL;
+    ctx->ts_cc = NULL;
+
+    if (ctx->recv_calls > 0)
+        LOG_INFO("RTP ingest %s: %llu packets in %llu recvmmsg calls, mean batch %.1f",
+                 ctx->rtsp_url, (unsigned long long)ctx->recv_packets, (unsigned long long)ctx->recv_calls,
+                 (double)ctx->recv_packets / ctx->recv_calls);
+    if (ctx->interleaved && ctx->recv_packets > 0)
+        LOG_INFO("RTP ingest %s: %llu packets over interleaved TCP",
+                 ctx->rtsp_url, (unsigned long long)ctx->recv_packets);
+    if (ctx->reorder.staging)
+        LOG_INFO("RTP sequence %s: %llu lost, %llu reordered, %llu duplicate, %llu late",
+                 ctx->rtsp_url, (unsigned long long)stat_get(&ctx->stats.rtp_lost),
+                 (unsigned long long)stat_get(&ctx->stats.rtp_reordered),
+                 (unsigned long long)stat_get(&ctx->stats.rtp_duplicates),
+                 (unsigned long long)stat_get(&ctx->stats.rtp_late));
+    if (stat_get(&ctx->stats.ts_packets) > 0)
+        LOG_INFO("TS integrity %s: %llu packets, %llu CC errors, %llu sync errors, %llu TEI",
+                 ctx->rtsp_url, (unsigned long long)stat_get(&ctx->stats.ts_packets),
+                 (unsigned long long)stat_get(&ctx->stats.ts_cc_errors),
+                 (unsigned long long)stat_get(&ctx->stats.ts_sync_errors),
+                 (unsigned long long)stat_get(&ctx->stats.ts_tei));
+    rtp_reorder_free(&ctx->reorder);
+
+    ctx->state = PLAY_CLOSED;
+    ctx->on_state(ctx);
+}
 
-    pthread_join(recv_thread, NULL);
-    pthread_join(send_thread, NULL);
-
-    return NULL;
+// 交错模式下缓冲区满时不再读取控制连接，但未发完的请求仍要继续发送
+static int ctrl_update_events(struct play_ctx *ctx)
+{
+    uint32_t events = ctx->ingest_paused ? 0 : EPOLLIN;
+    if (ctx->req_sent < ctx->req_len)
+        events |= EPOLLOUT;
+    return loop_io_modify(ctx->loop, &ctx->ctrl_io, events);
 }
 
-static void *rtcp_thread(void *arg)
+static int flush_request(struct play_ctx *ctx)
 {
+    while (ctx->req_sent < ctx->req_len)
+    {
+        ssize_t r = send(ctx->sockfd, ctx->req + ctx->req_sent, ctx->req_len - ctx->req_sent, MSG_NOSIGNAL);
+        if (r < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        ctx->req_sent += r;
+    }
 
-    return NULL;
+    return ctrl_update_events(ctx);
 }
 
-static int parse_rtsp_uri(const char *uri, struct rtsp_uri *out)
+// 追加到待发送的请求之后，流水线模式下可以连续排入多个请求再一起发送
+static int queue_request(const char *method, const char *uri, const char *extra_headers, const char *body, void *ctx)
 {
-    if (!uri || strncmp(uri, "rtsp://", 7) != 0)
-        return -1;
-    const char *p = uri + 7;
-    const char *slash = strchr(p, '/');
-    if (!slash)
-        return -1;
-    size_t hostlen = slash - p;
-    char hostport[320];
-    if (hostlen >= sizeof(hostport))
-        return -1;
-    memcpy(hostport, p, hostlen);
-    hostport[hostlen] = '\0';
-    char *colon = strchr(hostport, ':');
-    if (colon)
+    struct play_ctx *_control = ctx;
+    if (_control->req_sent == _control->req_len)
+        _control->req_len = _control->req_sent = 0;
+    char *req = _control->req + _control->req_len;
+    size_t req_sz = sizeof(_control->req) - _control->req_len;
+    int len = 0;
+    len += snprintf(req + len, req_sz - len, "%s %s RTSP/1.0\r\n", method, uri);
+    len += snprintf(req + len, req_sz - len, "CSeq: %d\r\n", _control->seq++);
+    if (_control->session_id[0])
+    {
+        len += snprintf(req + len, req_sz - len, "Session: %s\r\n", _control->session_id);
+    }
+    if (extra_headers)
+        len += snprintf(req + len, req_sz - len, "%s", extra_headers);
+    if (body)
     {
-        *colon = '\0';
-        strncpy(out->host, hostport, sizeof(out->host) - 1);
-        out->port = atoi(colon + 1);
-        if (out->port <= 0)
-            out->port = 554;
+        len += snprintf(req + len, req_sz - len, "Content-Length: %zu\r\n", strlen(body));
+        len += snprintf(req + len, req_sz - len, "\r\n");
+        len += snprintf(req + len, req_sz - len, "%s", body);
     }
     else
     {
-        strncpy(out->host, hostport, sizeof(out->host) - 1);
-        out->port = 554;
+        len += snprintf(req + len, req_sz - len, "\r\n");
     }
-    snprintf(out->path, sizeof(out->path), "%s", slash); // include leading '/'
+    if ((size_t)len >= req_sz)
+        return -1;
+
+    _control->req_len += len;
+    _control->awaiting++;
+    loop_timer_start(_control->loop, &_control->timer,
+                     _control->phase == RTSP_TEARDOWN ? RTSP_TEARDOWN_TIMEOUT_MS : RTSP_REQUEST_TIMEOUT_MS);
+
     return 0;
 }
 
-static int connect_host(const char *host, int port)
+static int send_request(const char *method, const char *uri, const char *extra_headers, const char *body, void *ctx)
 {
-    struct addrinfo hints, *res, *rp;
-    char portstr[16];
-    snprintf(portstr, sizeof(portstr), "%d", port);
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = SOCK_STREAM;
-    if (getaddrinfo(host, portstr, &hints, &res) != 0)
+    if (queue_request(method, uri, extra_headers, body, ctx) < 0)
         return -1;
-    int s = -1;
-    for (rp = res; rp; rp = rp->ai_next)
-    {
-        s = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
-        if (s < 0)
-            continue;
-        if (connect(s, rp->ai_addr, rp->ai_addrlen) == 0)
-            break;
-        close(s);
-        s = -1;
-    }
-    freeaddrinfo(res);
-
-    return s;
+    return flush_request(ctx);
 }
 
-static ssize_t send_all(int fd, const void *buf, size_t len)
+static int do_options(const char *uri, void *ctx)
 {
-    size_t sent = 0;
-    const char *p = buf;
-    while (sent < len)
-    {
-        ssize_t r = send(fd, p + sent, len - sent, 0);
-        if (r <= 0)
-            return -1;
-        sent += r;
-    }
-    return sent;
+    return send_request("OPTIONS", uri, NULL, NULL, ctx);
 }
 
-static int recv_response(char *buf, size_t bufsz, void *ctx)
+static int do_describe(const char *uri, void *ctx)
 {
+    char headers[256];
+    snprintf(headers, sizeof(headers), "Accept: application/sdp\r\n");
+    return send_request("DESCRIBE", uri, headers, NULL, ctx);
+}
 
+static void on_options(char *resp, void *ctx)
+{
     struct play_ctx *_control = ctx;
-    memset(buf, 0, bufsz);
-    size_t total = 0;
-
-    while (total < bufsz - 1)
-    {
-        ssize_t n = recv(_control->sockfd, buf + total, bufsz - 1 - total, 0);
-        if (n <= 0)
-            return -1;
-        total += n;
-        buf[total] = '\0';
-
-        if (strstr(buf, "\r\n\r\n"))
-            break;
-    }
-
-    return (int)total;
+    char *pub = get_header_value(resp, "Public");
+    if (pub)
+        snprintf(_control->public_methods, sizeof(_control->public_methods), "%s", pub);
 }
 
-static int parse_status_code(const char *resp)
+static void on_describe(char *resp, void *ctx)
 {
-    int code = 0;
-    if (sscanf(resp, "RTSP/%*s %d", &code) == 1)
-        return code;
-    return -1;
+    struct play_ctx *_control = ctx;
+    // extract Content-Base or Location
+    char *cb = get_header_value(resp, "Content-Base");
+    if (!cb)
+        cb = get_header_value(resp, "Content-Location");
+    if (cb)
+        strncpy(_control->last_location, cb, sizeof(_control->last_location) - 1);
 }
 
-static char *get_header_value(const char *resp, const char *header)
+static int do_setup(const char *uri, int client_rtp_port, void *ctx)
 {
-    // returns pointer into resp where value begins. Caller should not free.
-    char *h = strcasestr(resp, header);
-    if (!h)
-        return NULL;
-    char *colon = strchr(h, ':');
-    if (!colon)
-        return NULL;
-    char *v = colon + 1;
-    while (*v == ' ' || *v == '\t')
-        v++;
-    // trim end of line
-    char *eol = strchr(v, '\r');
-    if (!eol)
-        eol = strchr(v, '\n');
-    if (eol)
-        *eol = '\0';
-    return v;
+    struct play_ctx *_control = ctx;
+    char headers[256];
+    if (_control->interleaved)
+        snprintf(headers, sizeof(headers), "Transport: RTP/AVP/TCP;unicast;interleaved=0-1\r\n");
+    else
+        snprintf(headers, sizeof(headers), "Transport: RTP/AVP/UDP;unicast;client_port=%d-%d\r\n", client_rtp_port, client_rtp_port + 1);
+    return send_request("SETUP", uri, headers, NULL, ctx);
 }
 
-static int send_request(const char *method, const char *uri, const char *extra_headers, const char *body, char *resp, size_t resp_sz, void *ctx)
+// RTP/RTCP 套接字是 IPv4 的，对端是 IPv6（非映射地址）时返回 -1
+static int server_addr(struct play_ctx *ctx, struct sockaddr_in *out, int port)
 {
-    struct play_ctx *_control = ctx;
-    char req[4096];
-    int len = 0;
-    len += snprintf(req + len, sizeof(req) - len, "%s %s RTSP/1.0\r\n", method, uri);
-    len += snprintf(req + len, sizeof(req) - len, "CSeq: %d\r\n", _control->seq++);
-    if (_control->session_id[0])
-    {
-        len += snprintf(req + len, sizeof(req) - len, "Session: %s", _control->session_id);
-    }
-    if (extra_headers)
-        len += snprintf(req + len, sizeof(req) - len, "%s", extra_headers);
-    if (body)
+    struct sockaddr_storage peer;
+    socklen_t len = sizeof(peer);
+
+    memset(out, 0, sizeof(*out));
+    out->sin_family = AF_INET;
+    out->sin_port = htons(port);
+    if (getpeername(ctx->sockfd, (struct sockaddr *)&peer, &len) < 0)
+        return -1;
+    if (peer.ss_family == AF_INET)
     {
-        len += snprintf(req + len, sizeof(req) - len, "Content-Length: %zu\r\n", strlen(body));
-        len += snprintf(req + len, sizeof(req) - len, "\r\n");
-        len += snprintf(req + len, sizeof(req) - len, "%s", body);
+        out->sin_addr = ((struct sockaddr_in *)&peer)->sin_addr;
+        return 0;
     }
-    else
+    const struct in6_addr *a6 = &((struct sockaddr_in6 *)&peer)->sin6_addr;
+    if (peer.ss_family == AF_INET6 && IN6_IS_ADDR_V4MAPPED(a6))
     {
-        len += snprintf(req + len, sizeof(req) - len, "\r\n");
+        memcpy(&out->sin_addr, &a6->s6_addr[12], sizeof(out->sin_addr));
+        return 0;
     }
-    if (send_all(_control->sockfd, req, len) != len)
-        return -1;
-    int r = recv_response(resp, resp_sz, ctx);
-    if (r <= 0)
-        return -1;
-
-    return r;
-}
-
-static int do_options(const char *uri, char *resp, size_t resp_sz, void *ctx)
-{
-    return send_request("OPTIONS", uri, NULL, NULL, resp, resp_sz, ctx);
+    return -1;
 }
 
-static int do_describe(const char *uri, char *resp, size_t resp_sz, void *ctx)
+static void on_setup(char *resp, void *ctx)
 {
     struct play_ctx *_control = ctx;
-    char headers[256];
-    snprintf(headers, sizeof(headers), "Accept: application/sdp\r\n");
-    int r = send_request("DESCRIBE", uri, headers, NULL, resp, resp_sz, ctx);
-    if (r > 0)
+    char *sess_line = strstr(resp, "Session:");
+    if (sess_line)
     {
-        // extract Content-Base or Location
-        char *cb = get_header_value(resp, "Content-Base");
-        if (!cb)
-            cb = get_header_value(resp, "Content-Location");
-        if (cb)
-            strncpy(_control->last_location, cb, sizeof(_control->last_location) - 1);
+        sess_line += strlen("Session:");
+        while (*sess_line == ' ')
+            sess_line++;
+
+        char *line_end = strpbrk(sess_line, "\r\n");
+        if (!line_end)
+            line_end = sess_line + strlen(sess_line);
+
+        char *semi = strchr(sess_line, ';');
+        if (semi && semi < line_end)
+            line_end = semi;
+
+        size_t len = line_end - sess_line;
+        if (len >= sizeof(_control->session_id))
+            len = sizeof(_control->session_id) - 1;
+        strncpy(_control->session_id, sess_line, len);
+        _control->session_id[len] = '\0';
     }
-    return r;
-}
 
-static int do_setup(const char *uri, int client_rtp_port, char *resp, size_t resp_sz, void *ctx)
-{
-
-    struct play_ctx *_control = ctx;
-    char headers[256];
-    snprintf(headers, sizeof(headers), "Transport: RTP/AVP/UDP;unicast;client_port=%d-%d\r\n", client_rtp_port, client_rtp_port + 1);
-    int r = send_request("SETUP", uri, headers, NULL, resp, resp_sz, ctx);
-    if (r > 0)
+    int server_rtp = 0, server_rtcp = 0;
+    char source[PARSE_ADDR_MAX] = "";
+    char *tp = get_header_value(resp, "Transport");
+    if (tp)
     {
-        char *sess_line = strstr(resp, "Session:");
-        if (sess_line)
+        char *sp = strstr(tp, "server_port=");
+        if (sp)
         {
-            sess_line += strlen("Session:");
-            while (*sess_line == ' ')
-                sess_line++;
-
-            char *line_end = strchr(sess_line, '\n');
-            if (!line_end)
-                line_end = sess_line + strlen(sess_line);
-
-            char *semi = strchr(sess_line, ';');
-            if (semi && semi < line_end)
-                line_end = semi;
-
-            size_t len = line_end - sess_line;
-            if (len >= sizeof(_control->session_id))
-                len = sizeof(_control->session_id) - 1;
-            strncpy(_control->session_id, sess_line, len);
-            _control->session_id[len] = '\0';
+            sscanf(sp + strlen("server_port="), "%d-%d", &server_rtp, &server_rtcp);
         }
+        char *src = strstr(tp, "source=");
+        if (src)
+            sscanf(src + strlen("source="), "%45[^;]", source);
     }
-    return r;
+
+    // host 可能是域名，地址取自已连上的 RTSP 连接，只换端口
+    if ((server_addr(_control, &_control->rtp_server, server_rtp) < 0 ||
+         server_addr(_control, &_control->rtcp_server, server_rtcp) < 0) &&
+        !_control->interleaved)
+        LOG_WARN("%s: upstream is not reachable over IPv4, UDP trigger packets are not sent", _control->rtsp_url);
+
+    // 媒体从别的地址发出时服务器用 source= 声明，打洞包和来源检查都以它为准
+    struct in_addr media;
+    if (source[0] && inet_pton(AF_INET, source, &media) == 1)
+        _control->rtp_server.sin_addr = _control->rtcp_server.sin_addr = media;
 }
 
-static int do_play(const char *uri, const char *range, char *resp, size_t resp_sz, void *ctx)
+static int do_play(const char *uri, const char *range, void *ctx)
 {
     char headers[256] = {0};
     if (range && range[0])
         snprintf(headers, sizeof(headers), "Range: %s\r\n", range);
-    return send_request("PLAY", uri, headers, NULL, resp, resp_sz, ctx);
+    return send_request("PLAY", uri, headers, NULL, ctx);
 }
 
-static int do_GET_PARAMETER(const char *uri, char *resp, size_t resp_sz, void *ctx)
+static int do_GET_PARAMETER(const char *uri, void *ctx)
 {
+    struct play_ctx *_control = ctx;
     char headers[256] = {0};
-    return send_request("GET_PARAMETER", uri, headers, NULL, resp, resp_sz, ctx);
+    // Public 中没有 GET_PARAMETER 的服务器用 OPTIONS 保活
+    if (_control->public_methods[0] && !strstr(_control->public_methods, "GET_PARAMETER"))
+        return send_request("OPTIONS", uri, NULL, NULL, ctx);
+    return send_request("GET_PARAMETER", uri, headers, NULL, ctx);
 }
 
-static int do_pause(const char *uri, char *resp, size_t resp_sz, void *ctx)
+static int do_teardown(const char *uri, void *ctx)
 {
-    return send_request("PAUSE", uri, NULL, NULL, resp, resp_sz, ctx);
+    return send_request("TEARDOWN", uri, NULL, NULL, ctx);
 }
 
-static int do_teardown(const char *uri, char *resp, size_t resp_sz, void *ctx)
+// 关闭 UDP 接收，之后的 SETUP 请求交错传输
+static void use_interleaved(struct play_ctx *ctx, const char *reason)
 {
-    return send_request("TEARDOWN", uri, NULL, NULL, resp, resp_sz, ctx);
+    LOG_WARN("%s: %s, switching to interleaved TCP", ctx->rtsp_url, reason);
+
+    loop_timer_stop(ctx->loop, &ctx->batch_timer);
+    loop_timer_stop(ctx->loop, &ctx->probe_timer);
+    loop_io_stop(ctx->loop, &ctx->rtp_io);
+    loop_io_stop(ctx->loop, &ctx->rtcp_io);
+    portpool_put(ctx->ports);
+    ctx->ports = NULL;
+    ctx->rtp_sock = ctx->rtcp_sock = -1;
+    ctx->interleaved = 1;
 }
 
-int random_rtp_port()
+static int alloc_rtp_buffer(struct play_ctx *ctx)
 {
-    static int initialized = 0;
-    if (!initialized)
+    if (ctx->rtp_buf)
+        return 0;
+
+    struct rtp_buffer *rtp_buf = init_rtp_buffer();
+    if (rtp_buf == NULL)
+        return -1;
+    if (ctx->reorder_ms > 0 && rtp_reorder_init(&ctx->reorder, rtp_buf->stride, ctx->reorder_ms, &ctx->stats) < 0)
     {
-        srand(time(NULL) ^ getpid());
-        initialized = 1;
+        free_rtp_buffer(rtp_buf);
+        return -1;
     }
-
-    int port = 10000 + (rand() % 25000) * 2;
-    return port;
+    ctx->lag_limit = (uint64_t)rtp_buf->size * get_server_config()->lag_limit / 100;
+    // 其他工作线程上的客户端在挂载时会读取 rtp_buf
+    pthread_mutex_lock(&ctx->lock);
+    ctx->rtp_buf = rtp_buf;
+    pthread_mutex_unlock(&ctx->lock);
+    return 0;
 }
 
-static void *get_parameter_thread(void *arg)
+static void handle_response(struct play_ctx *ctx, char *resp)
 {
-    struct play_ctx *_control = arg;
-    char resp[8192];
+    const struct server_config *config = get_server_config();
+
+    if (!ctx->awaiting)
+        return;
+    if (--ctx->awaiting == 0)
+        loop_timer_stop(ctx->loop, &ctx->timer);
+
+    if (ctx->phase == RTSP_TEARDOWN)
+    {
+        ctx->torn_down = 1;
+        rtsp_finish(ctx);
+        return;
+    }
 
-    time_t last_time = time(NULL);
+    // 保活只关心连接是否仍然可用
+    if (ctx->phase == RTSP_KEEPALIVE)
+        return;
 
-    while (!_control->stop)
+    int code = parse_status_code(resp);
+    if (ctx->phase == RTSP_SETUP && (code < 200 || code >= 300) && ctx->handshake_cached)
     {
-        if (_control->stop)
+        // 缓存的 DESCRIBE 结果可能已经过时，完整握手一次再决定是否改用交错传输
+        LOG_WARN("%s: SETUP with cached handshake rejected with %d, retrying from OPTIONS", ctx->rtsp_url, code);
+        rtsp_cache_invalidate(ctx->rtsp_url);
+        ctx->handshake_cached = 0;
+        ctx->last_location[0] = '\0';
+        set_phase(ctx, RTSP_OPTIONS);
+        if (do_options(ctx->rtsp_url, ctx) < 0)
         {
-            break;
+            LOG_ERROR("Failed to send OPTIONS request");
+            rtsp_finish(ctx);
+        }
+        return;
+    }
+    if (ctx->phase == RTSP_SETUP && (code < 200 || code >= 300) &&
+        !ctx->interleaved && ctx->transport == RTSP_TRANSPORT_AUTO)
+    {
+        char reason[64];
+        snprintf(reason, sizeof(reason), "UDP SETUP rejected with %d", code);
+        use_interleaved(ctx, reason);
+        if (do_setup(ctx->rtsp_url, 0, ctx) < 0)
+        {
+            LOG_ERROR("Failed to send SETUP request");
+            rtsp_finish(ctx);
+        }
+        return;
+    }
+
+    if (code < 200 || code >= 300)
+    {
+        LOG_ERROR("Failed to do %s request, response: %s", phase_names[ctx->phase], resp);
+        rtsp_finish(ctx);
+        return;
+    }
+
+    int r = 0;
+    switch (ctx->phase)
+    {
+    case RTSP_OPTIONS:
+        on_options(resp, ctx);
+        set_phase(ctx, RTSP_DESCRIBE);
+        // 流水线模式下 DESCRIBE 已经发出
+        if (!ctx->pipelined)
+            r = do_describe(ctx->rtsp_url, ctx);
+        break;
+    case RTSP_DESCRIBE:
+        on_describe(resp, ctx);
+        ctx->pipelined = 0;
+        rtsp_cache_store(ctx->rtsp_url, ctx->public_methods, ctx->last_location);
+        set_phase(ctx, RTSP_SETUP);
+        r = do_setup(ctx->rtsp_url, ctx->setup_rtp_port, ctx);
+        break;
+    case RTSP_SETUP:
+        on_setup(resp, ctx);
+        // 握手成功后才分配环形缓冲区，失败的频道不占用内存
+        if (alloc_rtp_buffer(ctx) < 0)
+        {
+            rtsp_finish(ctx);
+            return;
+        }
+        ctx->ssrc = 0x11223344;
+        if (!config->enable_nat && !ctx->interleaved)
+            rtp_send_trigger(ctx->rtp_sock, &ctx->rtp_server, ctx->ssrc);
+        set_phase(ctx, RTSP_PLAY);
+        r = do_play(ctx->rtsp_url, "npt=0.000-", ctx);
+        break;
+    case RTSP_PLAY:
+        LOG_INFO("%s: PLAY accepted %llu ms after start%s", ctx->rtsp_url,
+                 (unsigned long long)(loop_now_ms() - ctx->start_ms), ctx->handshake_cached ? " (cached handshake)" : "");
+        ctx->play = 1;
+        set_phase(ctx, RTSP_KEEPALIVE);
+        ctx->state = PLAY_PLAYING;
+        loop_timer_start(ctx->loop, &ctx->keepalive, RTSP_KEEPALIVE_INTERVAL_MS);
+        if (!ctx->interleaved && ctx->transport == RTSP_TRANSPORT_AUTO)
+            loop_timer_start(ctx->loop, &ctx->probe_timer, RTSP_UDP_PROBE_MS);
+        ctx->on_state(ctx);
+        break;
+    default:
+        break;
+    }
+
+    if (r < 0)
+    {
+        LOG_ERROR("Failed to send %s request", phase_names[ctx->phase]);
+        rtsp_finish(ctx);
+    }
+}
+
+// 依次处理缓冲区中的 RTSP 响应和 $ 交错帧
+static void process_input(struct play_ctx *ctx)
+{
+    size_t pos = 0;
+
+    while (ctx->phase != RTSP_DONE && pos < ctx->resp_len)
+    {
+        char *p = ctx->resp + pos;
+        size_t avail = ctx->resp_len - pos;
+
+        if (ctx->ilv_skip > 0)
+        {
+            size_t n = ctx->ilv_skip < avail ? ctx->ilv_skip : avail;
+            ctx->ilv_skip -= n;
+            pos += n;
+            continue;
         }
 
-        time_t current_time = time(NULL);
-        if (difftime(current_time, last_time) >= 10)
+        if (p[0] == '$')
         {
-            if (do_GET_PARAMETER(_control->last_location, resp, sizeof(resp), _control) <= 0)
+            if (avail < 4)
+                break;
+            uint8_t channel = (uint8_t)p[1];
+            size_t flen = ((uint8_t)p[2] << 8) | (uint8_t)p[3];
+            if (4 + flen > sizeof(ctx->resp) - 1)
+            {
+                ctx->ilv_skip = 4 + flen;
+                continue;
+            }
+            if (avail < 4 + flen)
+                break;
+
+            // 通道 0 是 RTP，通道 1 的 RTCP 直接丢弃
+            if (channel == 0 && !rtp_ingest(ctx, (uint8_t *)p + 4, flen))
             {
-                LOG_ERROR("Failed to send GET_PARAMETER request");
+                ctx->ingest_paused = 1;
+                ctrl_update_events(ctx);
                 break;
             }
+            pos += 4 + flen;
+            continue;
+        }
+
+        size_t len = parse_response_length(p, avail);
+        if (len == 0)
+            break;
+
+        char resp[sizeof(ctx->resp)];
+        memcpy(resp, p, len);
+        resp[len] = '\0';
+        pos += len;
+
+        handle_response(ctx, resp);
+    }
+
+    ctx->resp_len -= pos;
+    memmove(ctx->resp, ctx->resp + pos, ctx->resp_len);
+    ctx->resp[ctx->resp_len] = '\0';
+}
+
+static void read_responses(struct play_ctx *ctx)
+{
+    while (ctx->phase != RTSP_DONE)
+    {
+        process_input(ctx);
+        if (ctx->phase == RTSP_DONE || ctx->ingest_paused)
+            return;
 
-            last_time = current_time;
+        if (ctx->resp_len >= sizeof(ctx->resp) - 1)
+        {
+            LOG_ERROR("RTSP response too large");
+            rtsp_finish(ctx);
+            return;
+        }
+
+        ssize_t n = recv(ctx->sockfd, ctx->resp + ctx->resp_len, sizeof(ctx->resp) - 1 - ctx->resp_len, 0);
+        if (n < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
+            if (errno == EINTR)
+                continue;
         }
-        sleep(1);
+        if (n <= 0)
+        {
+            if (ctx->phase != RTSP_TEARDOWN)
+                LOG_ERROR("RTSP connection closed during %s", phase_names[ctx->phase]);
+            // 服务器收到流水线请求后断开，之后对这个地址逐个发送
+            if (ctx->pipelined)
+                rtsp_cache_disable_pipeline(ctx->rtsp_url);
+            rtsp_finish(ctx);
+            return;
+        }
+        ctx->resp_len += n;
+        ctx->resp[ctx->resp_len] = '\0';
     }
+}
+
+static void try_connect(struct play_ctx *ctx)
+{
+    while (ctx->next_addr < ctx->addrs.count)
+    {
+        struct resolve_addr *rp = &ctx->addrs.addrs[ctx->next_addr++];
 
-    // LOG_INFO("RTP Keepalive thread: quit.");
-    return NULL;
+        int s = socket(rp->family, rp->socktype | SOCK_NONBLOCK, rp->protocol);
+        if (s < 0)
+            continue;
+        if (connect(s, (struct sockaddr *)&rp->addr, rp->addrlen) == 0 || errno == EINPROGRESS)
+        {
+            ctx->sockfd = s;
+            set_phase(ctx, RTSP_CONNECTING);
+            if (loop_io_start(ctx->loop, &ctx->ctrl_io, s, EPOLLOUT) < 0)
+                break;
+            loop_timer_start(ctx->loop, &ctx->timer, RTSP_REQUEST_TIMEOUT_MS);
+            return;
+        }
+        close(s);
+    }
+
+    LOG_ERROR("Failed to connect host");
+    rtsp_finish(ctx);
+}
+
+// 缓存命中（包括 IP 字面量）时直接回调，否则等解析线程把结果投递回来
+static void resolve_host(struct play_ctx *ctx, struct resolve_req **req, const char *host, int port, int family, int socktype,
+                         resolve_cb cb, void *arg)
+{
+    struct resolve_result res;
+
+    if (resolve_lookup(host, port, family, socktype, &res))
+    {
+        cb(arg, &res);
+        return;
+    }
+
+    *req = resolve_start(ctx->loop, host, port, family, socktype, cb, arg);
+    if (*req == NULL)
+    {
+        res.status = -1;
+        res.count = 0;
+        cb(arg, &res);
+    }
 }
 
-void rtsp_play_stream(const char *rtsp_url, int http_fd)
+static void on_host_resolved(void *arg, const struct resolve_result *res)
 {
+    struct play_ctx *ctx = (struct play_ctx *)arg;
+
+    ctx->dns_req = NULL;
+    if (res->status < 0)
+    {
+        LOG_ERROR("Failed to resolve host %s", ctx->host);
+        rtsp_finish(ctx);
+        return;
+    }
+    ctx->addrs = *res;
+    ctx->next_addr = 0;
+    try_connect(ctx);
+}
 
-    int th_rtp_created = 0, th_rtcp_created = 0, th_get_param_created = 0;
+static void start_connect(struct play_ctx *ctx)
+{
+    resolve_host(ctx, &ctx->dns_req, ctx->host, ctx->port, AF_UNSPEC, SOCK_STREAM, on_host_resolved, ctx);
+}
 
+// 缓存了 DESCRIBE 结果时直接 SETUP；否则 OPTIONS 开始，允许时 DESCRIBE 与它一起发出
+static void start_handshake(struct play_ctx *ctx)
+{
     const struct server_config *config = get_server_config();
-    int rtp_port = random_rtp_port();
+    struct rtsp_cache_entry cached;
+    int r;
 
-    struct rtsp_uri uri;
-    char resp[8192];
+    if (config->handshake_ttl_ms > 0 && rtsp_cache_lookup(ctx->rtsp_url, &cached))
+    {
+        snprintf(ctx->public_methods, sizeof(ctx->public_methods), "%s", cached.public_methods);
+        snprintf(ctx->last_location, sizeof(ctx->last_location), "%s", cached.content_base);
+        ctx->handshake_cached = 1;
+        set_phase(ctx, RTSP_SETUP);
+        if (do_setup(ctx->rtsp_url, ctx->setup_rtp_port, ctx) < 0)
+        {
+            LOG_ERROR("Failed to send SETUP request");
+            rtsp_finish(ctx);
+        }
+        return;
+    }
 
-    struct play_ctx *ctx = (struct play_ctx *)malloc(sizeof(struct play_ctx));
-    if (ctx == NULL)
+    set_phase(ctx, RTSP_OPTIONS);
+    if (config->pipeline && rtsp_cache_pipeline_allowed(ctx->rtsp_url))
+    {
+        ctx->pipelined = 1;
+        r = queue_request("OPTIONS", ctx->rtsp_url, NULL, NULL, ctx);
+        if (r == 0)
+            r = do_describe(ctx->rtsp_url, ctx);
+    }
+    else
     {
-        LOG_ERROR("Failed to allocate memory for play_ctx.");
+        r = do_options(ctx->rtsp_url, ctx);
+    }
+    if (r < 0)
+    {
+        LOG_ERROR("Failed to send OPTIONS request");
+        rtsp_finish(ctx);
+    }
+}
+
+static void on_connected(struct play_ctx *ctx)
+{
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(ctx->sockfd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+        err = errno;
+
+    loop_timer_stop(ctx->loop, &ctx->timer);
+
+    if (err != 0)
+    {
+        loop_io_stop(ctx->loop, &ctx->ctrl_io);
+        close(ctx->sockfd);
+        ctx->sockfd = -1;
+        try_connect(ctx);
         return;
     }
 
-    ctx->rtp_buf = (struct rtp_buffer *)malloc(sizeof(struct rtp_buffer));
-    if (ctx->rtp_buf == NULL)
+    start_handshake(ctx);
+}
+
+static void note_first_packet(struct play_ctx *ctx)
+{
+    if (ctx->first_packet || ctx->recv_packets == 0)
+        return;
+    ctx->first_packet = 1;
+    LOG_INFO("%s: first RTP packet %llu ms after start", ctx->rtsp_url,
+             (unsigned long long)(loop_now_ms() - ctx->start_ms));
+}
+
+static void ctrl_io_cb(struct ev_loop *loop, struct ev_io *io, uint32_t events)
+{
+    struct play_ctx *ctx = (struct play_ctx *)io->data;
+
+    if (ctx->phase == RTSP_CONNECTING)
     {
-        LOG_ERROR("Failed to allocate memory for rtp_buffer.");
-        free(ctx); // 释放 ctx 内存
-        return;    // 或者其他错误处理
+        on_connected(ctx);
+        return;
     }
 
-    if (init_rtp_buffer(ctx->rtp_buf) < 0)
+    if ((events & EPOLLOUT) && flush_request(ctx) < 0)
     {
-        LOG_ERROR("Failed to allocate memory for rtp_buffer.");
-        free(ctx->rtp_buf);
-        free(ctx);
+        LOG_ERROR("Failed to send %s request", phase_names[ctx->phase]);
+        rtsp_finish(ctx);
         return;
     }
 
-    pthread_t th_rtp, th_rtcp, th_get_param;
+    if (events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+    {
+        read_responses(ctx);
+        if (ctx->interleaved)
+        {
+            note_first_packet(ctx);
+            rtp_notify_readers(ctx);
+        }
+    }
+}
 
-    ctx->rtp_sock = rtp_open(rtp_port);
-    ctx->rtcp_sock = rtcp_open(rtp_port + 1);
+// 最慢的客户端腾出空位后恢复接收
+void rtsp_resume_ingest(struct play_ctx *ctx)
+{
+    if (ctx->stop)
+        return;
 
-    ctx->max_rtp_buffer_size = config->max_rtp_buffer_size;
-    ctx->max_udp_packet_size = config->max_udp_packet_size;
+    if (!ctx->interleaved)
+    {
+        rtp_resume(ctx);
+        return;
+    }
 
-    int wan_port = 0;
-    int setup_rtp_port;
-    char pub_ip[64];
+    if (!ctx->ingest_paused)
+        return;
+    ctx->ingest_paused = 0;
+    ctrl_update_events(ctx);
+    read_responses(ctx);
+    rtp_notify_readers(ctx);
+}
 
-    if (config->enable_nat)
+// 同一个请求发给所有已解析的服务器，第一个有效响应胜出
+static void stun_send(struct play_ctx *ctx)
+{
+    for (int i = 0; i < ctx->stun_ntargets; i++)
+    {
+        struct stun_target *t = &ctx->stun_targets[i];
+        if (t->ready)
+            sendto(ctx->rtp_sock, ctx->stun_req, sizeof(ctx->stun_req), 0, (struct sockaddr *)&t->addr, sizeof(t->addr));
+    }
+    loop_timer_start(ctx->loop, &ctx->timer, STUN_RTO_MS << (ctx->stun_tries - 1));
+}
+
+static void stun_failed(struct play_ctx *ctx, const char *reason)
+{
+    if (ctx->transport == RTSP_TRANSPORT_AUTO)
     {
+        use_interleaved(ctx, reason);
+        start_connect(ctx);
+        return;
+    }
+    LOG_ERROR("%s", reason);
+    rtsp_finish(ctx);
+}
 
-        wan_port = get_wan_port_existing_socket(ctx->rtp_sock, pub_ip, sizeof(pub_ip));
+static void on_stun_resolved(void *arg, const struct resolve_result *res)
+{
+    struct stun_target *t = (struct stun_target *)arg;
+    struct play_ctx *ctx = t->ctx;
+
+    t->dns_req = NULL;
+    ctx->stun_resolving--;
+    if (res->status == 0 && res->addrs[0].family == AF_INET)
+    {
+        memcpy(&t->addr, &res->addrs[0].addr, sizeof(t->addr));
+        t->ready = 1;
 
-        if (wan_port >= 0)
-            LOG_DEBUG("Public mapping obtained: %s:%d -> %d", pub_ip, wan_port, rtp_port);
+        // 第一个解析完的服务器开始计时，之后解析完的立即补发一次
+        if (ctx->phase != RTSP_STUN)
+        {
+            set_phase(ctx, RTSP_STUN);
+            ctx->stun_tries = 1;
+            stun_send(ctx);
+        }
         else
         {
-            LOG_ERROR("STUN failed to get public mapping");
-            goto cleanup;
+            sendto(ctx->rtp_sock, ctx->stun_req, sizeof(ctx->stun_req), 0, (struct sockaddr *)&t->addr, sizeof(t->addr));
         }
+        return;
     }
 
-    if (wan_port == 0)
-        setup_rtp_port = rtp_port;
-    else
-        setup_rtp_port = wan_port;
+    if (ctx->stun_resolving == 0 && ctx->phase != RTSP_STUN)
+        stun_failed(ctx, "STUN server unavailable");
+}
 
-    if (parse_rtsp_uri(rtsp_url, &uri) != 0)
+static void stun_start(struct play_ctx *ctx)
+{
+    struct stun_server servers[STUN_MAX_SERVERS];
+    int n = stun_parse_servers(get_server_config()->stun_servers, servers, STUN_MAX_SERVERS);
+
+    // 后台预热过的端口对已有未过期的映射
+    int mapped = portpool_mapped_port(ctx->ports);
+    if (mapped)
     {
-        LOG_ERROR("Invalid RTSP URI");
-        goto cleanup;
+        LOG_DEBUG("Using warm mapping %d -> %d, skipping STUN", mapped, ctx->rtp_port);
+        ctx->setup_rtp_port = mapped;
+        start_connect(ctx);
+        return;
     }
 
-    ctx->sockfd = connect_host(uri.host, uri.port);
-    ctx->seq = 1;
-    ctx->stop = 0;
+    if (stun_predict_port(ctx->rtp_port, &ctx->setup_rtp_port))
+    {
+        LOG_DEBUG("Predicted public port %d, skipping STUN", ctx->setup_rtp_port);
+        ctx->stun_predicted = 1;
+        start_connect(ctx);
+        return;
+    }
+    if (n == 0)
+    {
+        stun_failed(ctx, "No STUN server configured");
+        return;
+    }
 
-    if (ctx->sockfd < 0)
+    stun_build_request(ctx->stun_req, ctx->stun_tid);
+    ctx->stun_ntargets = n;
+    ctx->stun_resolving = n;
+    for (int i = 0; i < n; i++)
+    {
+        ctx->stun_targets[i].ctx = ctx;
+        ctx->stun_targets[i].ready = 0;
+    }
+    // 解析结果可能同步回调，回调里会读 stun_resolving，所以先全部初始化
+    for (int i = 0; i < n && ctx->phase != RTSP_DONE && !ctx->interleaved; i++)
     {
-        LOG_ERROR("Failed to connect host");
-        goto cleanup;
+        struct stun_target *t = &ctx->stun_targets[i];
+        resolve_host(ctx, &t->dns_req, servers[i].host, servers[i].port, AF_INET, SOCK_DGRAM, on_stun_resolved, t);
     }
+}
+
+static void stun_receive(struct play_ctx *ctx)
+{
+    unsigned char rsp[1500];
+    char pub_ip[64];
+    int wan_port = 0;
 
-    if (do_options(rtsp_url, resp, sizeof(resp), ctx) <= 0)
+    while (1)
     {
-        LOG_ERROR("Failed to do OPTIONS request, response: %s", resp);
-        goto cleanup;
+        ssize_t n = recv(ctx->rtp_sock, rsp, sizeof(rsp), MSG_DONTWAIT);
+        if (n < 0)
+            return;
+        if (stun_parse_response(rsp, n, ctx->stun_tid, pub_ip, sizeof(pub_ip), &wan_port) == 0)
+            break;
     }
 
-    if (do_describe(rtsp_url, resp, sizeof(resp), ctx) <= 0)
+    loop_timer_stop(ctx->loop, &ctx->timer);
+    LOG_DEBUG("Public mapping obtained: %s:%d -> %d", pub_ip, wan_port, ctx->rtp_port);
+
+    // 其余服务器的解析和响应都不再需要
+    for (int i = 0; i < ctx->stun_ntargets; i++)
     {
-        LOG_ERROR("Failed to do DESCRIBE request, response: %s", resp);
-        goto cleanup;
+        resolve_cancel(ctx->stun_targets[i].dns_req);
+        ctx->stun_targets[i].dns_req = NULL;
     }
 
-    if (do_setup(rtsp_url, setup_rtp_port, resp, sizeof(resp), ctx) <= 0)
+    if (wan_port != 0)
     {
-        LOG_ERROR("Failed to do SETUP request, response: %s", resp);
-        goto cleanup;
+        stun_observe_mapping(ctx->rtp_port, wan_port);
+        portpool_set_mapping(ctx->ports, wan_port);
+        ctx->setup_rtp_port = wan_port;
     }
+    start_connect(ctx);
+}
 
-    int server_rtp = 0, server_rtcp = 0;
-    char *tp = get_header_value(resp, "Transport");
-    if (tp)
+static void rtp_io_cb(struct ev_loop *loop, struct ev_io *io, uint32_t events)
+{
+    struct play_ctx *ctx = (struct play_ctx *)io->data;
+
+    if (ctx->phase == RTSP_STUN)
     {
-        char *sp = strstr(tp, "server_port=");
-        if (sp)
-        {
-            sscanf(sp + strlen("server_port="), "%d-%d", &server_rtp, &server_rtcp);
-        }
+        stun_receive(ctx);
+        return;
+    }
+
+    if (rtp_receive(ctx) < 0)
+    {
+        rtsp_stop_stream(ctx);
+        return;
     }
+    note_first_packet(ctx);
+    rtp_notify_readers(ctx);
+}
+
+// PLAY 成功但 UDP 一直收不到数据（多半被 NAT 或防火墙挡住），改用交错模式重新建立会话
+static void probe_timer_cb(struct ev_loop *loop, struct ev_timer *timer)
+{
+    struct play_ctx *ctx = (struct play_ctx *)timer->data;
+
+    if (ctx->phase != RTSP_KEEPALIVE || ctx->recv_packets > 0)
+        return;
+
+    // 预测的公网端口不对，下一个会话重新做 STUN
+    if (ctx->stun_predicted)
+        stun_prediction_failed();
 
-    // Initialize context for RTP and RTCP
-    ctx->http_sock = http_fd;
-    ctx->ssrc = 0x11223344;
-    ctx->rtsp_url = rtsp_url;
+    // 不等响应：TEARDOWN 写进内核后关闭连接，仍会先于 FIN 送到。
+    // 上游不一定处理它，端口对直接关闭，不放回池中
+    if (ctx->session_id[0] && ctx->req_sent == ctx->req_len && do_teardown(ctx->rtsp_url, ctx) < 0)
+        LOG_WARN("%s: failed to send TEARDOWN before switching transport", ctx->rtsp_url);
+    portpool_discard(ctx->ports);
+    ctx->ports = NULL;
+
+    loop_timer_stop(loop, &ctx->timer);
+    loop_timer_stop(loop, &ctx->keepalive);
+    loop_io_stop(loop, &ctx->ctrl_io);
+    close(ctx->sockfd);
+    ctx->sockfd = -1;
+
+    use_interleaved(ctx, "no RTP received over UDP");
     ctx->play = 0;
+    ctx->session_id[0] = '\0';
+    ctx->req_len = ctx->req_sent = 0;
+    ctx->resp_len = 0;
+    ctx->awaiting = 0;
+    ctx->pipelined = 0;
+    ctx->reorder.synced = 0;
+    start_connect(ctx);
+}
 
-    // Initialize RTP and RTCP server addresses
-    memset(&ctx->rtcp_server, 0, sizeof(ctx->rtcp_server));
-    ctx->rtcp_server.sin_family = AF_INET;
-    ctx->rtcp_server.sin_port = htons(server_rtcp);
-    inet_pton(AF_INET, uri.host, &ctx->rtcp_server.sin_addr);
+static void batch_timer_cb(struct ev_loop *loop, struct ev_timer *timer)
+{
+    rtp_resume((struct play_ctx *)timer->data);
+}
 
-    memset(&ctx->rtp_server, 0, sizeof(ctx->rtp_server));
-    ctx->rtp_server.sin_family = AF_INET;
-    ctx->rtp_server.sin_port = htons(server_rtp);
-    inet_pton(AF_INET, uri.host, &ctx->rtp_server.sin_addr);
+static void reorder_timer_cb(struct ev_loop *loop, struct ev_timer *timer)
+{
+    rtp_reorder_timeout((struct play_ctx *)timer->data);
+}
+
+static void rtcp_io_cb(struct ev_loop *loop, struct ev_io *io, uint32_t events)
+{
+    char buf[1500];
+
+    // 暂不处理服务器的 RTCP 报告，只需要把 socket 读空
+    while (recv(io->fd, buf, sizeof(buf), MSG_DONTWAIT) > 0)
+        ;
+}
 
-    if (pthread_create(&th_rtp, NULL, rtp_thread, ctx) != 0)
+static void timer_cb(struct ev_loop *loop, struct ev_timer *timer)
+{
+    struct play_ctx *ctx = (struct play_ctx *)timer->data;
+
+    switch (ctx->phase)
     {
-        LOG_ERROR("Failed to create RTP thread");
-        goto cleanup;
+    case RTSP_STUN:
+        if (++ctx->stun_tries > STUN_TRIES)
+        {
+            for (int i = 0; i < ctx->stun_ntargets; i++)
+            {
+                resolve_cancel(ctx->stun_targets[i].dns_req);
+                ctx->stun_targets[i].dns_req = NULL;
+            }
+            stun_failed(ctx, "STUN failed to get public mapping");
+        }
+        else
+        {
+            stun_send(ctx);
+        }
+        break;
+    case RTSP_CONNECTING:
+        loop_io_stop(loop, &ctx->ctrl_io);
+        close(ctx->sockfd);
+        ctx->sockfd = -1;
+        try_connect(ctx);
+        break;
+    case RTSP_KEEPALIVE:
+        LOG_ERROR("Failed to send GET_PARAMETER request");
+        ctx->awaiting = 0;
+        rtsp_stop_stream(ctx);
+        break;
+    case RTSP_TEARDOWN:
+        rtsp_finish(ctx);
+        break;
+    default:
+        LOG_ERROR("RTSP %s request timed out", phase_names[ctx->phase]);
+        if (ctx->pipelined)
+            rtsp_cache_disable_pipeline(ctx->rtsp_url);
+        rtsp_finish(ctx);
+        break;
     }
-    else
+}
+
+static void keepalive_cb(struct ev_loop *loop, struct ev_timer *timer)
+{
+    struct play_ctx *ctx = (struct play_ctx *)timer->data;
+    const char *uri = ctx->last_location[0] ? ctx->last_location : ctx->rtsp_url;
+
+    if (!ctx->awaiting && do_GET_PARAMETER(uri, ctx) < 0)
     {
+        LOG_ERROR("Failed to send GET_PARAMETER request");
+        rtsp_stop_stream(ctx);
+        return;
     }
 
-    if (pthread_create(&th_rtcp, NULL, rtcp_thread, ctx) != 0)
+    loop_timer_start(loop, &ctx->keepalive, RTSP_KEEPALIVE_INTERVAL_MS);
+}
+
+void rtsp_stop_stream(struct play_ctx *ctx)
+{
+    if (ctx->phase == RTSP_DONE || ctx->phase == RTSP_TEARDOWN)
+        return;
+
+    ctx->stop = 1;
+    ctx->play = 0;
+    loop_io_stop(ctx->loop, &ctx->rtp_io);
+    loop_timer_stop(ctx->loop, &ctx->keepalive);
+
+    // 请求发送到一半时无法再插入 TEARDOWN，直接关闭连接
+    if (ctx->session_id[0] && ctx->sockfd >= 0 && ctx->req_sent == ctx->req_len)
     {
-        LOG_ERROR("Failed to create RTCP thread");
-        goto cleanup;
+        set_phase(ctx, RTSP_TEARDOWN);
+        if (do_teardown(ctx->rtsp_url, ctx) == 0)
+            return;
     }
-    else
+
+    rtsp_finish(ctx);
+}
+
+// 组播没有握手：加入组后即可接收，同一个组的所有客户端共享这个 socket 和环形缓冲区
+static void mcast_start(struct play_ctx *ctx)
+{
+    struct mcast_group g;
+    const char *rest;
+
+    if (strncmp(ctx->rtsp_url, "udp://", 6) != 0 || parse_mcast_addr(ctx->rtsp_url + 6, &g, &rest) != 0)
     {
+        LOG_ERROR("Invalid multicast address: %s", ctx->rtsp_url);
+        rtsp_finish(ctx);
+        return;
     }
 
-    if (do_play(rtsp_url, "npt=0.000-", resp, sizeof(resp), ctx) <= 0)
+    // 组播多为不带序号的裸 TS，局域网内也很少乱序，不做重排
+    ctx->reorder_ms = 0;
+    ctx->raw_ts = 1;
+    ctx->rtp_sock = mcast_open(&g, get_server_config()->mcast_if);
+    if (ctx->rtp_sock < 0 || alloc_rtp_buffer(ctx) < 0 ||
+        loop_io_start(ctx->loop, &ctx->rtp_io, ctx->rtp_sock, EPOLLIN) < 0)
     {
-        LOG_ERROR("Failed to do PLAY request, response: %s", resp);
-        goto cleanup;
+        rtsp_finish(ctx);
+        return;
     }
-    else
+
+    LOG_INFO("%s: joined multicast group", ctx->rtsp_url);
+    ctx->play = 1;
+    set_phase(ctx, RTSP_KEEPALIVE);
+    ctx->state = PLAY_PLAYING;
+    ctx->on_state(ctx);
+}
+
+void rtsp_play_stream(struct play_ctx *ctx)
+{
+    const struct server_config *config = get_server_config();
+    struct rtsp_uri uri;
+
+    ctx->loop = loop_current();
+    ctx->sockfd = ctx->rtp_sock = ctx->rtcp_sock = -1;
+    ctx->ctrl_io.fd = ctx->rtp_io.fd = ctx->rtcp_io.fd = -1;
+    ctx->ctrl_io.cb = ctrl_io_cb;
+    ctx->rtp_io.cb = rtp_io_cb;
+    ctx->rtcp_io.cb = rtcp_io_cb;
+    ctx->ctrl_io.data = ctx->rtp_io.data = ctx->rtcp_io.data = ctx;
+    ctx->timer.cb = timer_cb;
+    ctx->keepalive.cb = keepalive_cb;
+    ctx->batch_timer.cb = batch_timer_cb;
+    ctx->reorder_timer.cb = reorder_timer_cb;
+    ctx->probe_timer.cb = probe_timer_cb;
+    ctx->timer.data = ctx->keepalive.data = ctx->batch_timer.data = ctx->reorder_timer.data = ctx;
+    ctx->probe_timer.data = ctx;
+    ctx->seq = 1;
+    ctx->start_ms = loop_now_ms();
+    ctx->phase = RTSP_INIT;
+    ctx->stats.phase_since = ctx->start_ms;
+    ctx->state = PLAY_STARTING;
+
+    ctx->max_rtp_buffer_size = config->max_rtp_buffer_size;
+    ctx->max_udp_packet_size = config->max_udp_packet_size;
+
+    ctx->recv_batch = config->recv_batch;
+    if (ctx->recv_batch < 1)
+        ctx->recv_batch = 1;
+    if (ctx->recv_batch > UIO_MAXIOV)
+        ctx->recv_batch = UIO_MAXIOV;
+    if (ctx->recv_batch > ctx->max_rtp_buffer_size)
+        ctx->recv_batch = ctx->max_rtp_buffer_size;
+    ctx->recv_timeout_ms = config->recv_timeout_ms;
+    ctx->reorder_ms = config->reorder_ms > 0 ? config->reorder_ms : 0;
+    ctx->gop_cache = config->gop_cache;
+    ts_psi_init(&ctx->psi);
+
+    ctx->recv_buf = (uint8_t *)malloc(ctx->max_udp_packet_size);
+    ctx->msgs = (struct mmsghdr *)calloc(ctx->recv_batch, sizeof(struct mmsghdr));
+    ctx->peers = (struct sockaddr_in *)calloc(ctx->recv_batch, sizeof(struct sockaddr_in));
+    ctx->iovs = (struct iovec *)calloc(ctx->recv_batch, sizeof(struct iovec));
+    ctx->ctrls = (char *)calloc(ctx->recv_batch, RTP_CTRL_SIZE);
+    ctx->ts_cc = (uint8_t *)calloc(TS_PID_COUNT, 1);
+    if (ctx->recv_buf == NULL || ctx->msgs == NULL || ctx->peers == NULL || ctx->iovs == NULL || ctx->ctrls == NULL || ctx->ts_cc == NULL)
     {
-        ctx->play = 1;
+        LOG_ERROR("Failed to allocate memory for UDP receive buffer.");
+        rtsp_finish(ctx);
+        return;
     }
 
-    if (pthread_create(&th_get_param, NULL, get_parameter_thread, ctx) != 0)
+    if (ctx->transport == RTSP_TRANSPORT_MULTICAST)
     {
-        LOG_ERROR("Failed to create parameter thread");
-        goto cleanup;
+        mcast_start(ctx);
+        return;
     }
-    else
+
+    if (parse_rtsp_uri(ctx->rtsp_url, &uri) != 0)
     {
+        LOG_ERROR("Invalid RTSP URI");
+        rtsp_finish(ctx);
+        return;
     }
+    snprintf(ctx->host, sizeof(ctx->host), "%s", uri.host);
+    ctx->port = uri.port;
 
-    pthread_join(th_rtp, NULL);
+    // 交错模式不需要 STUN 和 UDP 端口
+    if (ctx->transport == RTSP_TRANSPORT_TCP)
+    {
+        ctx->interleaved = 1;
+        start_connect(ctx);
+        return;
+    }
 
-    pthread_join(th_rtcp, NULL);
+    ctx->ports = portpool_get();
+    if (ctx->ports == NULL)
+    {
+        rtsp_finish(ctx);
+        return;
+    }
+    ctx->rtp_port = ctx->ports->port;
+    ctx->setup_rtp_port = ctx->rtp_port;
+    ctx->rtp_sock = ctx->ports->rtp_sock;
+    ctx->rtcp_sock = ctx->ports->rtcp_sock;
 
-    pthread_join(th_get_param, NULL);
+    if (loop_io_start(ctx->loop, &ctx->rtp_io, ctx->rtp_sock, EPOLLIN) < 0 ||
+        loop_io_start(ctx->loop, &ctx->rtcp_io, ctx->rtcp_sock, EPOLLIN) < 0)
+    {
+        rtsp_finish(ctx);
+        return;
+    }
 
-    do_teardown(rtsp_url, resp, sizeof(resp), ctx);
+    if (config->enable_nat)
+    {
+        stun_start(ctx);
+        return;
+    }
 
-cleanup:
-    close(ctx->sockfd);
-    rtp_close(ctx->rtp_sock);
-    rtcp_close(ctx->rtcp_sock);
-    free_rtp_buffer(ctx->rtp_buf);
-    free(ctx);
+    start_connect(ctx);
 }
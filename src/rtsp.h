@@ -3,7 +3,60 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <netdb.h>
+#include <pthread.h>
 #include "rtp.h"
+#include "reorder.h"
+#include "ts.h"
+#include "resolve.h"
+#include "stun.h"
+#include "portpool.h"
+#include "loop.h"
+
+struct mmsghdr;
+struct iovec;
+
+enum play_state
+{
+    PLAY_STARTING = 0,
+    PLAY_PLAYING,
+    PLAY_CLOSED,
+};
+
+// RTSP 握手状态机
+enum rtsp_phase
+{
+    RTSP_INIT = 0,
+    RTSP_STUN,
+    RTSP_CONNECTING,
+    RTSP_OPTIONS,
+    RTSP_DESCRIBE,
+    RTSP_SETUP,
+    RTSP_PLAY,
+    RTSP_KEEPALIVE,
+    RTSP_TEARDOWN,
+    RTSP_DONE,
+};
+
+// UDP 失败（STUN 超时、SETUP 被拒、PLAY 后收不到包）时自动改用 RTSP 连接内的交错 TCP
+enum rtsp_transport
+{
+    RTSP_TRANSPORT_AUTO = 0,
+    RTSP_TRANSPORT_TCP,
+    RTSP_TRANSPORT_MULTICAST,     // 不走 RTSP，直接加入组播组，rtsp_url 为 udp://[source@]group:port
+};
+
+struct play_ctx;
+
+// 同时查询的 STUN 服务器之一
+struct stun_target
+{
+    struct play_ctx *ctx;
+    struct resolve_req *dns_req;
+    struct sockaddr_in addr;
+    int ready;                    // 地址已解析，参与请求
+};
+
 struct play_ctx
 {
     struct rtp_buffer *rtp_buf;
@@ -18,12 +71,99 @@ struct play_ctx
     struct sockaddr_in rtp_server;
     struct sockaddr_in rtcp_server;
     uint32_t ssrc;
-    int http_sock;
     const char *rtsp_url;
     int max_rtp_buffer_size;
     int max_udp_packet_size;
+
+    struct ev_loop *loop;         // 会话所属的工作线程
+    struct ev_io ctrl_io;
+    struct ev_io rtp_io;
+    struct ev_io rtcp_io;
+    struct ev_timer timer;        // 请求超时 / STUN 重传
+    struct ev_timer keepalive;
+
+    _Atomic enum play_state state;
+    enum rtsp_phase phase;
+    uint8_t *recv_buf;
+
+    struct mmsghdr *msgs;         // recvmmsg 批量接收，直接指向环形缓冲区槽位
+    struct sockaddr_in *peers;    // 每个包的来源地址，只收 rtp_server 发来的包
+    struct iovec *iovs;
+    char *ctrls;                  // 每个包的控制消息缓冲区，接收内核时间戳
+    int recv_batch;
+    int recv_timeout_ms;
+    struct ev_timer batch_timer;  // 批次未满时推迟下一次读取
+    uint64_t recv_calls;
+    uint64_t recv_packets;
+    struct session_stats stats;   // 供 /metrics 读取
+
+    enum rtsp_transport transport;
+    int interleaved;              // RTP/RTCP 以 $ 帧的形式在控制连接上传输
+    int torn_down;                // 上游已确认 TEARDOWN，不会再往端口对发送
+    int ingest_paused;            // 交错模式下缓冲区满，暂停读取控制连接
+    size_t ilv_skip;              // 待丢弃的超长交错帧剩余字节
+    struct ev_timer probe_timer;  // PLAY 后检查 UDP 是否收到数据
+    int raw_ts;                   // 接受不带 RTP 头的 TS（组播常见）
+
+    int reorder_ms;               // 0 表示按到达顺序转发
+    struct rtp_reorder reorder;
+    struct ev_timer reorder_timer;
+
+    uint64_t scanned;             // 已做过 TS 检查和关键帧扫描的槽位
+    uint8_t *ts_cc;               // 逐 PID 的连续计数状态，TS_PID_COUNT 字节
+    int gop_cache;                // 记住最近的随机访问点，新客户端从这里开始
+    struct ts_psi psi;
+    uint64_t last_pat;            // 最近一个含 PAT 的槽位
+    int pat_seen;
+    int gop_valid;                // gop_valid/gop_start 受 lock 保护
+    uint64_t gop_start;           // 关键帧前的 PAT 所在槽位，相当于一个不读数据的客户端
+    _Atomic uint64_t last_rap;    // 最近的随机访问点槽位 + 1，0 表示还没有
+    _Atomic int rap_readers;      // 按 skip 策略处理落后的客户端数，不为 0 时即使没开关键帧缓存也要扫描
+    _Atomic int lossy_readers;    // 落后时不阻塞上游的客户端数
+    _Atomic uint64_t lag_floor;   // 有客户端因落后被放弃时公布：此前的槽位可能已被覆盖，之后的在下次公布前不会
+    uint64_t lag_limit;           // 客户端落后超过这么多槽位时按策略处理
+
+    char host[256];
+    int port;
+    struct port_pair *ports;      // 从端口池取得的 RTP/RTCP socket
+    int rtp_port;
+    int setup_rtp_port;
+    struct resolve_result addrs;
+    int next_addr;
+    struct resolve_req *dns_req;  // 正在进行的异步解析
+
+    int stun_tries;
+    unsigned char stun_tid[12];
+    unsigned char stun_req[STUN_REQUEST_SIZE]; // 重传时沿用同一个事务 ID
+    struct stun_target stun_targets[STUN_MAX_SERVERS];
+    int stun_ntargets;
+    int stun_resolving;           // 仍在解析的服务器数
+    int stun_predicted;           // 按学到的 NAT 行为跳过了 STUN
+
+    char req[4096];
+    size_t req_len;
+    size_t req_sent;
+    int awaiting;                 // 已发送、尚未收到响应的请求数
+    int pipelined;                // DESCRIBE 已随 OPTIONS 一起发出
+    int handshake_cached;         // 跳过了 OPTIONS/DESCRIBE，直接从 SETUP 开始
+    char public_methods[256];     // OPTIONS 响应的 Public 头
+    uint64_t start_ms;            // 会话开始时间，用于统计起播耗时
+    int first_packet;             // 是否已记录首包耗时
+    char resp[8192];
+    size_t resp_len;
+
+    pthread_mutex_t lock;         // 保护 readers，客户端可能在其他工作线程
+    struct rtp_reader *readers;   // 共享同一上游的 HTTP 客户端
+    _Atomic int nwaiting;         // 已读空并等待唤醒的客户端数
+    _Atomic int stalled;          // 缓冲区满，暂停读取 RTP
+    int wake_fd;                  // 满 -> 非满时由客户端唤醒生产者
+    void (*on_state)(struct play_ctx *ctx);
+    void *opaque;
 };
 
-void rtsp_play_stream(const char *rtsp_url, int http_fd);
+void rtsp_play_stream(struct play_ctx *ctx);
+void rtsp_stop_stream(struct play_ctx *ctx);
+void rtsp_resume_ingest(struct play_ctx *ctx);
+const char *rtsp_phase_name(enum rtsp_phase phase);
 
-#endif
\ No newline at end of file
+#endif
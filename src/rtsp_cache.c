@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "rtsp_cache.h"
+#include "config.h"
+#include "loop.h"
+
+struct cache_slot
+{
+    char url[512];
+    struct rtsp_cache_entry entry;
+    int described;
+    uint64_t expires;
+    uint64_t used; // 最近使用时间，满了以后替换最久未用的
+};
+
+static pthread_mutex_t g_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct cache_slot g_cache[RTSP_CACHE_MAX];
+
+static struct cache_slot *find_locked(const char *url)
+{
+    for (int i = 0; i < RTSP_CACHE_MAX; i++)
+    {
+        if (g_cache[i].url[0] && strcmp(g_cache[i].url, url) == 0)
+            return &g_cache[i];
+    }
+    return NULL;
+}
+
+static struct cache_slot *find_or_add_locked(const char *url)
+{
+    struct cache_slot *slot = find_locked(url);
+    if (slot)
+        return slot;
+
+    slot = &g_cache[0];
+    for (int i = 0; i < RTSP_CACHE_MAX; i++)
+    {
+        if (g_cache[i].url[0] == '\0')
+        {
+            slot = &g_cache[i];
+            break;
+        }
+        if (g_cache[i].used < slot->used)
+            slot = &g_cache[i];
+    }
+
+    memset(slot, 0, sizeof(*slot));
+    snprintf(slot->url, sizeof(slot->url), "%s", url);
+    return slot;
+}
+
+int rtsp_cache_lookup(const char *url, struct rtsp_cache_entry *out)
+{
+    int hit = 0;
+
+    pthread_mutex_lock(&g_cache_lock);
+    struct cache_slot *slot = find_locked(url);
+    if (slot && slot->described && loop_now_ms() < slot->expires)
+    {
+        *out = slot->entry;
+        slot->used = loop_now_ms();
+        hit = 1;
+    }
+    pthread_mutex_unlock(&g_cache_lock);
+
+    return hit;
+}
+
+void rtsp_cache_store(const char *url, const char *public_methods, const char *content_base)
+{
+    int ttl = get_server_config()->handshake_ttl_ms;
+    if (ttl <= 0)
+        return;
+
+    pthread_mutex_lock(&g_cache_lock);
+    struct cache_slot *slot = find_or_add_locked(url);
+    snprintf(slot->entry.public_methods, sizeof(slot->entry.public_methods), "%s", public_methods);
+    snprintf(slot->entry.content_base, sizeof(slot->entry.content_base), "%s", content_base);
+    slot->described = 1;
+    slot->used = loop_now_ms();
+    slot->expires = slot->used + ttl;
+    pthread_mutex_unlock(&g_cache_lock);
+}
+
+void rtsp_cache_invalidate(const char *url)
+{
+    pthread_mutex_lock(&g_cache_lock);
+    struct cache_slot *slot = find_locked(url);
+    if (slot)
+        slot->described = 0;
+    pthread_mutex_unlock(&g_cache_lock);
+}
+
+int rtsp_cache_pipeline_allowed(const char *url)
+{
+    int allowed = 1;
+
+    pthread_mutex_lock(&g_cache_lock);
+    struct cache_slot *slot = find_locked(url);
+    if (slot && slot->entry.no_pipeline)
+        allowed = 0;
+    pthread_mutex_unlock(&g_cache_lock);
+
+    return allowed;
+}
+
+void rtsp_cache_disable_pipeline(const char *url)
+{
+    pthread_mutex_lock(&g_cache_lock);
+    struct cache_slot *slot = find_or_add_locked(url);
+    slot->entry.no_pipeline = 1;
+    slot->used = loop_now_ms();
+    pthread_mutex_unlock(&g_cache_lock);
+}
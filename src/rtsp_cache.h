@@ -0,0 +1,23 @@
+#ifndef RTSP_CACHE_H
+#define RTSP_CACHE_H
+
+#define RTSP_CACHE_MAX 64
+
+// 按上游地址缓存 OPTIONS 和 DESCRIBE 的结果，缓存有效时新会话可以直接从 SETUP 开始
+struct rtsp_cache_entry
+{
+    char public_methods[256]; // OPTIONS 响应的 Public 头
+    char content_base[512];   // DESCRIBE 响应的 Content-Base / Content-Location
+    int no_pipeline;          // 服务器不接受流水线请求
+};
+
+// 返回 1 表示有未过期的 DESCRIBE 结果
+int rtsp_cache_lookup(const char *url, struct rtsp_cache_entry *out);
+void rtsp_cache_store(const char *url, const char *public_methods, const char *content_base);
+// SETUP 被拒等情况下缓存的结果可能已失效
+void rtsp_cache_invalidate(const char *url);
+
+int rtsp_cache_pipeline_allowed(const char *url);
+void rtsp_cache_disable_pipeline(const char *url);
+
+#endif
@@ -0,0 +1,501 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include "session.h"
+#include "rtp.h"
+#include "metrics.h"
+#include "logs.h"
+
+#define SESSION_FREE_RETRY_MS 100
+
+static pthread_mutex_t g_sessions_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct stream_session *g_sessions = NULL;
+static struct stream_session *g_all_sessions = NULL;
+
+static void session_unlink_locked(struct stream_session *s)
+{
+    if (!s->linked)
+        return;
+
+    for (struct stream_session **pp = &g_sessions; *pp; pp = &(*pp)->next)
+    {
+        if (*pp == s)
+        {
+            *pp = s->next;
+            break;
+        }
+    }
+    s->linked = 0;
+}
+
+static void session_free(struct ev_loop *loop, void *arg)
+{
+    struct stream_session *s = (struct stream_session *)arg;
+
+    loop_io_stop(loop, &s->wake_io);
+    loop_timer_stop(loop, &s->linger_timer);
+    close(s->ctx.wake_fd);
+
+    pthread_mutex_lock(&g_sessions_lock);
+    for (struct stream_session **pp = &g_all_sessions; *pp; pp = &(*pp)->all_next)
+    {
+        if (*pp == s)
+        {
+            *pp = s->all_next;
+            break;
+        }
+    }
+    metrics_session_retire(&s->ctx.stats);
+    pthread_mutex_unlock(&g_sessions_lock);
+
+    free_rtp_buffer(s->ctx.rtp_buf);
+    pthread_mutex_destroy(&s->ctx.lock);
+    free(s);
+}
+
+static void session_free_task(struct ev_loop *loop, void *arg)
+{
+    struct stream_session *s = (struct stream_session *)arg;
+
+    // 当前这一轮事件中可能还有指向 ctx 的 io，延后释放
+    if (loop_defer(loop, session_free, s) < 0)
+    {
+        LOG_ERROR("Failed to defer release of session %s, retrying", s->rtsp_url);
+        loop_timer_start(loop, &s->free_retry, SESSION_FREE_RETRY_MS);
+    }
+}
+
+// 上游的 io 只属于所属线程，释放也要回到那里。投递失败（内存不足）时在当前线程上稍后重试，
+// 引用已经归零，计时器不会再被别人用到
+static void session_post_free(struct stream_session *s)
+{
+    if (loop_post(s->ctx.loop, session_free_task, s) == 0)
+        return;
+    LOG_ERROR("Failed to post release of session %s, retrying", s->rtsp_url);
+    loop_timer_start(loop_current(), &s->free_retry, SESSION_FREE_RETRY_MS);
+}
+
+static void session_free_retry_cb(struct ev_loop *loop, struct ev_timer *timer)
+{
+    session_post_free((struct stream_session *)timer->data);
+}
+
+static void session_unref(struct stream_session *s)
+{
+    if (atomic_fetch_sub(&s->refs, 1) == 1)
+        session_post_free(s);
+}
+
+static void session_stop_task(struct ev_loop *loop, void *arg)
+{
+    struct stream_session *s = (struct stream_session *)arg;
+
+    rtsp_stop_stream(&s->ctx);
+    session_unref(s);
+}
+
+// 空闲会话超过数量或内存上限时，返回最久未用的一个
+static struct stream_session *session_pick_idle_locked(void)
+{
+    const struct server_config *config = get_server_config();
+    struct stream_session *oldest = NULL;
+    size_t bytes = 0;
+    int idle = 0;
+
+    for (struct stream_session *s = g_sessions; s; s = s->next)
+    {
+        if (!s->idle)
+            continue;
+        idle++;
+        bytes += s->idle_bytes;
+        if (oldest == NULL || s->idle_since < oldest->idle_since)
+            oldest = s;
+    }
+
+    if (idle > config->linger_max || bytes > (size_t)config->linger_mb << 20)
+        return oldest;
+    return NULL;
+}
+
+static void session_evict_idle(void)
+{
+    while (1)
+    {
+        pthread_mutex_lock(&g_sessions_lock);
+        struct stream_session *s = session_pick_idle_locked();
+        if (s)
+        {
+            session_unlink_locked(s);
+            s->idle = 0;
+            atomic_fetch_add(&s->refs, 1);
+        }
+        pthread_mutex_unlock(&g_sessions_lock);
+
+        if (s == NULL)
+            break;
+
+        LOG_INFO("Evicting idle upstream: %s", s->rtsp_url);
+        if (loop_post(s->ctx.loop, session_stop_task, s) < 0)
+            session_unref(s);
+    }
+}
+
+static void session_linger_cb(struct ev_loop *loop, struct ev_timer *timer)
+{
+    struct stream_session *s = (struct stream_session *)timer->data;
+    int expired = 0;
+
+    // 期间可能有客户端重新挂载又离开，以最后一次空闲的时间为准
+    pthread_mutex_lock(&g_sessions_lock);
+    if (s->idle && s->linked && loop_now_ms() - s->idle_since >= (uint64_t)get_server_config()->linger_ms)
+    {
+        session_unlink_locked(s);
+        s->idle = 0;
+        expired = 1;
+    }
+    pthread_mutex_unlock(&g_sessions_lock);
+
+    if (expired)
+    {
+        LOG_INFO("Idle upstream expired: %s", s->rtsp_url);
+        rtsp_stop_stream(&s->ctx);
+    }
+}
+
+// 定时器只能在上游所属的线程中操作
+static void session_linger_task(struct ev_loop *loop, void *arg)
+{
+    struct stream_session *s = (struct stream_session *)arg;
+
+    if (!s->ctx.stop)
+        loop_timer_start(loop, &s->linger_timer, get_server_config()->linger_ms);
+    session_unref(s);
+}
+
+// 在客户端所在的工作线程中执行
+static void reader_detach(struct rtp_reader *reader)
+{
+    struct play_ctx *ctx = reader->ctx;
+    struct stream_session *s = (struct stream_session *)ctx->opaque;
+    int stop_upstream = 0;
+    int linger = 0;
+
+    pthread_mutex_lock(&g_sessions_lock);
+    pthread_mutex_lock(&ctx->lock);
+    for (struct rtp_reader **pp = &ctx->readers; *pp; pp = &(*pp)->next)
+    {
+        if (*pp == reader)
+        {
+            *pp = reader->next;
+            break;
+        }
+    }
+    if (atomic_exchange(&reader->waiting, 0))
+        atomic_fetch_sub(&ctx->nwaiting, 1);
+    if (reader->lag_policy != RTP_LAG_BLOCK)
+        atomic_fetch_sub(&ctx->lossy_readers, 1);
+    if (reader->lag_policy == RTP_LAG_SKIP)
+        atomic_fetch_sub(&ctx->rap_readers, 1);
+    metrics_reader_retire(&ctx->stats, reader);
+
+    // 最后一个客户端离开后关闭上游，新的请求会重新建立会话；设置了保留时间时先保留上游，
+    // 期间请求同一地址的客户端直接挂载，不用重新握手
+    if (ctx->readers == NULL && s->linked)
+    {
+        if (get_server_config()->linger_ms > 0 && ctx->state != PLAY_CLOSED)
+        {
+            s->idle = 1;
+            s->idle_since = loop_now_ms();
+            s->idle_bytes = ctx->rtp_buf ? ctx->rtp_buf->slab_size : 0;
+            linger = 1;
+        }
+        else
+        {
+            session_unlink_locked(s);
+            stop_upstream = 1;
+        }
+    }
+    pthread_mutex_unlock(&ctx->lock);
+    pthread_mutex_unlock(&g_sessions_lock);
+
+    // 生产者可能正在等这个客户端腾出空位
+    if (atomic_load(&ctx->stalled) && atomic_exchange(&ctx->stalled, 0))
+    {
+        uint64_t one = 1;
+        write(ctx->wake_fd, &one, sizeof(one));
+    }
+
+    loop_timer_stop(reader->loop, &reader->flush_timer);
+    loop_io_stop(reader->loop, &reader->io);
+    loop_io_stop(reader->loop, &reader->wake_io);
+    close(reader->wake_fd);
+    reader->on_close(reader);
+
+    if (stop_upstream)
+    {
+        atomic_fetch_add(&s->refs, 1);
+        if (loop_post(ctx->loop, session_stop_task, s) < 0)
+            session_unref(s);
+    }
+
+    if (linger)
+    {
+        atomic_fetch_add(&s->refs, 1);
+        if (loop_post(ctx->loop, session_linger_task, s) < 0)
+            session_unref(s);
+        session_evict_idle();
+    }
+
+    session_unref(s);
+}
+
+static void reader_run(struct rtp_reader *reader)
+{
+    enum play_state state = reader->ctx->state;
+
+    if (state == PLAY_CLOSED)
+        reader->stop = 1;
+
+    if (!reader->stop && state == PLAY_PLAYING)
+    {
+        if (!reader->header_sent)
+        {
+            send_http_response(reader->http_sock);
+            reader->header_sent = 1;
+        }
+        if (atomic_load_explicit(&reader->lagging, memory_order_relaxed))
+            rtp_reader_lag(reader);
+        if (!reader->stop && !(reader->io.events & EPOLLOUT))
+            rtp_reader_flush(reader);
+    }
+
+    if (reader->stop)
+        reader_detach(reader);
+}
+
+static void reader_io_cb(struct ev_loop *loop, struct ev_io *io, uint32_t events)
+{
+    struct rtp_reader *reader = (struct rtp_reader *)io->data;
+
+    int completed = 0;
+
+    // 零拷贝完成通知通过错误队列送达，同样以 EPOLLERR 的形式出现
+    if (reader->zerocopy && (events & EPOLLERR))
+    {
+        events &= ~EPOLLERR;
+        if (rtp_reader_complete(reader) < 0)
+            reader->stop = 1;
+        completed = reader->header_sent && !(io->events & EPOLLOUT);
+    }
+
+    if (events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP))
+        reader->stop = 1;
+
+    if (!reader->stop && (events & EPOLLIN))
+    {
+        char buf[512];
+        ssize_t n = recv(io->fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+            reader->stop = 1;
+    }
+
+    if (!reader->stop && ((events & EPOLLOUT) || completed))
+        rtp_reader_flush(reader);
+
+    if (reader->stop)
+        reader_detach(reader);
+}
+
+static void reader_flush_cb(struct ev_loop *loop, struct ev_timer *timer)
+{
+    reader_run((struct rtp_reader *)timer->data);
+}
+
+static void reader_wake_cb(struct ev_loop *loop, struct ev_io *io, uint32_t events)
+{
+    struct rtp_reader *reader = (struct rtp_reader *)io->data;
+    uint64_t v;
+
+    while (read(io->fd, &v, sizeof(v)) > 0)
+        ;
+
+    reader_run(reader);
+}
+
+static void session_wake_cb(struct ev_loop *loop, struct ev_io *io, uint32_t events)
+{
+    struct stream_session *s = (struct stream_session *)io->data;
+    uint64_t v;
+
+    while (read(io->fd, &v, sizeof(v)) > 0)
+        ;
+
+    rtsp_resume_ingest(&s->ctx);
+}
+
+static void on_play_state(struct play_ctx *ctx)
+{
+    struct stream_session *s = (struct stream_session *)ctx->opaque;
+
+    if (ctx->state == PLAY_CLOSED)
+    {
+        LOG_INFO("Upstream closed: %s", s->rtsp_url);
+
+        pthread_mutex_lock(&g_sessions_lock);
+        session_unlink_locked(s);
+        pthread_mutex_unlock(&g_sessions_lock);
+    }
+
+    // 客户端在各自的线程中处理状态变化
+    rtp_wake_readers(ctx);
+
+    if (ctx->state == PLAY_CLOSED)
+        session_unref(s);
+}
+
+static struct stream_session *session_create_locked(const char *rtsp_url, enum rtsp_transport transport)
+{
+    struct stream_session *s = NULL;
+    if (posix_memalign((void **)&s, CACHE_LINE_SIZE, sizeof(struct stream_session)) != 0)
+    {
+        LOG_ERROR("Failed to allocate memory for stream_session.");
+        return NULL;
+    }
+    memset(s, 0, sizeof(*s));
+
+    s->ctx.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    s->wake_io.cb = session_wake_cb;
+    s->wake_io.data = s;
+    if (s->ctx.wake_fd < 0 || loop_io_start(loop_current(), &s->wake_io, s->ctx.wake_fd, EPOLLIN) < 0)
+    {
+        LOG_ERROR("Failed to create session eventfd");
+        if (s->ctx.wake_fd >= 0)
+            close(s->ctx.wake_fd);
+        free(s);
+        return NULL;
+    }
+
+    snprintf(s->rtsp_url, sizeof(s->rtsp_url), "%s", rtsp_url);
+    s->ctx.rtsp_url = s->rtsp_url;
+    s->ctx.transport = transport;
+    s->ctx.loop = loop_current();
+    s->ctx.on_state = on_play_state;
+    s->ctx.opaque = s;
+    s->linger_timer.cb = session_linger_cb;
+    s->linger_timer.data = s;
+    s->free_retry.cb = session_free_retry_cb;
+    s->free_retry.data = s;
+    pthread_mutex_init(&s->ctx.lock, NULL);
+    atomic_init(&s->refs, 1);
+
+    s->linked = 1;
+    s->next = g_sessions;
+    g_sessions = s;
+    s->all_next = g_all_sessions;
+    g_all_sessions = s;
+    metrics_session_opened();
+
+    return s;
+}
+
+void session_foreach(void (*fn)(struct stream_session *s, void *arg), void *arg)
+{
+    pthread_mutex_lock(&g_sessions_lock);
+    for (struct stream_session *s = g_all_sessions; s; s = s->all_next)
+        fn(s, arg);
+    pthread_mutex_unlock(&g_sessions_lock);
+}
+
+void session_attach(struct rtp_reader *reader, const char *rtsp_url, enum rtsp_transport transport)
+{
+    struct ev_loop *loop = loop_current();
+    int created = 0;
+
+    reader->loop = loop;
+    reader->sent = 0;
+    reader->header_sent = 0;
+    // 零拷贝的槽位要等客户端确认收到才能交还，落后时不阻塞上游的客户端只用普通发送
+    if (get_server_config()->zerocopy && reader->lag_policy == RTP_LAG_BLOCK)
+        rtp_reader_enable_zerocopy(reader);
+    reader->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (reader->wake_fd < 0)
+    {
+        LOG_ERROR("Failed to create reader eventfd");
+        loop_io_stop(loop, &reader->io);
+        reader->on_close(reader);
+        return;
+    }
+
+    pthread_mutex_lock(&g_sessions_lock);
+
+    struct stream_session *s;
+    for (s = g_sessions; s; s = s->next)
+    {
+        if (strcmp(s->rtsp_url, rtsp_url) == 0)
+            break;
+    }
+
+    if (s == NULL)
+    {
+        s = session_create_locked(rtsp_url, transport);
+        created = 1;
+    }
+    else if (s->idle)
+    {
+        // 保留中的上游，定时器到期时看到 idle 已清除就不会关闭它
+        s->idle = 0;
+        LOG_INFO("Reusing idle upstream: %s", s->rtsp_url);
+    }
+
+    if (s)
+    {
+        atomic_fetch_add(&s->refs, 1);
+        metrics_client_opened();
+
+        pthread_mutex_lock(&s->ctx.lock);
+        reader->ctx = &s->ctx;
+        atomic_init(&reader->waiting, 0);
+        atomic_init(&reader->tail, rtp_reader_start(&s->ctx));
+        reader->send_pos = atomic_load(&reader->tail);
+        reader->next = s->ctx.readers;
+        s->ctx.readers = reader;
+        if (reader->lag_policy != RTP_LAG_BLOCK)
+            atomic_fetch_add(&s->ctx.lossy_readers, 1);
+        if (reader->lag_policy == RTP_LAG_SKIP)
+            atomic_fetch_add(&s->ctx.rap_readers, 1);
+        pthread_mutex_unlock(&s->ctx.lock);
+    }
+
+    pthread_mutex_unlock(&g_sessions_lock);
+
+    if (s == NULL)
+    {
+        close(reader->wake_fd);
+        loop_io_stop(loop, &reader->io);
+        reader->on_close(reader);
+        return;
+    }
+
+    reader->io.cb = reader_io_cb;
+    reader->io.data = reader;
+    reader->wake_io.cb = reader_wake_cb;
+    reader->wake_io.data = reader;
+    reader->flush_timer.cb = reader_flush_cb;
+    reader->flush_timer.data = reader;
+    loop_io_modify(loop, &reader->io, RTP_READER_EVENTS);
+    if (loop_io_start(loop, &reader->wake_io, reader->wake_fd, EPOLLIN) < 0)
+        reader->stop = 1;
+
+    if (created)
+    {
+        LOG_INFO("Upstream opened: %s", s->rtsp_url);
+        rtsp_play_stream(&s->ctx);
+    }
+
+    reader_run(reader);
+}
@@ -0,0 +1,29 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stdatomic.h>
+#include "rtsp.h"
+
+// 同一 RTSP 地址的所有 HTTP 客户端共享一个上游会话，传输方式由创建会话的请求决定。上游的 socket 都在创建会话的工作线程中处理，
+// 客户端留在各自接入的工作线程，通过无锁环形缓冲区读取数据
+struct stream_session
+{
+    char rtsp_url[512];
+    struct play_ctx ctx;
+    struct ev_io wake_io;
+    _Atomic int refs;           // 已挂载的客户端数 + 上游本身 + 未执行的投递任务
+    int linked;                 // 是否仍在注册表中，受注册表锁保护
+    int idle;                   // 没有客户端但上游仍在保留，以下三项受注册表锁保护
+    uint64_t idle_since;
+    size_t idle_bytes;          // 保留期间占用的环形缓冲区大小
+    struct ev_timer linger_timer;
+    struct ev_timer free_retry;  // 释放任务投递失败时稍后重试
+    struct stream_session *next;
+    struct stream_session *all_next; // 所有未释放的会话，包括已移出注册表的
+};
+
+void session_attach(struct rtp_reader *reader, const char *rtsp_url, enum rtsp_transport transport);
+// 持有注册表锁遍历所有未释放的会话，用于统计
+void session_foreach(void (*fn)(struct stream_session *s, void *arg), void *arg);
+
+#endif
@@ -11,14 +11,23 @@
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <time.h>
+#include <pthread.h>
+#include "loop.h"
+#include "logs.h"
+#include "parse.h"
 
 #define STUN_MSG_BINDING_REQUEST 0x0001
 #define STUN_ATTR_XOR_MAPPED_ADDR 0x0020
 #define STUN_ATTR_MAPPED_ADDR 0x0001
 #define STUN_MAGIC_COOKIE 0x2112A442
+#define STUN_DEFAULT_PORT 3478
+#define STUN_PREDICT_AFTER 3
+#define STUN_PREDICT_TTL_MS 600000
 
-const char *stun_host = "stun.l.google.com";
-int stun_port = 19302;
+// 端口保持型 NAT 的观察结果，所有会话共享
+static pthread_mutex_t g_nat_lock = PTHREAD_MUTEX_INITIALIZER;
+static int g_nat_preserved;      // 连续观察到端口不变的次数
+static uint64_t g_nat_learned_at;
 
 static void gen_tid(unsigned char tid[12])
 {
@@ -28,137 +37,149 @@ static void gen_tid(unsigned char tid[12])
         tid[i] = rand() & 0xFF;
 }
 
-static void put16(unsigned char *p, uint16_t v) { *(uint16_t *)p = htons(v); }
-static void put32(unsigned char *p, uint32_t v) { *(uint32_t *)p = htonl(v); }
-
-int stun_get_mapping(int s, char *out_pub_ip, int *out_pub_port)
+int stun_parse_servers(const char *list, struct stun_server *out, int max)
 {
-    if (s < 0)
-        return -1;
+    int n = 0;
+    const char *p = list;
 
-    int rv = -1;
-    struct addrinfo hints, *res = NULL;
-    char sport[16];
-    snprintf(sport, sizeof(sport), "%d", stun_port);
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_family = AF_INET;
-    hints.ai_socktype = SOCK_DGRAM;
+    while (p && *p && n < max)
+    {
+        const char *end = strchr(p, ',');
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+        char item[256];
+        if (len > 0 && len < sizeof(item))
+        {
+            memcpy(item, p, len);
+            item[len] = '\0';
+            char *colon = strrchr(item, ':');
+            out[n].port = STUN_DEFAULT_PORT;
+            if (colon)
+            {
+                *colon = '\0';
+                out[n].port = atoi(colon + 1);
+            }
+            if (item[0] && out[n].port > 0 && out[n].port < 65536)
+            {
+                snprintf(out[n].host, sizeof(out[n].host), "%s", item);
+                n++;
+            }
+        }
+        p = end ? end + 1 : NULL;
+    }
 
-    if (getaddrinfo(stun_host, sport, &hints, &res) != 0)
-        return -1;
-    struct sockaddr_in stun_addr = *(struct sockaddr_in *)res->ai_addr;
+    return n;
+}
 
-    unsigned char tid[12];
+void stun_build_request(unsigned char req[STUN_REQUEST_SIZE], unsigned char tid[12])
+{
     gen_tid(tid);
 
-    unsigned char req[20];
-    put16(req + 0, STUN_MSG_BINDING_REQUEST);
-    put16(req + 2, 0); // length 0
-    put32(req + 4, STUN_MAGIC_COOKIE);
+    store_be16(req + 0, STUN_MSG_BINDING_REQUEST);
+    store_be16(req + 2, 0); // length 0
+    store_be32(req + 4, STUN_MAGIC_COOKIE);
     memcpy(req + 8, tid, 12);
+}
 
-    int tries = 2;
-    for (int t = 0; t < tries; ++t)
+int stun_parse_response(const unsigned char *rsp, size_t n, const unsigned char tid[12],
+                        char *out_pub_ip, size_t ip_len, int *out_pub_port)
+{
+    if (n < 20)
+        return -1;
+
+    uint16_t msg_len = load_be16(rsp + 2);
+    uint32_t cookie = load_be32(rsp + 4);
+    if (cookie != STUN_MAGIC_COOKIE)
+        return -1;
+    if (memcmp(rsp + 8, tid, 12) != 0)
+        return -1;
+
+    size_t offset = 20;
+    while (offset + 4 <= 20 + (size_t)msg_len && offset + 4 <= n)
     {
-        ssize_t sent = sendto(s, req, sizeof(req), 0,
-                              (struct sockaddr *)&stun_addr, sizeof(stun_addr));
-        if (sent != (ssize_t)sizeof(req))
-            continue;
-
-        fd_set rf;
-        FD_ZERO(&rf);
-        FD_SET(s, &rf);
-        struct timeval tv = {2, 0};
-        int sel = select(s + 1, &rf, NULL, NULL, &tv);
-        if (sel <= 0)
-            continue;
-
-        unsigned char rsp[1500];
-        struct sockaddr_in src;
-        socklen_t sl = sizeof(src);
-        ssize_t n = recvfrom(s, rsp, sizeof(rsp), 0, (struct sockaddr *)&src, &sl);
-        if (n < 20)
-            continue;
-
-        uint16_t msg_len = ntohs(*(uint16_t *)(rsp + 2));
-        uint32_t cookie = ntohl(*(uint32_t *)(rsp + 4));
-        if (cookie != STUN_MAGIC_COOKIE)
-            continue;
-        if (memcmp(rsp + 8, tid, 12) != 0)
-            continue;
-
-        int offset = 20;
-        while (offset + 4 <= 20 + msg_len && offset + 4 <= n)
-        {
-            uint16_t attr_type = ntohs(*(uint16_t *)(rsp + offset));
-            uint16_t attr_len = ntohs(*(uint16_t *)(rsp + offset + 2));
-            int val_off = offset + 4;
-            if (val_off + attr_len > n)
-                break;
+        uint16_t attr_type = load_be16(rsp + offset);
+        uint16_t attr_len = load_be16(rsp + offset + 2);
+        size_t val_off = offset + 4;
+        if (val_off + attr_len > n)
+            break;
 
-            if (attr_type == STUN_ATTR_XOR_MAPPED_ADDR && attr_len >= 8)
+        if (attr_type == STUN_ATTR_XOR_MAPPED_ADDR && attr_len >= 8)
+        {
+            unsigned char family = rsp[val_off + 1];
+            if (family == 0x01)
             {
-                unsigned char family = rsp[val_off + 1];
-                if (family == 0x01)
-                {
-                    uint16_t xport = ntohs(*(uint16_t *)(rsp + val_off + 2));
-                    uint32_t xaddr = ntohl(*(uint32_t *)(rsp + val_off + 4));
-                    uint16_t port = xport ^ (STUN_MAGIC_COOKIE >> 16);
-                    uint32_t ip = xaddr ^ STUN_MAGIC_COOKIE;
-                    struct in_addr ina;
-                    ina.s_addr = htonl(ip);
-                    inet_ntop(AF_INET, &ina, out_pub_ip, 64);
-                    *out_pub_port = port;
-                    rv = 0;
-                    goto done;
-                }
+                uint16_t xport = load_be16(rsp + val_off + 2);
+                uint32_t xaddr = load_be32(rsp + val_off + 4);
+                uint16_t port = xport ^ (STUN_MAGIC_COOKIE >> 16);
+                uint32_t ip = xaddr ^ STUN_MAGIC_COOKIE;
+                struct in_addr ina;
+                ina.s_addr = htonl(ip);
+                inet_ntop(AF_INET, &ina, out_pub_ip, ip_len);
+                *out_pub_port = port;
+                return 0;
             }
-            else if (attr_type == STUN_ATTR_MAPPED_ADDR && attr_len >= 8)
+        }
+        else if (attr_type == STUN_ATTR_MAPPED_ADDR && attr_len >= 8)
+        {
+            unsigned char family = rsp[val_off + 1];
+            if (family == 0x01)
             {
-                unsigned char family = rsp[val_off + 1];
-                if (family == 0x01)
-                {
-                    uint16_t port = ntohs(*(uint16_t *)(rsp + val_off + 2));
-                    uint32_t ip = ntohl(*(uint32_t *)(rsp + val_off + 4));
-                    struct in_addr ina;
-                    ina.s_addr = htonl(ip);
-                    inet_ntop(AF_INET, &ina, out_pub_ip, 64);
-                    *out_pub_port = port;
-                    rv = 0;
-                    goto done;
-                }
+                uint16_t port = load_be16(rsp + val_off + 2);
+                uint32_t ip = load_be32(rsp + val_off + 4);
+                struct in_addr ina;
+                ina.s_addr = htonl(ip);
+                inet_ntop(AF_INET, &ina, out_pub_ip, ip_len);
+                *out_pub_port = port;
+                return 0;
             }
-
-            int adv = 4 + attr_len;
-            if (attr_len % 4)
-                adv += (4 - (attr_len % 4));
-            offset += adv;
         }
+
+        size_t adv = 4 + attr_len;
+        if (attr_len % 4)
+            adv += (4 - (attr_len % 4));
+        offset += adv;
     }
 
-done:
-    if (res)
-        freeaddrinfo(res);
-    return rv;
+    return -1;
 }
 
-int get_wan_port_existing_socket(int sock, char *out_pub_ip, size_t ip_len)
+int stun_predict_port(int local_port, int *public_port)
 {
-    if (sock < 0)
-        return -1;
+    int predictable;
 
-    char ipbuf[64] = {0};
-    int wan_port = 0;
+    pthread_mutex_lock(&g_nat_lock);
+    predictable = g_nat_preserved >= STUN_PREDICT_AFTER && loop_now_ms() - g_nat_learned_at < STUN_PREDICT_TTL_MS;
+    if (!predictable && g_nat_preserved >= STUN_PREDICT_AFTER)
+        g_nat_preserved = 0; // 过期后重新确认一遍
+    pthread_mutex_unlock(&g_nat_lock);
 
-    if (stun_get_mapping(sock, ipbuf, &wan_port) == 0)
+    if (predictable)
+        *public_port = local_port;
+    return predictable;
+}
+
+void stun_observe_mapping(int local_port, int public_port)
+{
+    pthread_mutex_lock(&g_nat_lock);
+    if (public_port == local_port)
     {
-        if (out_pub_ip && ip_len > 0)
+        if (++g_nat_preserved == STUN_PREDICT_AFTER)
         {
-            strncpy(out_pub_ip, ipbuf, ip_len - 1);
-            out_pub_ip[ip_len - 1] = '\0';
+            g_nat_learned_at = loop_now_ms();
+            LOG_INFO("NAT preserves local ports, skipping STUN for new sessions");
         }
-        return wan_port;
     }
+    else
+    {
+        g_nat_preserved = 0;
+    }
+    pthread_mutex_unlock(&g_nat_lock);
+}
 
-    return -1;
-}
\ No newline at end of file
+void stun_prediction_failed(void)
+{
+    pthread_mutex_lock(&g_nat_lock);
+    if (g_nat_preserved >= STUN_PREDICT_AFTER)
+        LOG_WARN("Predicted NAT mapping did not work, using STUN again");
+    g_nat_preserved = 0;
+    pthread_mutex_unlock(&g_nat_lock);
+}
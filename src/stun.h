@@ -1,6 +1,28 @@
 #ifndef STUN_H
 #define STUN_H
 
-int get_wan_port_existing_socket(int sock, char *out_pub_ip, size_t ip_len);
+#include <stddef.h>
+#include <netinet/in.h>
 
-#endif
\ No newline at end of file
+#define STUN_REQUEST_SIZE 20
+#define STUN_MAX_SERVERS 4
+
+struct stun_server
+{
+    char host[256];
+    int port;
+};
+
+// 解析逗号分隔的 host[:port] 列表，返回服务器个数
+int stun_parse_servers(const char *list, struct stun_server *out, int max);
+
+void stun_build_request(unsigned char req[STUN_REQUEST_SIZE], unsigned char tid[12]);
+int stun_parse_response(const unsigned char *rsp, size_t n, const unsigned char tid[12],
+                        char *out_pub_ip, size_t ip_len, int *out_pub_port);
+
+// 学到的 NAT 行为：连续多次映射都保持本地端口不变时，可以不做 STUN 直接用本地端口作为公网端口
+int stun_predict_port(int local_port, int *public_port);
+void stun_observe_mapping(int local_port, int public_port);
+void stun_prediction_failed(void);
+
+#endif
@@ -0,0 +1,397 @@
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "ts.h"
+
+#define TS_PID_MIN_ES 0x20 // 0x00-0x1F 留给 PSI/SI
+
+// drop= 中可以用名字指定的 DVB 表
+static const struct
+{
+    const char *name;
+    int pid;
+} ts_table_pids[] = {
+    {"null", TS_PID_NULL},
+    {"nit", 0x10},
+    {"sdt", 0x11},
+    {"eit", 0x12},
+    {"tdt", 0x14},
+};
+
+void ts_psi_init(struct ts_psi *psi)
+{
+    psi->pmt_pid = -1;
+    psi->video_pid = -1;
+}
+
+static int is_video_stream(uint8_t stream_type)
+{
+    switch (stream_type)
+    {
+    case 0x01: // MPEG-1
+    case 0x02: // MPEG-2
+    case 0x10: // MPEG-4 Part 2
+    case 0x1B: // H.264
+    case 0x24: // HEVC
+    case 0x42: // AVS
+    case 0xD2: // AVS2
+    case 0xEA: // VC-1
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+// 返回 PSI 节的起始位置和长度，只处理从当前 TS 包开始的节
+static const uint8_t *psi_section(const uint8_t *pkt, const uint8_t *payload, int *section_len)
+{
+    if (!(pkt[1] & 0x40))
+        return NULL;
+
+    const uint8_t *end = pkt + TS_PACKET_SIZE;
+    const uint8_t *p = payload + 1 + payload[0]; // pointer_field
+    if (p + 8 > end)
+        return NULL;
+
+    int len = ((p[1] & 0x0F) << 8) | p[2];
+    if (p + 3 + len > end)
+        len = end - p - 3;
+    *section_len = len;
+    return p;
+}
+
+static void parse_pat(struct ts_psi *psi, const uint8_t *pkt, const uint8_t *payload)
+{
+    int len;
+    const uint8_t *sec = psi_section(pkt, payload, &len);
+    if (sec == NULL || sec[0] != 0x00)
+        return;
+
+    // 取第一个非 0 节目号的 PMT PID
+    for (const uint8_t *p = sec + 8; p + 4 <= sec + 3 + len - 4; p += 4)
+    {
+        int program = (p[0] << 8) | p[1];
+        if (program != 0)
+        {
+            psi->pmt_pid = ((p[2] & 0x1F) << 8) | p[3];
+            return;
+        }
+    }
+}
+
+static void parse_pmt(struct ts_psi *psi, const uint8_t *pkt, const uint8_t *payload)
+{
+    int len;
+    const uint8_t *sec = psi_section(pkt, payload, &len);
+    if (sec == NULL || sec[0] != 0x02 || len < 13)
+        return;
+
+    const uint8_t *end = sec + 3 + len - 4;
+    int info_len = ((sec[10] & 0x0F) << 8) | sec[11];
+    for (const uint8_t *p = sec + 12 + info_len; p + 5 <= end;)
+    {
+        int pid = ((p[1] & 0x1F) << 8) | p[2];
+        int es_info_len = ((p[3] & 0x0F) << 8) | p[4];
+        if (is_video_stream(p[0]))
+        {
+            psi->video_pid = pid;
+            return;
+        }
+        p += 5 + es_info_len;
+    }
+}
+
+static int ts_pid(const uint8_t *pkt)
+{
+    return ((pkt[1] & 0x1F) << 8) | pkt[2];
+}
+
+// 跳过适配域后的负载，没有负载时返回 NULL
+static const uint8_t *ts_payload(const uint8_t *pkt)
+{
+    int afc = (pkt[3] >> 4) & 0x3;
+    const uint8_t *payload = pkt + 4;
+
+    if (afc & 0x2)
+        payload = pkt + 5 + pkt[4];
+    if (!(afc & 0x1) || payload >= pkt + TS_PACKET_SIZE)
+        return NULL;
+    return payload;
+}
+
+int ts_scan(struct ts_psi *psi, const uint8_t *buf, size_t len)
+{
+    int found = 0;
+
+    for (size_t off = 0; off + TS_PACKET_SIZE <= len; off += TS_PACKET_SIZE)
+    {
+        const uint8_t *pkt = buf + off;
+        if (pkt[0] != TS_SYNC_BYTE)
+            break;
+
+        int pid = ts_pid(pkt);
+        const uint8_t *payload = ts_payload(pkt);
+        int rai = (pkt[3] & 0x20) && pkt[4] > 0 && (pkt[5] & 0x40);
+
+        if (pid == TS_PID_PAT)
+        {
+            found |= TS_FOUND_PAT;
+            if (payload)
+                parse_pat(psi, pkt, payload);
+        }
+        else if (pid == psi->pmt_pid)
+        {
+            if (payload)
+                parse_pmt(psi, pkt, payload);
+        }
+        else if (pid == psi->video_pid && rai && (pkt[1] & 0x40))
+        {
+            found |= TS_FOUND_RAP;
+        }
+    }
+
+    return found;
+}
+
+static void pid_set(uint8_t *map, int pid)
+{
+    map[pid >> 3] |= 1 << (pid & 7);
+}
+
+static int pid_test(const uint8_t *map, int pid)
+{
+    return (map[pid >> 3] >> (pid & 7)) & 1;
+}
+
+int ts_filter_init(struct ts_filter *f, int program, const char *drop)
+{
+    memset(f, 0, sizeof(*f));
+    f->program = program;
+    f->pmt_pid = -1;
+    pid_set(f->drop, TS_PID_NULL);
+
+    if (drop == NULL)
+        return 0;
+
+    char list[256];
+    if (strlen(drop) >= sizeof(list))
+        return -1;
+    strcpy(list, drop);
+
+    char *save = NULL;
+    for (char *item = strtok_r(list, ",", &save); item; item = strtok_r(NULL, ",", &save))
+    {
+        int pid = -1;
+        for (size_t i = 0; i < sizeof(ts_table_pids) / sizeof(ts_table_pids[0]); i++)
+        {
+            if (strcasecmp(item, ts_table_pids[i].name) == 0)
+                pid = ts_table_pids[i].pid;
+        }
+        if (pid < 0)
+        {
+            char *end;
+            long v = strtol(item, &end, 0);
+            if (*end != '\0' || end == item || v < 0 || v >= TS_PID_COUNT)
+                return -1;
+            pid = (int)v;
+        }
+        pid_set(f->drop, pid);
+    }
+    return 0;
+}
+
+// MPEG-2 PSI 的 CRC32：多项式 0x04C11DB7，高位在前，不反转
+static uint32_t psi_crc32(const uint8_t *p, size_t len)
+{
+    uint32_t crc = 0xFFFFFFFF;
+
+    while (len--)
+    {
+        crc ^= (uint32_t)*p++ << 24;
+        for (int i = 0; i < 8; i++)
+            crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7 : crc << 1;
+    }
+    return crc;
+}
+
+// PAT 中有选中的节目时，在 out 写出只含该节目的 PAT 并返回 1
+static int filter_pat(struct ts_filter *f, const uint8_t *pkt, const uint8_t *payload, uint8_t *out)
+{
+    int len;
+    const uint8_t *sec = psi_section(pkt, payload, &len);
+    if (sec == NULL || sec[0] != 0x00)
+        return 0;
+
+    int pmt_pid = -1;
+    for (const uint8_t *p = sec + 8; p + 4 <= sec + 3 + len - 4; p += 4)
+    {
+        if (((p[0] << 8) | p[1]) == f->program)
+        {
+            pmt_pid = ((p[2] & 0x1F) << 8) | p[3];
+            break;
+        }
+    }
+    if (pmt_pid < 0)
+        return 0;
+
+    // PMT 换了 PID，等新的 PMT 再放行 ES
+    if (pmt_pid != f->pmt_pid)
+    {
+        f->pmt_pid = pmt_pid;
+        f->pmt_len = 0;
+        memset(f->keep, 0, sizeof(f->keep));
+    }
+
+    memset(out, 0xFF, TS_PACKET_SIZE);
+    out[0] = TS_SYNC_BYTE;
+    out[1] = 0x40; // payload_unit_start，PID 0
+    out[2] = 0x00;
+    out[3] = 0x10 | (pkt[3] & 0x0F); // 只有负载，沿用原包的连续计数
+    out[4] = 0;                      // pointer_field
+
+    uint8_t *s = out + 5;
+    s[0] = 0x00;
+    s[1] = 0xB0;
+    s[2] = 13; // 5 字节表头 + 一个节目 + CRC
+    s[3] = sec[3]; // transport_stream_id
+    s[4] = sec[4];
+    s[5] = sec[5]; // 版本号随原表变化
+    s[6] = 0;
+    s[7] = 0;
+    s[8] = f->program >> 8;
+    s[9] = f->program;
+    s[10] = 0xE0 | (pmt_pid >> 8);
+    s[11] = pmt_pid;
+    uint32_t crc = psi_crc32(s, 12);
+    s[12] = crc >> 24;
+    s[13] = crc >> 16;
+    s[14] = crc >> 8;
+    s[15] = crc;
+    return 1;
+}
+
+// 完整的 PMT 节：校验 CRC 后重新生成要保留的 PID
+static void pmt_parse(struct ts_filter *f, const uint8_t *sec, int total)
+{
+    if (total < 16 || ((sec[3] << 8) | sec[4]) != f->program || psi_crc32(sec, total) != 0)
+        return;
+
+    memset(f->keep, 0, sizeof(f->keep));
+    pid_set(f->keep, ((sec[8] & 0x1F) << 8) | sec[9]); // PCR_PID
+
+    const uint8_t *end = sec + total - 4;
+    int info_len = ((sec[10] & 0x0F) << 8) | sec[11];
+    for (const uint8_t *p = sec + 12 + info_len; p + 5 <= end;)
+    {
+        pid_set(f->keep, ((p[1] & 0x1F) << 8) | p[2]);
+        p += 5 + (((p[3] & 0x0F) << 8) | p[4]);
+    }
+}
+
+static void pmt_append(struct ts_filter *f, const uint8_t *p, size_t n)
+{
+    size_t room = sizeof(f->pmt_sec) - f->pmt_len;
+    if (n > room)
+        n = room;
+    memcpy(f->pmt_sec + f->pmt_len, p, n);
+    f->pmt_len += n;
+}
+
+// 收齐 section_length 后解析，表头不对时放弃这一节
+static void pmt_done(struct ts_filter *f)
+{
+    if (f->pmt_len < 3)
+        return;
+    int total = 3 + (((f->pmt_sec[1] & 0x0F) << 8) | f->pmt_sec[2]);
+    if (f->pmt_sec[0] != 0x02 || total > (int)sizeof(f->pmt_sec))
+    {
+        f->pmt_len = 0;
+        return;
+    }
+    if (f->pmt_len < total)
+        return;
+    pmt_parse(f, f->pmt_sec, total);
+    f->pmt_len = 0;
+}
+
+// 按连续计数把 PMT 节拼起来；中间丢包时丢掉这一节，保留上一次的结果
+static void filter_pmt(struct ts_filter *f, const uint8_t *pkt, const uint8_t *payload)
+{
+    const uint8_t *end = pkt + TS_PACKET_SIZE;
+    int cc = pkt[3] & 0x0F;
+    int next = f->pmt_len > 0 && cc == ((f->pmt_cc + 1) & 0x0F);
+
+    if (f->pmt_len > 0 && cc == f->pmt_cc)
+        return; // 重复包
+
+    if (pkt[1] & 0x40)
+    {
+        const uint8_t *start = payload + 1 + payload[0]; // pointer_field 之前是上一节的结尾
+        if (start >= end)
+        {
+            f->pmt_len = 0;
+            return;
+        }
+        if (next)
+        {
+            pmt_append(f, payload + 1, start - payload - 1);
+            pmt_done(f);
+        }
+        f->pmt_len = 0;
+        pmt_append(f, start, end - start);
+    }
+    else if (next)
+    {
+        pmt_append(f, payload, end - payload);
+    }
+    else
+    {
+        f->pmt_len = 0;
+        return;
+    }
+    f->pmt_cc = cc;
+    pmt_done(f);
+}
+
+size_t ts_filter_apply(struct ts_filter *f, const uint8_t *buf, size_t len, uint8_t *out)
+{
+    size_t n = 0;
+    size_t off = 0;
+
+    for (; off + TS_PACKET_SIZE <= len; off += TS_PACKET_SIZE)
+    {
+        const uint8_t *pkt = buf + off;
+        if (pkt[0] != TS_SYNC_BYTE)
+            break;
+
+        int pid = ts_pid(pkt);
+        if (pid_test(f->drop, pid))
+            continue;
+
+        if (f->program >= 0)
+        {
+            if (pid == TS_PID_PAT)
+            {
+                const uint8_t *payload = ts_payload(pkt);
+                if (payload && filter_pat(f, pkt, payload, out + n))
+                    n += TS_PACKET_SIZE;
+                continue;
+            }
+            if (pid == f->pmt_pid)
+            {
+                const uint8_t *payload = ts_payload(pkt);
+                if (payload)
+                    filter_pmt(f, pkt, payload);
+            }
+            // 其他节目的 PMT 和 ES 不转发，PSI/SI 只按 drop 过滤
+            else if (pid >= TS_PID_MIN_ES && !pid_test(f->keep, pid))
+                continue;
+        }
+
+        memcpy(out + n, pkt, TS_PACKET_SIZE);
+        n += TS_PACKET_SIZE;
+    }
+
+    memcpy(out + n, buf + off, len - off);
+    return n + len - off;
+}
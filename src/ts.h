@@ -0,0 +1,58 @@
+#ifndef TS_H
+#define TS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define TS_PACKET_SIZE 188
+#define TS_SYNC_BYTE 0x47
+#define TS_PID_PAT 0x0000
+#define TS_PID_NULL 0x1FFF
+#define TS_PID_COUNT 8192
+#define TS_PSI_SECTION_MAX 1024 // 3 字节表头 + 最长 1021 字节的 section_length
+
+#define TS_FOUND_PAT 0x1
+#define TS_FOUND_RAP 0x2
+
+// 从 PAT/PMT 中学到的节目信息，-1 表示尚未知道
+struct ts_psi
+{
+    int pmt_pid;
+    int video_pid;
+};
+
+// 按客户端的 TS 过滤：只保留选中节目的 PID（PAT 改写为只含该节目），并丢弃指定的 PID
+struct ts_filter
+{
+    int program;                      // 选中的节目号，-1 表示不按节目过滤
+    int pmt_pid;                      // 从 PAT 中学到，-1 表示尚未知道
+    uint8_t drop[TS_PID_COUNT / 8];   // 要丢弃的 PID
+    uint8_t keep[TS_PID_COUNT / 8];   // 选中节目的 PCR 和 ES PID，来自 PMT
+    uint8_t pmt_sec[TS_PSI_SECTION_MAX]; // 正在拼接的 PMT 节，音轨或描述符多时会跨几个 TS 包
+    int pmt_len;                      // 已收到的字节数，0 表示没有在拼接
+    int pmt_cc;                       // 上一个 PMT 包的连续计数
+};
+
+void ts_psi_init(struct ts_psi *psi);
+
+// 扫描一段 TS 数据，返回 TS_FOUND_* 标志：是否含 PAT，视频 PID 上是否有随机访问点
+int ts_scan(struct ts_psi *psi, const uint8_t *buf, size_t len);
+
+// 完整性检查的计数，由调用方累加到会话
+struct ts_check_result
+{
+    uint64_t packets;
+    uint64_t cc_errors;   // 连续计数错误
+    uint64_t sync_errors; // 同步字节不对的包，以及不足 188 字节的尾部
+    uint64_t tei;         // transport_error_indicator 置位的包
+};
+
+// 检查同步字节、TEI 和逐 PID 的连续计数，结果累加到 r。cc 为 TS_PID_COUNT 字节的状态表，初始全 0
+void ts_check(uint8_t *cc, const uint8_t *buf, size_t len, struct ts_check_result *r);
+
+// drop 为逗号分隔的 PID（十进制或 0x 十六进制）或表名 null/nit/sdt/eit/tdt，可以为空；空包总是丢弃
+int ts_filter_init(struct ts_filter *f, int program, const char *drop);
+// 把 buf 中保留的包写到 out，返回写出的字节数，out 至少 len 字节。不以同步字节开头的部分原样写出
+size_t ts_filter_apply(struct ts_filter *f, const uint8_t *buf, size_t len, uint8_t *out);
+
+#endif
@@ -0,0 +1,59 @@
+#include "ts.h"
+
+// 连续计数状态表中每个 PID 一个字节
+#define TS_CC_MASK 0x0F
+#define TS_CC_SEEN 0x10 // 已见过该 PID
+#define TS_CC_DUP 0x20  // 上一个包是重复包，再重复就算错误
+
+// 返回 1 表示连续计数出错。规则按 ETSI TR 101 290 的 Continuity_count_error
+static int ts_cc_check(uint8_t *cc, const uint8_t *pkt)
+{
+    int pid = ((pkt[1] & 0x1F) << 8) | pkt[2];
+    if (pid == TS_PID_NULL)
+        return 0;
+
+    int afc = (pkt[3] >> 4) & 0x3;
+    int cur = pkt[3] & TS_CC_MASK;
+    uint8_t prev = cc[pid];
+    cc[pid] = TS_CC_SEEN | cur;
+
+    if (!(prev & TS_CC_SEEN))
+        return 0;
+    // discontinuity_indicator 置位时计数可以跳变
+    if ((afc & 0x2) && pkt[4] > 0 && (pkt[5] & 0x80))
+        return 0;
+
+    int last = prev & TS_CC_MASK;
+    // 没有负载的包不递增计数
+    if (!(afc & 0x1))
+        return cur != last;
+    // 允许一个重复包
+    if (cur == last)
+    {
+        if (prev & TS_CC_DUP)
+            return 1;
+        cc[pid] |= TS_CC_DUP;
+        return 0;
+    }
+    return cur != ((last + 1) & TS_CC_MASK);
+}
+
+void ts_check(uint8_t *cc, const uint8_t *buf, size_t len, struct ts_check_result *r)
+{
+    size_t count = len / TS_PACKET_SIZE;
+    if (len % TS_PACKET_SIZE)
+        r->sync_errors++;
+
+    r->packets += count;
+    for (size_t i = 0; i < count; i++)
+    {
+        const uint8_t *pkt = buf + i * TS_PACKET_SIZE;
+        // 失步或传输错误的包头不可信，不参与连续计数
+        if (pkt[0] != TS_SYNC_BYTE)
+            r->sync_errors++;
+        else if (pkt[1] & 0x80)
+            r->tei++;
+        else
+            r->cc_errors += ts_cc_check(cc, pkt);
+    }
+}